@@ -0,0 +1,310 @@
+/* band.c - Band decoder, frequency stream to band data outputs.
+ *
+ * Antenna switches, filters and amplifiers want to know which band the
+ * radio is on. In monitor mode ptt reads the radio's frequency from a
+ * stream, looks it up in the [BANDS] table and drives the state=BAND
+ * output lines with the band's bit pattern, e.g. the 4 bit BCD code the
+ * usual band decoders take.
+ *
+ * The frequencies come one per line, in Hz, from a file or FIFO, from
+ * stdin ('-'), or straight from a rigctld, which is asked for the
+ * frequency ('f') every Poll ms. The source is non-blocking and drained
+ * once per sample, and only the latest frequency counts. A rigctld that
+ * goes away is reconnected to, backing off from BAND_RETRY_MIN to
+ * BAND_RETRY_MAX ms between tries; the band lines keep the last band.
+ *
+ * The table is sorted and checked for overlaps once at start up, so a
+ * lookup is a binary search. Nothing is written unless the
+ * band changes, and then every band line is written in the same sample
+ * period as the frequency was read in, one MCR write per port.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "band.h"
+
+/* A [BANDS] entry: <name>=<low Hz>-<high Hz>,<pattern> */
+int band_parse(band_def * b, const char * name, const char * value)
+{
+	char * p;
+
+	memset(b, 0x00, sizeof(band_def));
+	strncpy(b->name, name, sizeof(b->name) - 1);
+
+	b->low = strtoll(value, &p, 10);
+	if (*p != '-')
+		return(ERROR);
+	b->high = strtoll(p + 1, &p, 10);
+	if (*p != ',' || b->high < b->low)
+		return(ERROR);
+	b->pattern = strtoul(p + 1, &p, 0);
+	if (*p != '\0')
+		return(ERROR);
+	return(PASS);
+}
+
+static int band_cmp(const void * a, const void * b)
+{
+	const band_def * x = (const band_def *)a;
+	const band_def * y = (const band_def *)b;
+
+	return(x->low < y->low ? -1 : x->low > y->low ? 1 : 0);
+}
+
+/* Sort the table by frequency and reject overlapping bands */
+int band_compile(band_def * bands, int count)
+{
+	int i;
+
+	qsort(bands, count, sizeof(band_def), band_cmp);
+	for (i = 1; i < count; i++)
+		if (bands[i].low <= bands[i - 1].high)
+		{
+			printf("Bands '%s' and '%s' overlap\n", bands[i - 1].name, bands[i].name);
+			return(ERROR);
+		}
+	return(PASS);
+}
+
+/* Index of the band holding 'freq', or BAND_NONE */
+int band_lookup(const band_def * bands, int count, long long freq)
+{
+	int lo = 0;
+	int hi = count - 1;
+	int mid;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if (freq < bands[mid].low)
+			hi = mid - 1;
+		else if (freq > bands[mid].high)
+			lo = mid + 1;
+		else
+			return(mid);
+	}
+	return(BAND_NONE);
+}
+
+/* rigctld:<host>:<port>. At start up the connect is waited for, so a
+ * wrong address is reported; a reconnect must not stall the monitor
+ * loop, it completes in the background and a refusal shows up as a
+ * read or send error.
+ */
+static int band_connect(const char * spec, int wait)
+{
+	struct addrinfo hints;
+	struct addrinfo * res;
+	char host[128];
+	const char * port;
+	int fd;
+
+	port = strrchr(spec, ':');
+	if (port == NULL || port - spec >= (int)sizeof(host))
+		return(-1);
+	memcpy(host, spec, port - spec);
+	host[port - spec] = '\0';
+
+	memset(&hints, 0x00, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port + 1, &hints, &res) != 0)
+		return(-1);
+
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd >= 0 && !wait)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0 &&
+		(wait || errno != EINPROGRESS))
+	{
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return(fd);
+}
+
+int band_open(band_decoder * d, const char * source, int poll_ms,
+	const band_def * bands, int count, unsigned int def_pattern)
+{
+	struct stat sb;
+
+	memset(d, 0x00, sizeof(band_decoder));
+	d->bands = bands;
+	d->count = count;
+	d->def_pattern = def_pattern;
+	d->current = BAND_UNKNOWN;
+
+	if (strcmp(source, "-") == 0)
+		d->fd = dup(0);
+	else if (strncmp(source, "rigctld:", 8) == 0)
+	{
+		strncpy(d->source, source + 8, sizeof(d->source) - 1);
+		d->fd = band_connect(d->source, TRUE);
+		d->poll_ms = poll_ms > 0 ? poll_ms : DEF_BAND_POLL;
+	}
+	else if (stat(source, &sb) == 0 && S_ISFIFO(sb.st_mode))
+		/* Read-write, so it never hangs up when a writer closes it */
+		d->fd = open(source, O_RDWR | O_NONBLOCK);
+	else
+		d->fd = open(source, O_RDONLY | O_NONBLOCK);
+	if (d->fd < 0)
+		return(-1);
+	fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) | O_NONBLOCK);
+	return(0);
+}
+
+/* One complete line: take it as the latest frequency */
+static void band_line(band_decoder * d)
+{
+	char * end;
+	long long freq;
+
+	d->line[d->used] = '\0';
+	d->used = 0;
+
+	freq = strtoll(d->line, &end, 10);
+	if (end == d->line || (*end != '\0' && *end != '\r'))
+	{
+		/* rigctld answers a failed command with 'RPRT <n>' */
+		d->errors++;
+		return;
+	}
+	d->freq = freq;
+	d->freqs++;
+	d->retry_ms = 0;
+}
+
+/* The rigctld went away: close up and try again after the backoff */
+static void band_lost(band_decoder * d, long long now_ns)
+{
+	if (d->fd >= 0)
+	{
+		close(d->fd);
+		d->fd = -1;
+		d->used = 0;
+		d->disconnects++;
+	}
+	if (d->retry_ms == 0)
+		d->retry_ms = BAND_RETRY_MIN;
+	else if (d->retry_ms < BAND_RETRY_MAX)
+		d->retry_ms *= 2;
+	d->retry_ns = now_ns + d->retry_ms * 1000000LL;
+}
+
+static int band_would_block(void)
+{
+	return(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/* Read whatever is waiting. Returns 1 if the band has changed, so the
+ * band lines need writing, 0 if not.
+ */
+int band_poll(band_decoder * d, long long now_ns)
+{
+	char buf[512];
+	unsigned long seen = d->freqs;
+	int band;
+	int len;
+	int i;
+
+	if (d->poll_ms > 0 && d->fd < 0)
+	{
+		if (now_ns < d->retry_ns)
+			return(0);
+		d->fd = band_connect(d->source, FALSE);
+		if (d->fd < 0)
+		{
+			band_lost(d, now_ns);
+			return(0);
+		}
+		d->asked_ns = 0;
+	}
+
+	/* Not write(), a closed socket would raise SIGPIPE. While the
+	 * connect is still going this would block, ask next time.
+	 */
+	if (d->poll_ms > 0 && now_ns - d->asked_ns >= d->poll_ms * 1000000LL)
+	{
+		if (send(d->fd, "f\n", 2, MSG_NOSIGNAL) < 0 && !band_would_block() &&
+			errno != ENOTCONN)
+		{
+			band_lost(d, now_ns);
+			return(0);
+		}
+		d->asked_ns = now_ns;
+	}
+
+	while ((len = read(d->fd, buf, sizeof(buf))) > 0)
+		for (i = 0; i < len; i++)
+		{
+			if (buf[i] == '\n')
+				band_line(d);
+			else if (d->used < BAND_LINE - 1)
+				d->line[d->used++] = buf[i];
+		}
+
+	/* End of file on a socket is the rigctld closing it. A file just
+	 * has nothing more yet.
+	 */
+	if (d->poll_ms > 0 && (len == 0 || !band_would_block()))
+		band_lost(d, now_ns);
+
+	if (d->freqs == seen)
+		return(0);
+
+	band = band_lookup(d->bands, d->count, d->freq);
+	if (band == d->current)
+		return(0);
+	d->current = band;
+	d->changes++;
+	return(1);
+}
+
+/* When band_poll() next has something to do on its own, 0 if only when
+ * the source has data: the next question to the rigctld, or the next
+ * reconnect.
+ */
+long long band_due(const band_decoder * d)
+{
+	if (d->poll_ms == 0)
+		return(0);
+	if (d->fd < 0)
+		return(d->retry_ns);
+	return(d->asked_ns + d->poll_ms * 1000000LL);
+}
+
+unsigned int band_pattern(const band_decoder * d)
+{
+	if (d->current < 0)
+		return(d->def_pattern);
+	return(d->bands[d->current].pattern);
+}
+
+const char * band_name(const band_decoder * d)
+{
+	if (d->current == BAND_UNKNOWN)
+		return("unknown");
+	if (d->current == BAND_NONE)
+		return("none");
+	return(d->bands[d->current].name);
+}
+
+void band_close(band_decoder * d)
+{
+	if (d->fd >= 0)
+		close(d->fd);
+	d->fd = -1;
+}
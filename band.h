@@ -0,0 +1,58 @@
+/* band.h - Band decoder, frequency stream to band data outputs.
+
+*/
+
+#ifndef __BAND_H__
+#define __BAND_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+#define BAND_NONE		-1			// Frequency outside every band
+#define BAND_UNKNOWN	-2			// No frequency seen yet
+#define BAND_LINE		128			// Longest frequency line
+#define DEF_BAND_POLL	100			// rigctld poll interval (ms)
+#define BAND_RETRY_MIN	250			// rigctld reconnect backoff, first (ms)
+#define BAND_RETRY_MAX	8000		// rigctld reconnect backoff, longest (ms)
+
+typedef struct
+{
+	int fd;						// Frequency source, non-blocking
+	int poll_ms;				// rigctld: ask every this many ms, 0 for a stream
+	long long asked_ns;			// rigctld: last time we asked
+	char source[128];			// rigctld: <host>:<port>, to reconnect to
+	int retry_ms;				// rigctld: reconnect backoff, 0 while connected
+	long long retry_ns;			// rigctld: next reconnect, while 'fd' is -1
+	char line[BAND_LINE];		// Partial line being assembled
+	int used;					// Bytes in 'line'
+	const band_def * bands;		// Compiled band table, sorted by 'low'
+	int count;
+	unsigned int def_pattern;	// Pattern outside every band
+	int current;				// Band index, BAND_NONE or BAND_UNKNOWN
+	long long freq;				// Last frequency (Hz)
+	unsigned long freqs;		// Frequencies read
+	unsigned long changes;		// Band changes
+	unsigned long errors;		// Lines that were not a frequency
+	unsigned long disconnects;	// rigctld: connections lost
+} band_decoder;
+
+int band_parse(band_def * b, const char * name, const char * value);
+int band_compile(band_def * bands, int count);
+int band_lookup(const band_def * bands, int count, long long freq);
+int band_open(band_decoder * d, const char * source, int poll_ms,
+	const band_def * bands, int count, unsigned int def_pattern);
+int band_poll(band_decoder * d, long long now_ns);
+long long band_due(const band_decoder * d);
+unsigned int band_pattern(const band_decoder * d);
+const char * band_name(const band_decoder * d);
+void band_close(band_decoder * d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BAND_H__ */
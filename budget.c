@@ -0,0 +1,100 @@
+/* budget.c - Memory budget for the embedded build profile.
+ *
+ * A station controller on a small board should know what memory it
+ * needs before it keys anything, and not find out at 3 AM. Built with
+ * 'make EMBEDDED=1' (PTT_EMBEDDED), the strings read from the config
+ * file and the command line are copied into a fixed pool here instead of
+ * being strdup()ed, and monitor mode sizes every table it uses from the
+ * config at start up, so nothing is allocated once the loop is running.
+ * If the pool fills up the config fails to load.
+ *
+ * The rest of this file reads back what the process really uses, for
+ * the budget report: resident and peak set sizes from /proc and the heap
+ * in use from the allocator.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <malloc.h>
+
+#include "budget.h"
+
+#ifdef PTT_EMBEDDED
+static char pool[CFG_POOL_SIZE];
+#endif
+static size_t pool_used;
+
+/* A copy of 's' that lives as long as the process, NULL if there is no
+ * room left for it.
+ */
+char * cfg_strdup(const char * s)
+{
+	size_t len = strlen(s) + 1;
+#ifdef PTT_EMBEDDED
+	char * p;
+
+	if (pool_used + len > CFG_POOL_SIZE)
+	{
+		printf("Config string pool full (%d bytes), can't keep '%s'\n", CFG_POOL_SIZE, s);
+		return(NULL);
+	}
+	p = &pool[pool_used];
+	memcpy(p, s, len);
+	pool_used += len;
+	return(p);
+#else
+	pool_used += len;
+	return(strdup(s));
+#endif
+}
+
+/* Bytes of config strings kept so far */
+size_t cfg_pool_used(void)
+{
+	return(pool_used);
+}
+
+/* A 'VmXXX:' field of /proc/self/status in kB, -1 if it can't be read.
+ * Read with a stack buffer, so asking doesn't allocate.
+ */
+long budget_proc_kb(const char * field)
+{
+	char buf[4096];
+	char * p;
+	size_t len = strlen(field);
+	ssize_t n;
+	int fd;
+
+	fd = open("/proc/self/status", O_RDONLY);
+	if (fd < 0)
+		return(-1);
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return(-1);
+	buf[n] = '\0';
+
+	for (p = buf; p != NULL; p = strchr(p, '\n'))
+	{
+		if (*p == '\n')
+			p++;
+		if (strncmp(p, field, len) == 0 && p[len] == ':')
+			return(atol(&p[len + 1]));
+	}
+	return(-1);
+}
+
+/* Bytes the allocator has handed out and not had back */
+long budget_heap(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+
+	return((long)(mi.uordblks + mi.hblkhd));
+}
@@ -0,0 +1,26 @@
+/* budget.h - Memory budget for the embedded build profile.
+
+*/
+
+#ifndef __BUDGET_H__
+#define __BUDGET_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define CFG_POOL_SIZE	8192		// Config and command line strings (bytes)
+
+char * cfg_strdup(const char * s);
+size_t cfg_pool_used(void);
+long budget_proc_kb(const char * field);
+long budget_heap(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BUDGET_H__ */
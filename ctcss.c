@@ -0,0 +1,229 @@
+/* ctcss.c - CTCSS sub-audible tone detector for tone qualified COR.
+ *
+ * Carrier only COR from DCD lets interference key a repeater. When a
+ * [CTCSS] section is configured, monitor mode feeds the receiver's
+ * discriminator audio (see pcm.c) through this detector, and COR is only
+ * passed on while the configured tone is present.
+ *
+ * The audio goes through a 4th order low pass at 270 Hz to keep voice
+ * out of the measurement and is averaged down to about 1 kHz. Goertzel
+ * filters then measure the power at the tone and at the standard tones
+ * either side of it, one sub-block at a time. Every sub-block the last
+ * CTCSS_SUBBLOCKS sub-blocks are combined into one analysis window, so
+ * with the default 50 ms sub-blocks the decision is made on a 150 ms
+ * window every 50 ms. The tone is present when it holds at least the
+ * threshold share of the window's AC power and is stronger than both of
+ * its neighbours, which keeps an adjacent tone from qualifying COR.
+ *
+ * At 1 kHz the three Goertzel filters cost a few thousand multiply adds
+ * per second, the low pass a few more per input sample.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "ctcss.h"
+
+/* The EIA standard CTCSS tones */
+static const double ctcss_tones[] = {
+	67.0, 69.3, 71.9, 74.4, 77.0, 79.7, 82.5, 85.4, 88.5, 91.5,
+	94.8, 97.4, 100.0, 103.5, 107.2, 110.9, 114.8, 118.8, 123.0, 127.3,
+	131.8, 136.5, 141.3, 146.2, 151.4, 156.7, 159.8, 162.2, 165.5, 167.9,
+	171.3, 173.8, 177.3, 179.9, 183.5, 186.2, 189.9, 192.8, 196.6, 199.5,
+	203.5, 206.5, 210.7, 218.1, 225.7, 229.1, 233.6, 241.8, 250.3, 254.1,
+	0.0
+};
+
+static void biquad_lowpass(ctcss_biquad * bq, double fc, double q, double rate)
+{
+	double w0 = 2.0 * M_PI * fc / rate;
+	double alpha = sin(w0) / (2.0 * q);
+	double a0 = 1.0 + alpha;
+
+	bq->b0 = (1.0 - cos(w0)) / 2.0 / a0;
+	bq->b1 = (1.0 - cos(w0)) / a0;
+	bq->b2 = bq->b0;
+	bq->a1 = -2.0 * cos(w0) / a0;
+	bq->a2 = (1.0 - alpha) / a0;
+	bq->z1 = 0.0;
+	bq->z2 = 0.0;
+}
+
+static double biquad_run(ctcss_biquad * bq, double x)
+{
+	double y = bq->b0 * x + bq->z1;
+
+	bq->z1 = bq->b1 * x - bq->a1 * y + bq->z2;
+	bq->z2 = bq->b2 * x - bq->a2 * y;
+	return(y);
+}
+
+static void ctcss_bin(ctcss * t, int bin, double freq, double drate)
+{
+	double w = 2.0 * M_PI * freq / drate;
+
+	t->coeff[bin] = 2.0 * cos(w);
+	t->cw[bin] = cos(w);
+	t->sw[bin] = sin(w);
+	t->rot_re[bin] = cos(w * t->sub);
+	t->rot_im[bin] = -sin(w * t->sub);
+}
+
+void ctcss_init(ctcss * t, int rate, double tone, double threshold, int block_ms)
+{
+	double drate;
+	double lower = tone * 0.965;
+	double upper = tone * 1.035;
+	int i;
+
+	memset(t, 0x00, sizeof(ctcss));
+
+	t->decim = rate / CTCSS_DECIM_RATE;
+	if (t->decim < 1)
+		t->decim = 1;
+	drate = (double)rate / t->decim;
+
+	t->sub = (int)(block_ms * drate / 1000.0);
+	if (t->sub < 8)
+		t->sub = 8;
+
+	/* Butterworth Q values for two cascaded 2nd order sections */
+	biquad_lowpass(&t->lp[0], CTCSS_LOWPASS, 0.5412, rate);
+	biquad_lowpass(&t->lp[1], CTCSS_LOWPASS, 1.3066, rate);
+
+	/* The neighbours are the nearest standard tones either side */
+	for (i = 0; ctcss_tones[i] > 0.0; i++)
+	{
+		if (ctcss_tones[i] < tone - 0.5)
+			lower = ctcss_tones[i];
+		else if (ctcss_tones[i] > tone + 0.5)
+		{
+			upper = ctcss_tones[i];
+			break;
+		}
+	}
+
+	ctcss_bin(t, 0, tone, drate);
+	ctcss_bin(t, 1, lower, drate);
+	ctcss_bin(t, 2, upper, drate);
+
+	t->threshold = threshold;
+}
+
+/* End of a sub-block: store its DFT and evaluate the window */
+static void ctcss_subblock(ctcss * t)
+{
+	double power[CTCSS_BINS];
+	double re;
+	double im;
+	double tr;
+	double sum = 0.0;
+	double energy = 0.0;
+	double ac;
+	int slot;
+	int bin;
+	int k;
+	int hit;
+
+	for (bin = 0; bin < CTCSS_BINS; bin++)
+	{
+		/* DFT of the sub-block, less a phase factor common to all of them */
+		t->x_re[t->head][bin] = t->s1[bin] - t->cw[bin] * t->s2[bin];
+		t->x_im[t->head][bin] = t->sw[bin] * t->s2[bin];
+		t->s1[bin] = 0.0;
+		t->s2[bin] = 0.0;
+	}
+	t->x_sum[t->head] = t->sum;
+	t->x_energy[t->head] = t->energy;
+	t->sum = 0.0;
+	t->energy = 0.0;
+	t->n = 0;
+
+	t->head = (t->head + 1) % CTCSS_SUBBLOCKS;
+	if (t->filled < CTCSS_SUBBLOCKS)
+	{
+		t->filled++;
+		if (t->filled < CTCSS_SUBBLOCKS)
+			return;
+	}
+
+	/* Combine the sub-blocks, newest first by Horner's rule, so each
+	 * later sub-block is rotated by the phase the window has advanced.
+	 */
+	for (bin = 0; bin < CTCSS_BINS; bin++)
+	{
+		re = 0.0;
+		im = 0.0;
+		for (k = 0; k < CTCSS_SUBBLOCKS; k++)
+		{
+			slot = (t->head + CTCSS_SUBBLOCKS - 1 - k) % CTCSS_SUBBLOCKS;
+			tr = re * t->rot_re[bin] - im * t->rot_im[bin];
+			im = re * t->rot_im[bin] + im * t->rot_re[bin];
+			re = tr + t->x_re[slot][bin];
+			im += t->x_im[slot][bin];
+		}
+		power[bin] = re * re + im * im;
+	}
+
+	for (k = 0; k < CTCSS_SUBBLOCKS; k++)
+	{
+		sum += t->x_sum[k];
+		energy += t->x_energy[k];
+	}
+	k = t->sub * CTCSS_SUBBLOCKS;
+	ac = energy - sum * sum / k;
+
+	/* A pure tone gives power = n * ac / 2 */
+	t->ratio = ac > 0.0 ? 2.0 * power[0] / (k * ac) : 0.0;
+	hit = (t->ratio >= t->threshold &&
+		power[0] > CTCSS_NEIGHBOUR * power[1] &&
+		power[0] > CTCSS_NEIGHBOUR * power[2]);
+
+	t->windows++;
+	if (hit)
+	{
+		t->hits++;
+		t->misses = 0;
+		t->present = 1;
+	}
+	else if (t->present && ++t->misses >= CTCSS_RELEASE)
+		t->present = 0;
+}
+
+/* Run 'count' input samples through the detector */
+void ctcss_feed(ctcss * t, const short * pcm, int count)
+{
+	double x;
+	double s0;
+	int bin;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		x = biquad_run(&t->lp[1], biquad_run(&t->lp[0], (double)pcm[i]));
+		t->acc += x;
+		if (++t->acc_n < t->decim)
+			continue;
+
+		x = t->acc / t->decim;
+		t->acc = 0.0;
+		t->acc_n = 0;
+
+		for (bin = 0; bin < CTCSS_BINS; bin++)
+		{
+			s0 = x + t->coeff[bin] * t->s1[bin] - t->s2[bin];
+			t->s2[bin] = t->s1[bin];
+			t->s1[bin] = s0;
+		}
+		t->sum += x;
+		t->energy += x * x;
+
+		if (++t->n >= t->sub)
+			ctcss_subblock(t);
+	}
+	t->samples += count;
+}
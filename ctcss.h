@@ -0,0 +1,68 @@
+/* ctcss.h - CTCSS sub-audible tone detector for tone qualified COR.
+
+*/
+
+#ifndef __CTCSS_H__
+#define __CTCSS_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEF_CTCSS_THRESHOLD	0.3		// Tone to total power ratio
+#define DEF_CTCSS_BLOCK		50		// Sub-block length (ms)
+#define CTCSS_SUBBLOCKS		3		// Sub-blocks per analysis window
+#define CTCSS_BINS			3		// Tone, lower and upper neighbour
+#define CTCSS_NEIGHBOUR		1.0		// Tone power over neighbour power, minimum
+#define CTCSS_RELEASE		2		// Missed windows before tone drops
+#define CTCSS_DECIM_RATE	1000	// Rate the detector runs at (Hz)
+#define CTCSS_LOWPASS		270.0	// Voice rejection low pass corner (Hz)
+
+typedef struct
+{
+	double b0, b1, b2;			// Numerator coefficients
+	double a1, a2;				// Denominator coefficients
+	double z1, z2;				// State
+} ctcss_biquad;
+
+typedef struct
+{
+	int decim;					// Input samples averaged per detector sample
+	int sub;					// Detector samples per sub-block
+	double threshold;			// Tone present when power ratio is above
+	ctcss_biquad lp[2];			// 4th order Butterworth low pass
+	double coeff[CTCSS_BINS];	// Goertzel coefficients, 2cos(w)
+	double cw[CTCSS_BINS];		// cos(w)
+	double sw[CTCSS_BINS];		// sin(w)
+	double rot_re[CTCSS_BINS];	// e^-jwL, phase step between sub-blocks
+	double rot_im[CTCSS_BINS];
+	double s1[CTCSS_BINS];		// Goertzel state
+	double s2[CTCSS_BINS];
+	double x_re[CTCSS_SUBBLOCKS][CTCSS_BINS];	// Sub-block DFT ring
+	double x_im[CTCSS_SUBBLOCKS][CTCSS_BINS];
+	double x_sum[CTCSS_SUBBLOCKS];				// Sub-block sums, for DC
+	double x_energy[CTCSS_SUBBLOCKS];			// Sub-block energies
+	int head;					// Next sub-block slot in the ring
+	int filled;					// Sub-blocks in the ring
+	double acc;					// Decimator accumulator
+	int acc_n;					// Samples in the accumulator
+	double sum;					// Current sub-block sum
+	double energy;				// Current sub-block energy
+	int n;						// Detector samples in this sub-block
+	int misses;					// Windows in a row without the tone
+	int present;				// Tone decision
+	double ratio;				// Power ratio of the last window
+	unsigned long windows;		// Windows evaluated
+	unsigned long hits;			// Windows with the tone found
+	unsigned long samples;		// Input samples consumed
+} ctcss;
+
+void ctcss_init(ctcss * t, int rate, double tone, double threshold, int block_ms);
+void ctcss_feed(ctcss * t, const short * pcm, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CTCSS_H__ */
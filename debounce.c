@@ -0,0 +1,87 @@
+/* debounce.c - Digital debounce and glitch filter for input lines.
+ *
+ * Squelch (COR) and footswitch inputs chatter. Each input sample is run
+ * through a small counter or integrator filter with separate assert and
+ * release times, and the filtered output can be made to hold each state
+ * for a minimum pulse width. The cost per sample is a handful of integer
+ * compares whatever the filter times are.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <string.h>
+
+#include "debounce.h"
+
+void debounce_init(debounce * db, int mode, int assert_n, int release_n, int minpulse_n, int initial)
+{
+	memset(db, 0x00, sizeof(debounce));
+	db->mode = mode;
+	db->assert_n = assert_n;
+	db->release_n = release_n;
+	db->minpulse_n = minpulse_n;
+	db->raw = initial;
+	db->out = initial;
+	db->hold = minpulse_n;
+}
+
+/* Feed one raw sample (0 or 1) to the filter, return the filtered value. */
+int debounce_sample(debounce * db, int raw)
+{
+	if (raw != db->raw)
+	{
+		db->raw = raw;
+		db->raw_edges++;
+	}
+
+	if (db->hold < db->minpulse_n)
+		db->hold++;
+
+	if (raw == db->out)
+	{
+		if (db->mode == FILTER_INTEGRATOR)
+		{
+			if (db->count > 0)
+				db->count--;
+		}
+		else
+			db->count = 0;
+		return(db->out);
+	}
+
+	db->count++;
+	if (db->count >= (db->out ? db->release_n : db->assert_n) &&
+		db->hold >= db->minpulse_n)
+	{
+		db->out = raw;
+		db->count = 0;
+		db->hold = 0;
+		db->edges++;
+	}
+	return(db->out);
+}
+
+int getFilterMode(const char * name)
+{
+	if (strcmp(name, "COUNTER") == 0)
+		return(FILTER_COUNTER);
+	else if (strcmp(name, "INTEGRATOR") == 0)
+		return(FILTER_INTEGRATOR);
+	else
+		return(-1);
+}
+
+const char * getFilterName(int mode)
+{
+	switch (mode)
+	{
+		case FILTER_COUNTER:
+			return("COUNTER");
+		case FILTER_INTEGRATOR:
+			return("INTEGRATOR");
+		default:
+			return("ERROR");
+	}
+}
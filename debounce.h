@@ -0,0 +1,42 @@
+/* debounce.h - Digital debounce and glitch filter for input lines.
+
+*/
+
+#ifndef __DEBOUNCE_H__
+#define __DEBOUNCE_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Filter modes, selected per line with 'filter=' */
+enum {
+	FILTER_COUNTER,		// Consecutive samples, reset by any agreeing sample
+	FILTER_INTEGRATOR	// Disagreeing samples count up, agreeing ones count down
+};
+
+typedef struct
+{
+	int mode;					// FILTER_COUNTER or FILTER_INTEGRATOR
+	int assert_n;				// Samples active before the output asserts
+	int release_n;				// Samples inactive before the output releases
+	int minpulse_n;				// Samples the output holds each state, minimum
+	int count;					// Counter/integrator value
+	int hold;					// Samples since the last output edge
+	int raw;					// Last raw input value
+	int out;					// Filtered output value
+	unsigned long raw_edges;	// Edges seen on the raw input
+	unsigned long edges;		// Edges passed to the filtered output
+} debounce;
+
+void debounce_init(debounce * db, int mode, int assert_n, int release_n, int minpulse_n, int initial);
+int debounce_sample(debounce * db, int raw);
+int getFilterMode(const char * name);
+const char * getFilterName(int mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEBOUNCE_H__ */
@@ -0,0 +1,186 @@
+/* evdev.c - Linux input device (footswitch, keyboard) inputs.
+ *
+ * USB footswitches and the like show up as input devices, not serial
+ * lines. A line section with device=<path> (or device=name:<device
+ * name>, matched against the names of /dev/input/event*) and key=<code>
+ * is an input like a CTS or DCD one: key down is active, key up is not,
+ * and it goes through the same filter and into COR. With grab=1 ptt
+ * takes the device for itself so its key presses don't also reach the
+ * desktop.
+ *
+ * Events are stamped by the kernel on CLOCK_MONOTONIC, the same clock
+ * the monitor loop runs on, so the time from the key press to the MCR
+ * write it causes can be measured.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "evdev.h"
+
+/* Find the event device whose name is 'name' */
+static int evdev_find(const char * name)
+{
+	char path[300];
+	char devname[256];
+	struct dirent * de;
+	DIR * dir;
+	int fd = -1;
+
+	dir = opendir("/dev/input");
+	if (dir == NULL)
+		return(-1);
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (strncmp(de->d_name, "event", 5) != 0)
+			continue;
+		snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+		fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		memset(devname, 0x00, sizeof(devname));
+		if (ioctl(fd, EVIOCGNAME(sizeof(devname) - 1), devname) >= 0 &&
+			strcmp(devname, name) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	closedir(dir);
+	return(fd);
+}
+
+/* Open an input device by path or by 'name:<device name>' */
+int evdev_open(const char * spec, int grab)
+{
+	int clock = CLOCK_MONOTONIC;
+	int fd;
+
+	if (strncmp(spec, "name:", 5) == 0)
+		fd = evdev_find(spec + 5);
+	else
+		fd = open(spec, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return(-1);
+
+	/* Stamp events on the monitor loop's clock */
+	ioctl(fd, EVIOCSCLOCKID, &clock);
+
+	if (grab && ioctl(fd, EVIOCGRAB, 1) != 0)
+	{
+		close(fd);
+		return(-1);
+	}
+	return(fd);
+}
+
+/* Start following 'key' (or any key) on 'fd', with the keys that are
+ * down already, so one held when ptt starts is not missed.
+ */
+void evdev_init(evdev_key * k, int fd, int key)
+{
+	int i;
+
+	memset(k, 0x00, sizeof(evdev_key));
+	k->fd = fd;
+	k->key = key;
+	if (fd < 0 || ioctl(fd, EVIOCGKEY(sizeof(k->held)), k->held) < 0)
+		memset(k->held, 0x00, sizeof(k->held));
+
+	for (i = 0; i < EVDEV_KEYS; i++)
+		if ((k->held[i / 8] & (1 << (i % 8))) && (key == EVDEV_ANY_KEY || i == key))
+			k->n_held++;
+	k->level = k->n_held > 0;
+	k->pending = k->level;
+}
+
+/* One key event: update the keys down, and queue a change of level */
+static void evdev_key_event(evdev_key * k, const struct input_event * ev)
+{
+	unsigned char bit = 1 << (ev->code % 8);
+	int down = (k->held[ev->code / 8] & bit) != 0;
+	int level;
+
+	if (ev->value == down)
+		return;
+	if (ev->value)
+		k->held[ev->code / 8] |= bit;
+	else
+		k->held[ev->code / 8] &= ~bit;
+	if (k->key != EVDEV_ANY_KEY && ev->code != k->key)
+		return;
+
+	k->n_held += ev->value ? 1 : -1;
+	level = k->n_held > 0;
+	if (level == k->pending)
+		return;
+	k->pending = level;
+
+	/* Full: this change undoes the last one queued, drop both */
+	if (k->queued == EVDEV_QUEUE)
+	{
+		k->queued--;
+		k->lost += 2;
+		return;
+	}
+	k->queue[k->queued].level = level;
+	k->queue[k->queued].when_ns = ev->input_event_sec * 1000000000LL +
+		ev->input_event_usec * 1000LL;
+	k->queued++;
+}
+
+/* Read the events waiting on the device. The line is active while the
+ * key is down, or with key=ANY while any key is. Changes come back one
+ * per call, so a press and release read together are still a press for
+ * one sample; '->when_ns' gets the kernel's time of it. Returns 1 if the
+ * level changed, 0 if not, -1 if the device has gone.
+ */
+int evdev_read(evdev_key * k)
+{
+	struct input_event ev[16];
+	ssize_t len;
+	int n;
+	int i;
+
+	while ((len = read(k->fd, ev, sizeof(ev))) > 0)
+	{
+		n = len / sizeof(struct input_event);
+		for (i = 0; i < n; i++)
+		{
+			/* Auto repeat (2) is no change */
+			if (ev[i].type != EV_KEY || ev[i].value == 2 || ev[i].code >= EVDEV_KEYS)
+				continue;
+			evdev_key_event(k, &ev[i]);
+		}
+	}
+	if (len == 0 || (len < 0 && errno == ENODEV))
+		return(-1);
+
+	if (k->queued == 0)
+		return(0);
+	k->level = k->queue[0].level;
+	k->when_ns = k->queue[0].when_ns;
+	k->queued--;
+	memmove(&k->queue[0], &k->queue[1], k->queued * sizeof(evdev_change));
+	return(1);
+}
+
+void evdev_close(int fd)
+{
+	if (fd < 0)
+		return;
+	ioctl(fd, EVIOCGRAB, 0);
+	close(fd);
+}
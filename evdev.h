@@ -0,0 +1,48 @@
+/* evdev.h - Linux input device (footswitch, keyboard) inputs.
+
+*/
+
+#ifndef __EVDEV_H__
+#define __EVDEV_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVDEV_ANY_KEY	-1			// key=ANY, every key counts
+#define EVDEV_KEYS		0x300		// Key codes, KEY_CNT
+#define EVDEV_QUEUE		16			// Level changes kept between two reads
+
+/* A level change read from the device, not yet returned */
+typedef struct
+{
+	int level;
+	long long when_ns;
+} evdev_change;
+
+/* The key (or keys) an input line follows on its device */
+typedef struct
+{
+	int fd;							// Input device, -1 if none
+	int key;						// Key code, or EVDEV_ANY_KEY
+	int level;						// Level as last returned, 1 is down
+	long long when_ns;				// Time of the last change returned
+	unsigned char held[EVDEV_KEYS / 8];	// Keys down
+	int n_held;						// Keys down that count
+	int pending;					// Level after the queued changes
+	evdev_change queue[EVDEV_QUEUE];	// Changes read, oldest first
+	int queued;
+	unsigned long lost;				// Changes dropped from a full queue
+} evdev_key;
+
+int evdev_open(const char * spec, int grab);
+void evdev_init(evdev_key * k, int fd, int key);
+int evdev_read(evdev_key * k);
+void evdev_close(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __EVDEV_H__ */
@@ -0,0 +1,105 @@
+/* handover.c - State handover across an in-place re-exec (upgrade).
+ *
+ * To upgrade a running ptt --monitor without a gap in service, the new
+ * binary is put in place and the running one sent SIGUSR2. It writes the
+ * state it holds into an anonymous memfd, clears close-on-exec on that
+ * and on the fds it wants to keep (audio input, the recording in
+ * progress), and execs itself by its original argv[0] with the memfd's
+ * number in PTT_HANDOVER. The process id, the fds and the port access
+ * survive the exec; the new binary reads the state back and carries on
+ * from where the old one stopped, without touching the lines.
+ *
+ * The state is an opaque block here, its layout belongs to the caller,
+ * who should check it before trusting it.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "handover.h"
+
+static int keep_on_exec(int fd)
+{
+	int flags = fcntl(fd, F_GETFD);
+
+	if (flags < 0)
+		return(-1);
+	return(fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC));
+}
+
+/* Write 'state' to a memfd and exec argv[0] with it. Only returns if
+ * something failed, in which case the caller just carries on.
+ */
+int handover_exec(char * const argv[], const void * state, size_t len,
+	const int * fds, int nfds)
+{
+	char num[16];
+	int fd;
+	int i;
+
+	fd = memfd_create("ptt-handover", 0);
+	if (fd < 0)
+		return(-1);
+
+	if (write(fd, state, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) != 0)
+	{
+		close(fd);
+		return(-1);
+	}
+
+	for (i = 0; i < nfds; i++)
+		if (fds[i] >= 0)
+			keep_on_exec(fds[i]);
+
+	snprintf(num, sizeof(num), "%d", fd);
+	setenv(HANDOVER_ENV, num, 1);
+	fflush(stdout);
+	execvp(argv[0], argv);
+
+	unsetenv(HANDOVER_ENV);
+	close(fd);
+	return(-1);
+}
+
+/* The state handed over by the previous binary, or NULL if we were not
+ * started by a handover. The caller frees it.
+ */
+void * handover_take(size_t * len)
+{
+	const char * env = getenv(HANDOVER_ENV);
+	struct stat st;
+	void * state;
+	int fd;
+
+	if (env == NULL)
+		return(NULL);
+	fd = atoi(env);
+	unsetenv(HANDOVER_ENV);
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		close(fd);
+		return(NULL);
+	}
+
+	state = malloc(st.st_size);
+	if (state != NULL && pread(fd, state, st.st_size, 0) != st.st_size)
+	{
+		free(state);
+		state = NULL;
+	}
+	close(fd);
+
+	*len = st.st_size;
+	return(state);
+}
@@ -0,0 +1,26 @@
+/* handover.h - State handover across an in-place re-exec (upgrade).
+
+*/
+
+#ifndef __HANDOVER_H__
+#define __HANDOVER_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define HANDOVER_ENV		"PTT_HANDOVER"	// Environment variable with the memfd
+#define HANDOVER_MAX_FDS	8				// Open fds passed on
+
+int handover_exec(char * const argv[], const void * state, size_t len,
+	const int * fds, int nfds);
+void * handover_take(size_t * len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HANDOVER_H__ */
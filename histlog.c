@@ -0,0 +1,906 @@
+/* histlog.c - Append-only history log of MCR line transitions.
+ *
+ * Every time ptt changes the MCR of a port, one fixed size record is
+ * appended to the history file with a single write(). Monitor mode also
+ * records every filtered input edge, and keeps its records in memory
+ * instead: noting one is a clock read and a few stores, and the batch
+ * goes out in one write() once the period's MCR writes are done, when it
+ * is half full or its oldest record is HIST_FLUSH_MS old.
+ *
+ * So the file is only nearly in time order: a batch can land after a
+ * one-shot ptt's later record, and the clock can be stepped. Queries
+ * mmap the file and keep an index beside it, '<file>.idx', of each
+ * block's time range and the last write to each MCR in it. The blocks
+ * the window can be in are found from the index and binary searched
+ * where they are in order, copied out and sorted where they are not,
+ * and the state before the window comes from the index too, so asking
+ * for the total TX time of a line over months of history only touches
+ * the records inside the window.
+ *
+ * The same records can be exported as Chrome trace event JSON for a
+ * timeline view of every line of every port.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "histlog.h"
+
+#define HIST_DTR	0x01		// MCR Bit 0
+#define HIST_RTS	0x02		// MCR Bit 1
+
+/* Append one transition record to the history file. The file is opened
+ * O_APPEND so concurrent ptt invocations never overwrite each other's
+ * records. Returns 0 on success, -1 on error.
+ */
+int hist_append(const char * file, int address, unsigned char old_mcr, unsigned char new_mcr)
+{
+	hist_record rec;
+	struct timespec ts;
+	int fd;
+	ssize_t n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	memset(&rec, 0x00, sizeof(rec));
+	rec.sec = (unsigned int)ts.tv_sec;
+	rec.nsec = (unsigned int)ts.tv_nsec;
+	rec.address = (unsigned short)address;
+	rec.old_mcr = old_mcr;
+	rec.new_mcr = new_mcr;
+
+	fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0)
+		return(-1);
+
+	n = write(fd, &rec, sizeof(rec));
+	close(fd);
+
+	return(n == sizeof(rec) ? 0 : -1);
+}
+
+/* Open the history file for batched appends. Returns 0 on success */
+int hist_open(hist_writer * w, const char * file)
+{
+	memset(w, 0x00, sizeof(hist_writer));
+	w->fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	return(w->fd < 0 ? -1 : 0);
+}
+
+/* Note a record. No system call but the clock, which is the vDSO */
+void hist_add(hist_writer * w, int kind, int address, int line,
+	unsigned char old_mcr, unsigned char new_mcr)
+{
+	hist_record * rec;
+	struct timespec ts;
+
+	if (w->n >= HIST_BATCH)
+	{
+		w->dropped++;
+		return;
+	}
+	if (w->n == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		w->first_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	rec = &w->buf[w->n++];
+	memset(rec, 0x00, sizeof(hist_record));
+	rec->sec = (unsigned int)ts.tv_sec;
+	rec->nsec = (unsigned int)ts.tv_nsec;
+	rec->address = (unsigned short)address;
+	rec->old_mcr = old_mcr;
+	rec->new_mcr = new_mcr;
+	rec->kind = kind;
+	rec->line = line;
+}
+
+/* Whether the batch should be written at CLOCK_MONOTONIC 'now_ns' */
+int hist_due(const hist_writer * w, long long now_ns)
+{
+	if (w->n == 0)
+		return(0);
+	return(w->n >= HIST_BATCH / 2 || now_ns >= hist_next(w));
+}
+
+/* When the waiting records must be written by, 0 if there are none */
+long long hist_next(const hist_writer * w)
+{
+	if (w->n == 0)
+		return(0);
+	return(w->first_ns + HIST_FLUSH_MS * 1000000LL);
+}
+
+/* Write the waiting records. Returns 0 on success, -1 if any were lost */
+int hist_flush(hist_writer * w)
+{
+	ssize_t n;
+	int count = w->n;
+
+	if (count == 0)
+		return(0);
+	w->n = 0;
+	w->writes++;
+	n = write(w->fd, w->buf, count * sizeof(hist_record));
+	if (n < 0)
+		n = 0;
+	w->records += n / sizeof(hist_record);
+	w->dropped += count - n / sizeof(hist_record);
+	return(n == count * (ssize_t)sizeof(hist_record) ? 0 : -1);
+}
+
+void hist_close(hist_writer * w)
+{
+	if (w->fd < 0)
+		return;
+	hist_flush(w);
+	close(w->fd);
+	w->fd = -1;
+}
+
+/* Parse a time given either as seconds since the epoch or as local time
+ * in the form 'YYYY-MM-DD[THH:MM[:SS]]'. Returns -1 if not recognized.
+ */
+time_t hist_parse_time(const char * s)
+{
+	struct tm tm;
+	const char * p;
+	const char * fmts[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d", NULL
+	};
+	int i;
+
+	for (p = s; *p && isdigit((unsigned char)*p); p++)
+		;
+	if (p != s && *p == '\0')
+		return((time_t)atol(s));
+
+	for (i = 0; fmts[i] != NULL; i++)
+	{
+		memset(&tm, 0x00, sizeof(tm));
+		p = strptime(s, fmts[i], &tm);
+		if (p != NULL && *p == '\0')
+		{
+			tm.tm_isdst = -1;
+			return(mktime(&tm));
+		}
+	}
+	return(-1);
+}
+
+static double rec_time(const hist_record * rec)
+{
+	return((double)rec->sec + (double)rec->nsec / 1e9);
+}
+
+static unsigned long long rec_ns(const hist_record * rec)
+{
+	return((unsigned long long)rec->sec * 1000000000ULL + rec->nsec);
+}
+
+static int rec_cmp(const void * a, const void * b)
+{
+	unsigned long long x = rec_ns((const hist_record *)a);
+	unsigned long long y = rec_ns((const hist_record *)b);
+
+	return(x < y ? -1 : x > y ? 1 : 0);
+}
+
+/* A query's view of the history: the file mapped, its index, and the
+ * records inside the window in time order.
+ */
+typedef struct
+{
+	const hist_record * recs;	// The mapped history file
+	size_t count;
+	hist_index * idx;			// An entry per complete block
+	size_t n_idx;
+	hist_record * copy;			// The window, sorted, if it was out of order
+	const hist_record * win;	// Records in the window, in time order
+	size_t n_win;
+} hist_view;
+
+/* Make the index entry of the 'n' records at 'recs' */
+static void index_block(hist_index * e, const hist_record * recs, size_t n)
+{
+	unsigned long long ns;
+	size_t i;
+	int m;
+
+	memset(e, 0x00, sizeof(hist_index));
+	e->first = recs[0];
+	e->min_ns = rec_ns(&recs[0]);
+	e->max_ns = e->min_ns;
+	e->sorted = 1;
+
+	for (i = 0; i < n; i++)
+	{
+		ns = rec_ns(&recs[i]);
+		if (i > 0 && ns < rec_ns(&recs[i - 1]))
+			e->sorted = 0;
+		if (ns < e->min_ns)
+			e->min_ns = ns;
+		if (ns > e->max_ns)
+			e->max_ns = ns;
+
+		if (recs[i].kind != HIST_MCR || e->n_marks == HIST_IDX_FULL)
+			continue;
+		for (m = 0; m < e->n_marks; m++)
+			if (e->marks[m].address == recs[i].address)
+				break;
+		if (m == HIST_IDX_MARKS)
+		{
+			e->n_marks = HIST_IDX_FULL;
+			continue;
+		}
+		if (m == e->n_marks)
+		{
+			e->marks[m].address = recs[i].address;
+			e->n_marks++;
+		}
+		if (ns >= e->marks[m].ns)
+		{
+			e->marks[m].ns = ns;
+			e->marks[m].new_mcr = recs[i].new_mcr;
+		}
+	}
+}
+
+/* Read '<file>.idx', making any entries it is missing, or that belong to
+ * a history file since replaced. If it can't be written, the entries
+ * are only made in memory.
+ */
+static int index_load(hist_view * v, const char * file)
+{
+	char name[512];
+	ssize_t got = 0;
+	size_t i;
+	int fd;
+
+	v->n_idx = v->count / HIST_IDX_BLOCK;
+	if (v->n_idx == 0)
+		return(0);
+	v->idx = (hist_index *)malloc(v->n_idx * sizeof(hist_index));
+	if (v->idx == NULL)
+		return(-1);
+
+	snprintf(name, sizeof(name), "%s.idx", file);
+	fd = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd >= 0)
+		got = pread(fd, v->idx, v->n_idx * sizeof(hist_index), 0);
+	if (got < 0)
+		got = 0;
+
+	for (i = 0; i < v->n_idx; i++)
+	{
+		if ((i + 1) * sizeof(hist_index) <= (size_t)got &&
+			memcmp(&v->idx[i].first, &v->recs[i * HIST_IDX_BLOCK], sizeof(hist_record)) == 0)
+			continue;
+		index_block(&v->idx[i], &v->recs[i * HIST_IDX_BLOCK], HIST_IDX_BLOCK);
+		if (fd >= 0 && pwrite(fd, &v->idx[i], sizeof(hist_index),
+				i * sizeof(hist_index)) != sizeof(hist_index))
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	return(0);
+}
+
+/* Find the records between t1 and t2. Only the blocks whose time range
+ * meets the window can hold any, and the unindexed tail. Where those
+ * are in time order, as they nearly always are, the window is found by
+ * binary search and read in place; otherwise its records are copied out
+ * and sorted.
+ */
+static int view_window(hist_view * v, time_t t1, time_t t2)
+{
+	unsigned long long lo = (unsigned long long)t1 * 1000000000ULL;
+	unsigned long long hi = (unsigned long long)t2 * 1000000000ULL;
+	size_t tail = v->n_idx * HIST_IDX_BLOCK;
+	size_t start = tail;
+	size_t first;
+	size_t last;
+	size_t mid;
+	size_t i;
+	int ordered = 1;
+
+	for (i = 0; i < v->n_idx; i++)
+		if (v->idx[i].max_ns >= lo && v->idx[i].min_ns < hi)
+		{
+			start = i * HIST_IDX_BLOCK;
+			break;
+		}
+
+	for (i = start / HIST_IDX_BLOCK; i < v->n_idx; i++)
+		if (!v->idx[i].sorted ||
+			(i * HIST_IDX_BLOCK > start && v->idx[i].min_ns < v->idx[i - 1].max_ns))
+			ordered = 0;
+	for (i = tail; i < v->count; i++)
+		if (i > start && rec_ns(&v->recs[i]) < rec_ns(&v->recs[i - 1]))
+			ordered = 0;
+
+	if (ordered)
+	{
+		first = start;
+		last = v->count;
+		while (first < last)
+		{
+			mid = first + (last - first) / 2;
+			if (rec_ns(&v->recs[mid]) < lo)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+		last = v->count;
+		i = first;
+		while (i < last)
+		{
+			mid = i + (last - i) / 2;
+			if (rec_ns(&v->recs[mid]) < hi)
+				i = mid + 1;
+			else
+				last = mid;
+		}
+		v->win = v->recs + first;
+		v->n_win = last - first;
+		return(0);
+	}
+
+	for (i = start; i < v->count; i++)
+		if (rec_ns(&v->recs[i]) >= lo && rec_ns(&v->recs[i]) < hi)
+			v->n_win++;
+	v->copy = (hist_record *)malloc((v->n_win > 0 ? v->n_win : 1) * sizeof(hist_record));
+	if (v->copy == NULL)
+		return(-1);
+	v->n_win = 0;
+	for (i = start; i < v->count; i++)
+		if (rec_ns(&v->recs[i]) >= lo && rec_ns(&v->recs[i]) < hi)
+			v->copy[v->n_win++] = v->recs[i];
+	qsort(v->copy, v->n_win, sizeof(hist_record), rec_cmp);
+	v->win = v->copy;
+	return(0);
+}
+
+static void view_close(hist_view * v)
+{
+	if (v->recs != NULL)
+		munmap((void *)v->recs, v->count * sizeof(hist_record));
+	free(v->idx);
+	free(v->copy);
+	memset(v, 0x00, sizeof(hist_view));
+}
+
+/* Map the history and find the window between t1 and t2 in it. Returns
+ * 0 on success, -1 on error.
+ */
+static int view_open(hist_view * v, const char * file, time_t t1, time_t t2)
+{
+	struct stat st;
+	void * map;
+	int fd;
+
+	memset(v, 0x00, sizeof(hist_view));
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return(-1);
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return(-1);
+	}
+
+	v->count = st.st_size / sizeof(hist_record);
+	if (v->count == 0)
+	{
+		close(fd);
+		return(0);
+	}
+	map = mmap(NULL, v->count * sizeof(hist_record), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return(-1);
+	v->recs = (const hist_record *)map;
+
+	if (index_load(v, file) != 0 || view_window(v, t1, t2) != 0)
+	{
+		view_close(v);
+		return(-1);
+	}
+	return(0);
+}
+
+/* The value the last write to the MCR at 'address' before t1 left, from
+ * the marks of the blocks wholly before t1 and the records of the ones
+ * that aren't. Returns 0 if there was no such write.
+ */
+static int view_state(const hist_view * v, int address, time_t t1, unsigned char * state)
+{
+	unsigned long long lo = (unsigned long long)t1 * 1000000000ULL;
+	unsigned long long best = 0;
+	unsigned long long ns;
+	const hist_index * e;
+	size_t end;
+	size_t i;
+	size_t j;
+	int found = 0;
+	int m;
+
+	/* Block 'n_idx' is the unindexed tail */
+	for (i = 0; i <= v->n_idx; i++)
+	{
+		end = i < v->n_idx ? (i + 1) * HIST_IDX_BLOCK : v->count;
+		if (i < v->n_idx)
+		{
+			e = &v->idx[i];
+			if (e->min_ns >= lo)
+				continue;
+			if (e->max_ns < lo && e->n_marks != HIST_IDX_FULL)
+			{
+				for (m = 0; m < e->n_marks; m++)
+					if (e->marks[m].address == address && (!found || e->marks[m].ns >= best))
+					{
+						best = e->marks[m].ns;
+						*state = e->marks[m].new_mcr;
+						found = 1;
+					}
+				continue;
+			}
+		}
+		for (j = i * HIST_IDX_BLOCK; j < end; j++)
+		{
+			if (v->recs[j].address != address || v->recs[j].kind != HIST_MCR)
+				continue;
+			ns = rec_ns(&v->recs[j]);
+			if (ns < lo && (!found || ns >= best))
+			{
+				best = ns;
+				*state = v->recs[j].new_mcr;
+				found = 1;
+			}
+		}
+	}
+	return(found);
+}
+
+/* Work out the time DTR (on[0]) and RTS (on[1]) of the MCR at 'address'
+ * were ON between t1 and t2. If list is set, each transition is printed
+ * too. Returns the number of transitions, or -1 on error.
+ */
+int hist_ontime(const char * file, int address, time_t t1, time_t t2, int list, double * on)
+{
+	const hist_record * rec;
+	hist_view v;
+	size_t i;
+	int found = 0;
+	unsigned char state = 0;
+	double start = (double)t1;
+	double end = (double)t2;
+	double now;
+	double dtr_since = start;
+	double rts_since = start;
+	char tbuf[32];
+	time_t tt;
+
+	on[0] = 0.0;
+	on[1] = 0.0;
+	if (view_open(&v, file, t1, t2) != 0)
+		return(-1);
+
+	/* The line state at the start of the window is whatever the last
+	 * write to this MCR before the window left behind.
+	 */
+	view_state(&v, address, t1, &state);
+
+	for (i = 0; i < v.n_win; i++)
+	{
+		rec = &v.win[i];
+		if (rec->address != address || rec->kind != HIST_MCR)
+			continue;
+
+		found++;
+		now = rec_time(rec);
+
+		if (list)
+		{
+			tt = (time_t)rec->sec;
+			strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&tt));
+			printf("%s.%06u 0x%04X: 0x%02X -> 0x%02X\n", tbuf,
+				rec->nsec / 1000, rec->address, rec->old_mcr, rec->new_mcr);
+		}
+
+		if ((state & HIST_DTR) && !(rec->new_mcr & HIST_DTR))
+			on[0] += now - dtr_since;
+		else if (!(state & HIST_DTR) && (rec->new_mcr & HIST_DTR))
+			dtr_since = now;
+
+		if ((state & HIST_RTS) && !(rec->new_mcr & HIST_RTS))
+			on[1] += now - rts_since;
+		else if (!(state & HIST_RTS) && (rec->new_mcr & HIST_RTS))
+			rts_since = now;
+
+		state = rec->new_mcr;
+	}
+
+	/* Lines still ON at the end of the window count up to t2 */
+	if (state & HIST_DTR)
+		on[0] += end - dtr_since;
+	if (state & HIST_RTS)
+		on[1] += end - rts_since;
+
+	view_close(&v);
+	return(found);
+}
+
+/* Report on the transitions of the MCR at 'address' between t1 and t2:
+ * the total time DTR and RTS were ON inside the window and the number
+ * of edges seen, each one with 'list'. Returns the number of matching
+ * records, or -1 on error.
+ */
+int hist_query(const char * file, int address, time_t t1, time_t t2, int list)
+{
+	double on[2];
+	int found;
+
+	found = hist_ontime(file, address, t1, t2, list, on);
+	if (found < 0)
+		return(-1);
+
+	printf("MCR 0x%04X: %d transitions\n", address, found);
+	printf("  DTR on time: %.3f s\n", on[0]);
+	printf("  RTS on time: %.3f s\n", on[1]);
+	return(found);
+}
+
+/* Report the filtered input edges between t1 and t2: the edges and ON
+ * time of each input line, and with 'list' every edge. Returns the
+ * number of edges, or -1 on error.
+ */
+int hist_inputs(const char * file, time_t t1, time_t t2, int list)
+{
+	const hist_record * rec;
+	hist_view v;
+	size_t i;
+	int level[256];
+	double since[256];
+	double on[256];
+	int edges[256];
+	int found = 0;
+	int k;
+	char tbuf[32];
+	time_t tt;
+
+	if (view_open(&v, file, t1, t2) != 0)
+		return(-1);
+
+	memset(edges, 0x00, sizeof(edges));
+	memset(on, 0x00, sizeof(on));
+	for (k = 0; k < 256; k++)
+	{
+		level[k] = -1;
+		since[k] = (double)t1;
+	}
+
+	for (i = 0; i < v.n_win; i++)
+	{
+		rec = &v.win[i];
+		if (rec->kind != HIST_INPUT)
+			continue;
+		k = rec->line;
+		found++;
+		edges[k]++;
+
+		/* Before its first edge in the window, it was at the edge's old level */
+		if (level[k] < 0)
+			level[k] = rec->old_mcr;
+		if (level[k] && !rec->new_mcr)
+			on[k] += rec_time(rec) - since[k];
+		else if (!level[k] && rec->new_mcr)
+			since[k] = rec_time(rec);
+		level[k] = rec->new_mcr;
+
+		if (list)
+		{
+			tt = (time_t)rec->sec;
+			strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&tt));
+			printf("%s.%06u line %d (0x%04X): %s\n", tbuf, rec->nsec / 1000,
+				k, rec->address, rec->new_mcr ? "ON" : "OFF");
+		}
+	}
+	view_close(&v);
+
+	for (k = 0; k < 256; k++)
+	{
+		if (edges[k] == 0)
+			continue;
+		if (level[k] > 0)
+			on[k] += (double)t2 - since[k];
+		printf("Input line %d: %d edges, ON time %.3f s\n", k, edges[k], on[k]);
+	}
+	return(found);
+}
+
+/* Chrome trace export. Each MCR is a process, each of its bits a thread
+ * whose key intervals are B/E spans, so the viewer draws them as bars.
+ * Every write is also an instant event on its own thread, and outliers
+ * from the outlier log on another. Input edges are B/E spans too, one
+ * thread per input line under an 'Inputs' process, and so are shift
+ * register outputs, one thread per bit under 'Shift register'. Events go out as the records are
+ * read, with one slot of state per MCR, so the size of the history
+ * doesn't matter.
+ */
+#define HIST_BITS			5		// DTR, RTS, OUT1, OUT2, LOOP
+#define HIST_TID_WRITES		8
+#define HIST_TID_OUTLIERS	9
+#define HIST_MAX_TRACKS		64
+#define HIST_PID_INPUTS		1		// Input edges, a thread per line
+#define HIST_PID_CHAIN		2		// Shift register outputs, a thread per bit
+
+static const char * hist_bit_names[HIST_BITS] = { "DTR", "RTS", "OUT1", "OUT2", "LOOP" };
+
+typedef struct
+{
+	unsigned short address;
+	unsigned char state;
+} hist_track;
+
+typedef struct
+{
+	FILE * fp;					// Outlier log, NULL if none
+	int have;					// The fields below hold the next outlier
+	double t;					// Its time, seconds since the epoch
+	int address;
+	unsigned int old_mcr;
+	unsigned int new_mcr;
+	double ms;					// Request to outb time
+} hist_outliers;
+
+static int trace_first;
+static FILE * trace_out;
+
+static void trace_event(const char * fmt, ...)
+{
+	va_list ap;
+
+	fputs(trace_first ? "\n" : ",\n", trace_out);
+	trace_first = 0;
+	va_start(ap, fmt);
+	vfprintf(trace_out, fmt, ap);
+	va_end(ap);
+}
+
+static double trace_us(double t, time_t t1)
+{
+	return((t - (double)t1) * 1e6);
+}
+
+/* Find the track of an MCR, adding it on first sight. The state before
+ * the window is what its first write in the window started from.
+ */
+static hist_track * trace_track(hist_track * tracks, int * n, const hist_record * rec)
+{
+	hist_track * tr;
+	int b;
+	int i;
+
+	for (i = 0; i < *n; i++)
+		if (tracks[i].address == rec->address)
+			return(&tracks[i]);
+	if (*n >= HIST_MAX_TRACKS)
+		return(NULL);
+
+	tr = &tracks[(*n)++];
+	tr->address = rec->address;
+	tr->state = rec->old_mcr;
+
+	trace_event("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"MCR 0x%04X\"}}",
+		tr->address, tr->address);
+	for (b = 0; b < HIST_BITS; b++)
+		trace_event("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			tr->address, b, hist_bit_names[b]);
+	trace_event("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"writes\"}}",
+		tr->address, HIST_TID_WRITES);
+	trace_event("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"outliers\"}}",
+		tr->address, HIST_TID_OUTLIERS);
+
+	for (b = 0; b < HIST_BITS; b++)
+		if (tr->state & (1 << b))
+			trace_event("{\"ph\":\"B\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":0}",
+				hist_bit_names[b], tr->address, b);
+	return(tr);
+}
+
+/* Read ahead to the next outlier at or after t1 */
+static void next_outlier(hist_outliers * o, time_t t1)
+{
+	char line[256];
+	struct tm tm;
+	long usec;
+
+	o->have = 0;
+	while (o->fp != NULL && fgets(line, sizeof(line), o->fp) != NULL)
+	{
+		/* Entries start with the date, their context lines are indented */
+		if (!isdigit((unsigned char)line[0]))
+			continue;
+		memset(&tm, 0x00, sizeof(tm));
+		if (sscanf(line, "%d-%d-%d %d:%d:%d.%ld port %*d (0x%x) 0x%x -> 0x%x: request to outb %lf",
+				&tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+				&usec, &o->address, &o->old_mcr, &o->new_mcr, &o->ms) != 11)
+			continue;
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		tm.tm_isdst = -1;
+		o->t = (double)mktime(&tm) + usec / 1e6;
+		if (o->t >= (double)t1)
+		{
+			o->have = 1;
+			return;
+		}
+	}
+}
+
+/* An input or shift register output edge, on thread 'line' of 'pid'.
+ * 'level' is the line's level so far, -1 before its first.
+ */
+static void trace_input(int * level, const hist_record * rec, time_t t1, int pid)
+{
+	if (*level < 0)
+	{
+		trace_event("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+			pid, pid == HIST_PID_INPUTS ? "Inputs" : "Shift register");
+		trace_event("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+			pid, rec->line, pid == HIST_PID_INPUTS ? "line" : "bit", rec->line);
+		if (rec->old_mcr)
+			trace_event("{\"ph\":\"B\",\"name\":\"ON\",\"pid\":%d,\"tid\":%d,\"ts\":0}",
+				pid, rec->line);
+		*level = rec->old_mcr != 0;
+	}
+	if ((rec->new_mcr != 0) != *level)
+		trace_event("{\"ph\":\"%s\",\"name\":\"ON\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+			rec->new_mcr ? "B" : "E", pid, rec->line,
+			trace_us(rec_time(rec), t1));
+	*level = rec->new_mcr != 0;
+}
+
+static void trace_outlier(hist_outliers * o, time_t t1)
+{
+	trace_event("{\"ph\":\"i\",\"s\":\"p\",\"name\":\"outlier %.3f ms\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+		"\"args\":{\"old\":\"0x%02X\",\"new\":\"0x%02X\",\"request_to_outb_ms\":%.3f}}",
+		o->ms, o->address, HIST_TID_OUTLIERS, trace_us(o->t, t1),
+		o->old_mcr, o->new_mcr, o->ms);
+}
+
+/* Write the history between t1 and t2, and the outliers logged in
+ * 'outliers' (may be NULL) over the same time, to 'out' as Chrome trace
+ * event JSON, for chrome://tracing or ui.perfetto.dev. Times are in us
+ * from t1. Returns the number of records written, or -1 on error.
+ */
+int hist_export(FILE * out, const char * file, const char * outliers, time_t t1, time_t t2)
+{
+	const hist_record * rec;
+	hist_view v;
+	hist_track tracks[HIST_MAX_TRACKS];
+	hist_track * tr;
+	hist_outliers ol;
+	int in_level[256];
+	int sr_level[256];
+	size_t i;
+	struct timespec ts;
+	double now;
+	double end;
+	double last = (double)t1;
+	int n_tracks = 0;
+	int found = 0;
+	int changed;
+	int b;
+
+	if (view_open(&v, file, t1, t2) != 0)
+		return(-1);
+	if (v.copy == NULL && v.n_win > 0)
+		madvise((void *)v.recs, v.count * sizeof(hist_record), MADV_SEQUENTIAL);
+
+	memset(in_level, 0xFF, sizeof(in_level));
+	memset(sr_level, 0xFF, sizeof(sr_level));
+	memset(&ol, 0x00, sizeof(ol));
+	if (outliers != NULL && strlen(outliers) > 0)
+		ol.fp = fopen(outliers, "r");
+	next_outlier(&ol, t1);
+
+	trace_out = out;
+	trace_first = 1;
+	fprintf(trace_out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	for (i = 0; i < v.n_win; i++)
+	{
+		rec = &v.win[i];
+		now = rec_time(rec);
+		last = now;
+		while (ol.have && ol.t <= now)
+		{
+			trace_outlier(&ol, t1);
+			next_outlier(&ol, t1);
+		}
+
+		if (rec->kind == HIST_INPUT || rec->kind == HIST_SR)
+		{
+			if (rec->kind == HIST_INPUT)
+				trace_input(&in_level[rec->line], rec, t1, HIST_PID_INPUTS);
+			else
+				trace_input(&sr_level[rec->line], rec, t1, HIST_PID_CHAIN);
+			found++;
+			continue;
+		}
+		if (rec->kind != HIST_MCR)
+			continue;
+
+		tr = trace_track(tracks, &n_tracks, rec);
+		if (tr == NULL)
+			continue;
+		found++;
+
+		changed = tr->state ^ rec->new_mcr;
+		for (b = 0; b < HIST_BITS; b++)
+			if (changed & (1 << b))
+				trace_event("{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+					(rec->new_mcr & (1 << b)) ? "B" : "E", hist_bit_names[b],
+					tr->address, b, trace_us(now, t1));
+		trace_event("{\"ph\":\"i\",\"s\":\"t\",\"name\":\"0x%02X -> 0x%02X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+			rec->old_mcr, rec->new_mcr, tr->address, HIST_TID_WRITES, trace_us(now, t1));
+		tr->state = rec->new_mcr;
+	}
+	while (ol.have && ol.t < (double)t2)
+	{
+		trace_outlier(&ol, t1);
+		next_outlier(&ol, t1);
+	}
+
+	/* Lines still ON are closed at the end of the window, or now */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	end = ts.tv_sec + ts.tv_nsec / 1e9;
+	if ((double)t2 < end)
+		end = (double)t2;
+	if (end < last)
+		end = last;
+	for (i = 0; i < (size_t)n_tracks; i++)
+		for (b = 0; b < HIST_BITS; b++)
+			if (tracks[i].state & (1 << b))
+				trace_event("{\"ph\":\"E\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+					hist_bit_names[b], tracks[i].address, b, trace_us(end, t1));
+	for (b = 0; b < 256; b++)
+	{
+		if (in_level[b] > 0)
+			trace_event("{\"ph\":\"E\",\"name\":\"ON\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+				HIST_PID_INPUTS, b, trace_us(end, t1));
+		if (sr_level[b] > 0)
+			trace_event("{\"ph\":\"E\",\"name\":\"ON\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+				HIST_PID_CHAIN, b, trace_us(end, t1));
+	}
+
+	fprintf(trace_out, "\n]}\n");
+	fflush(trace_out);
+
+	if (ol.fp != NULL)
+		fclose(ol.fp);
+	view_close(&v);
+	return(found);
+}
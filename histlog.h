@@ -0,0 +1,104 @@
+/* histlog.h - Append-only history log of MCR line transitions.
+
+*/
+
+#ifndef __HISTLOG_H__
+#define __HISTLOG_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#define HIST_MCR			0			// Record kinds: an MCR write
+#define HIST_INPUT			1			// A filtered input edge
+#define HIST_SR				2			// A shift register output edge
+#define HIST_BATCH			256			// Records written in one write()
+#define HIST_FLUSH_MS		1000		// Longest a record waits to be written
+#define HIST_IDX_BLOCK		4096		// History records per index entry
+#define HIST_IDX_MARKS		8			// MCRs an index entry keeps the state of
+#define HIST_IDX_FULL		0xFF		// The block wrote more MCRs than that
+
+/* Each transition is stored as one fixed size record. Records are only
+ * ever appended, but they are not strictly in time order: a monitor's
+ * batch goes out up to HIST_FLUSH_MS after its records were stamped, a
+ * one-shot ptt can append in between, and the clock can be stepped.
+ */
+typedef struct
+{
+	unsigned int sec;			// Transition time, seconds since epoch
+	unsigned int nsec;			// Transition time, nanoseconds
+	unsigned short address;		// IO address of the MCR, or for an input the
+								// MSR (0 for an input device)
+	unsigned char old_mcr;		// MCR value before the write, or input level
+	unsigned char new_mcr;		// MCR value read back after the write, or level
+	unsigned char kind;			// HIST_MCR or HIST_INPUT
+	unsigned char line;			// HIST_INPUT: the input's line in the config,
+								// HIST_SR: the output's bit in the chain
+	unsigned short reserved;	// Pad to 16 bytes, must be zero
+} hist_record;
+
+/* The last write to one MCR in a block of the history */
+typedef struct
+{
+	unsigned long long ns;		// Its time, ns since the epoch
+	unsigned short address;		// IO address of the MCR
+	unsigned char new_mcr;		// The value it left
+	unsigned char pad[5];
+} hist_mark;
+
+/* Queries keep '<file>.idx' beside the history, one entry for each
+ * complete block of HIST_IDX_BLOCK records. Blocks are never changed
+ * once complete, so an entry is made once, by the first query to need
+ * it. The time ranges find the blocks a window's records are in, and
+ * the marks give the state of the lines before it without reading the
+ * history back to its start.
+ */
+typedef struct
+{
+	hist_record first;			// The block's first record, to spot a new file
+	unsigned long long min_ns;	// Earliest record in the block
+	unsigned long long max_ns;	// Latest record in the block
+	unsigned char sorted;		// The block is in time order
+	unsigned char n_marks;		// Entries in 'marks', or HIST_IDX_FULL
+	unsigned char pad[6];
+	hist_mark marks[HIST_IDX_MARKS];	// Last write to each MCR in the block
+} hist_index;
+
+/* Records kept in memory by the monitor loop and written in batches,
+ * away from its MCR writes
+ */
+typedef struct
+{
+	int fd;						// History file
+	hist_record buf[HIST_BATCH];
+	int n;						// Records waiting
+	long long first_ns;			// When the oldest waiting one was added,
+								// CLOCK_MONOTONIC
+	unsigned long records;		// Records written
+	unsigned long dropped;		// Records lost to a full batch or failed write
+	unsigned long writes;		// write() calls
+} hist_writer;
+
+int hist_append(const char * file, int address, unsigned char old_mcr, unsigned char new_mcr);
+int hist_open(hist_writer * w, const char * file);
+void hist_add(hist_writer * w, int kind, int address, int line,
+	unsigned char old_mcr, unsigned char new_mcr);
+int hist_due(const hist_writer * w, long long now_ns);
+long long hist_next(const hist_writer * w);
+int hist_flush(hist_writer * w);
+void hist_close(hist_writer * w);
+int hist_ontime(const char * file, int address, time_t t1, time_t t2, int list, double * on);
+int hist_query(const char * file, int address, time_t t1, time_t t2, int list);
+int hist_inputs(const char * file, time_t t1, time_t t2, int list);
+int hist_export(FILE * out, const char * file, const char * outliers, time_t t1, time_t t2);
+time_t hist_parse_time(const char * s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HISTLOG_H__ */
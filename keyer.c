@@ -0,0 +1,455 @@
+/* keyer.c - CW keyer, buffered text to key and PTT edges on deadlines.
+ *
+ * The keyer takes text and the WinKeyer's buffered commands into a
+ * buffer and sends it a character at a time. Each character is laid out
+ * as a short list of key and PTT edges at absolute CLOCK_MONOTONIC times,
+ * each one timed from the one before it rather than from when the monitor
+ * happened to wake, so lateness on one edge never builds up into the
+ * next. The monitor calls keyer_run() every period with the time now,
+ * drives the key and PTT lines from the levels it leaves, and sleeps
+ * until the deadline it returns.
+ *
+ * Timing follows the WinKeyer: a dit is 1200/wpm ms, weighting moves time
+ * from the space after each mark to the mark (50 is 1:1), the ratio sets
+ * the dah length (50 is 3 dits), and key compensation adds a fixed time
+ * to every mark. With PTT enabled the PTT line comes on 'lead' ms before
+ * the first mark and goes off 'tail' ms after the last one, or after the
+ * hang time of one to two word spaces if the tail is 0.
+ *
+ * For full break-in (QSK) the PTT line is the T/R relay and is keyed
+ * around each character instead: it closes the QSK lead time before the
+ * first mark, scheduled ahead from when that mark is due, and opens the
+ * QSK tail (or the hang time, if longer) after the last one. A gap too
+ * short for the relay to open and close again within its dwell time is
+ * bridged, and a relay that has not dwelt long enough holds the mark
+ * back rather than cut the guard time. Edges due within KEYER_MERGE_NS of
+ * each other are applied together, so they go out in one MCR write.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "keyer.h"
+
+/* 0x20 to 0x5F, NULL for the ones with no Morse */
+static const char * morse[64] = {
+	NULL, "-.-.--", ".-..-.", NULL, "...-..-", NULL, ".-...", ".----.",
+	"-.--.", "-.--.-", NULL, ".-.-.", "--..--", "-....-", ".-.-.-", "-..-.",
+	"-----", ".----", "..---", "...--", "....-", ".....", "-....", "--...",
+	"---..", "----.", "---...", "-.-.-.", ".-.-.", "-...-", "...-.-", "..--..",
+	".--.-.", ".-", "-...", "-.-.", "-..", ".", "..-.", "--.",
+	"....", "..", ".---", "-.-", ".-..", "--", "-.", "---",
+	".--.", "--.-", ".-.", "...", "-", "..-", "...-", ".--",
+	"-..-", "-.--", "--..", ".-...", NULL, "-.--.", NULL, "..--.-"
+};
+
+void keyer_init(keyer * k, int wpm)
+{
+	memset(k, 0x00, sizeof(keyer));
+	k->wpm = wpm > 0 ? wpm : DEF_KEYER_WPM;
+	k->weight = 50;
+	k->ratio = 50;
+	k->ptt_enable = TRUE;
+	k->idle = TRUE;
+}
+
+/* Full break-in, the PTT line becomes T/R. 0 gives the default for the
+ * lead, tail and dwell, and no hang.
+ */
+void keyer_qsk(keyer * k, int lead_ms, int tail_ms, int hang_ms, int dwell_ms)
+{
+	k->qsk = TRUE;
+	k->qsk_lead_ms = lead_ms > 0 ? lead_ms : DEF_QSK_LEAD;
+	k->qsk_tail_ms = tail_ms > 0 ? tail_ms : DEF_QSK_TAIL;
+	k->qsk_hang_ms = hang_ms > 0 ? hang_ms : 0;
+	k->qsk_dwell_ms = dwell_ms > 0 ? dwell_ms : DEF_QSK_DWELL;
+}
+
+long long keyer_dit_ns(const keyer * k)
+{
+	int wpm = k->buffered_wpm > 0 ? k->buffered_wpm : k->wpm;
+
+	if (wpm < 5)
+		wpm = 5;
+	return(1200000000LL / wpm);
+}
+
+/* Time taken from each space and added to the mark before it */
+static long long mark_adj(const keyer * k)
+{
+	long long dit = keyer_dit_ns(k);
+	long long adj = dit * (k->weight - 50) / 50 + k->comp_ms * 1000000LL;
+
+	if (adj > dit * 4 / 5)
+		adj = dit * 4 / 5;
+	if (adj < -dit * 4 / 5)
+		adj = -dit * 4 / 5;
+	return(adj);
+}
+
+static long long tail_ns(const keyer * k)
+{
+	if (k->qsk)
+		return((k->qsk_hang_ms > k->qsk_tail_ms ? k->qsk_hang_ms : k->qsk_tail_ms) * 1000000LL);
+	if (k->tail_ms > 0)
+		return(k->tail_ms * 1000000LL);
+	return(keyer_dit_ns(k) * 7 * (3 + k->hang) / 3);
+}
+
+static void add_event(keyer * k, long long ns, int key, int ptt)
+{
+	if (k->n_ev >= KEYER_EVENTS)
+		return;
+	k->ev[k->n_ev].ns = ns;
+	k->ev[k->n_ev].key = key;
+	k->ev[k->n_ev].ptt = ptt;
+	k->n_ev++;
+}
+
+static int pop(keyer * k)
+{
+	int c;
+
+	if (k->count == 0)
+		return(-1);
+	c = k->buf[k->head];
+	k->head = (k->head + 1) % KEYER_BUFSIZE;
+	k->count--;
+	return(c);
+}
+
+static void echo(keyer * k, int c)
+{
+	if (k->n_sent < KEYER_SENT)
+		k->sent[k->n_sent++] = c;
+	k->chars++;
+}
+
+/* Bring PTT up ahead of a mark at 's', returns when the mark can start */
+static long long ptt_lead(keyer * k, long long s)
+{
+	k->ptt_off_ns = 0;
+	if (!k->ptt_enable || k->ptt)
+		return(s);
+	add_event(k, s, -1, 1);
+	k->ptt_ns = s;
+	return(s + k->lead_ms * 1000000LL);
+}
+
+/* QSK: T/R closed the lead time ahead of a mark at 's', returns when
+ * the mark can start. keyer_run() normally closed it on time already.
+ */
+static long long qsk_lead(keyer * k, long long s)
+{
+	long long dwell = k->qsk_dwell_ms * 1000000LL;
+
+	k->ptt_off_ns = 0;
+	if (!k->ptt)
+	{
+		if (s < k->ptt_ns + dwell)
+			s = k->ptt_ns + dwell;
+		add_event(k, s, -1, 1);
+		k->ptt_ns = s;
+	}
+	if (s < k->ptt_ns + k->qsk_lead_ms * 1000000LL)
+		s = k->ptt_ns + k->qsk_lead_ms * 1000000LL;
+	return(s);
+}
+
+/* QSK: T/R opens after the last mark, up at 'up', but not before it has
+ * been closed for the dwell time
+ */
+static void qsk_tail(keyer * k, long long up)
+{
+	long long off = up + tail_ns(k);
+
+	if (!k->qsk || k->held)
+		return;
+	if (off < k->ptt_ns + k->qsk_dwell_ms * 1000000LL)
+		off = k->ptt_ns + k->qsk_dwell_ms * 1000000LL;
+	k->ptt_off_ns = off;
+}
+
+/* The marks of one or two (merged) characters, from 's' */
+static void lay_out(keyer * k, long long s, const char * a, const char * b)
+{
+	long long dit = keyer_dit_ns(k);
+	long long adj = mark_adj(k);
+	long long dah = 3 * dit * k->ratio / 50;
+	const char * p;
+
+	s = k->qsk ? qsk_lead(k, s) : ptt_lead(k, s);
+	for (p = a; p != NULL; p = b, b = NULL)
+		for (; *p != '\0'; p++)
+		{
+			add_event(k, s, 1, -1);
+			s += (*p == '-' ? dah : dit) + adj;
+			add_event(k, s, 0, -1);
+			s += dit - adj;
+		}
+	qsk_tail(k, s - (dit - adj));
+
+	/* Three dits from the last mark, one of them already counted */
+	k->load_ns = s + 2 * dit;
+}
+
+static const char * lookup(int c)
+{
+	c = toupper(c);
+	if (c < 0x20 || c > 0x5F)
+		return(NULL);
+	return(morse[c - 0x20]);
+}
+
+/* QSK: whether the next thing in the buffer keys a mark */
+static int marks_next(const keyer * k)
+{
+	int c;
+
+	if (k->count == 0)
+		return(FALSE);
+	c = k->buf[k->head];
+	return(c == KEYER_KEY || c == KEYER_MERGE || lookup(c) != NULL);
+}
+
+/* Take from the buffer until something is scheduled from 's' */
+static void load(keyer * k, long long s)
+{
+	const char * a;
+	const char * b;
+	int c;
+	int arg;
+
+	k->n_ev = 0;
+	k->at = 0;
+	k->load_ns = s;
+	while (k->n_ev == 0 && k->load_ns == s && (c = pop(k)) >= 0)
+	{
+		switch (c)
+		{
+		case ' ':
+			/* Four more dits make the word space */
+			echo(k, c);
+			k->load_ns = s + 4 * keyer_dit_ns(k);
+			break;
+		case '|':
+			k->load_ns = s + keyer_dit_ns(k) / 2;
+			break;
+		case KEYER_PTT:
+			k->held = pop(k) > 0;
+			if (k->held && !k->ptt)
+				add_event(k, s, -1, 1);
+			else if (!k->held && k->ptt)
+				add_event(k, s, -1, 0);
+			k->ptt_off_ns = 0;
+			k->ptt_ns = s;
+			break;
+		case KEYER_KEY:
+			arg = pop(k);
+			s = k->qsk ? qsk_lead(k, s) : ptt_lead(k, s);
+			add_event(k, s, 1, -1);
+			add_event(k, s + (arg > 0 ? arg : 0) * 1000000000LL, 0, -1);
+			k->load_ns = k->ev[k->n_ev - 1].ns;
+			qsk_tail(k, k->load_ns);
+			break;
+		case KEYER_WAIT:
+			arg = pop(k);
+			k->load_ns = s + (arg > 0 ? arg : 0) * 1000000000LL;
+			break;
+		case KEYER_MERGE:
+			a = lookup(pop(k));
+			b = lookup(pop(k));
+			if (a == NULL)
+				a = "";
+			if (*a != '\0' || b != NULL)
+				lay_out(k, s, a, b);
+			break;
+		case KEYER_SPEED:
+			k->buffered_wpm = pop(k);
+			break;
+		case KEYER_HSCW:
+			pop(k);
+			break;
+		case KEYER_UNSPEED:
+			k->buffered_wpm = 0;
+			break;
+		case KEYER_NOP:
+			break;
+		default:
+			a = lookup(c);
+			if (a == NULL)
+				break;
+			echo(k, c);
+			lay_out(k, s, a, NULL);
+			break;
+		}
+	}
+}
+
+/* Apply every change due by 'now_ns', and return when the next one is
+ * due, or 0 if nothing is scheduled. 'edge_ns' is left at the due time
+ * of the last key edge applied, 0 if there was none.
+ */
+long long keyer_run(keyer * k, long long now_ns)
+{
+	keyer_event * e;
+	long long at;
+	long long close;
+
+	k->edge_ns = 0;
+	for (;;)
+	{
+		if (k->at < k->n_ev)
+		{
+			e = &k->ev[k->at];
+			if (e->ns > now_ns + KEYER_MERGE_NS)
+				return(e->ns);
+			k->at++;
+			if (e->ptt >= 0)
+			{
+				k->ptt = e->ptt;
+				k->ptt_ns = e->ns;
+			}
+			if (e->key >= 0 && !k->tune)
+			{
+				k->edge_run = k->run > 0;
+				k->edge_ns = e->ns;
+				k->run++;
+				if (e->key)
+					k->marks++;
+				k->key = e->key;
+			}
+
+			/* The last mark of the text, start the tail from it */
+			if (k->at == k->n_ev && k->count == 0 && e->key == 0 &&
+				k->ptt && !k->held && !k->tune && !k->qsk)
+				k->ptt_off_ns = e->ns + tail_ns(k);
+			continue;
+		}
+
+		if (k->count == 0 || k->paused)
+		{
+			if (!k->idle)
+			{
+				k->idle = TRUE;
+				k->run = 0;
+				if (k->ptt && !k->held && !k->tune && k->ptt_off_ns == 0)
+					k->ptt_off_ns = now_ns + tail_ns(k);
+			}
+			if (k->ptt_off_ns == 0)
+				return(0);
+			if (k->ptt_off_ns > now_ns)
+				return(k->ptt_off_ns);
+			k->ptt = 0;
+			k->ptt_off_ns = 0;
+			k->ptt_ns = now_ns;
+			continue;
+		}
+
+		/* After going idle, text starts when it comes but no sooner
+		 * than the character space after the last one.
+		 */
+		at = k->load_ns;
+		if (k->idle && at < now_ns)
+			at = now_ns;
+
+		/* QSK: keep T/R closed over a gap the relay can't open and close
+		 * again in, or close it the lead time ahead of the next mark
+		 */
+		if (k->qsk && !k->tune && marks_next(k))
+		{
+			close = at - k->qsk_lead_ms * 1000000LL;
+			if (k->ptt_off_ns != 0 && close < k->ptt_off_ns + k->qsk_dwell_ms * 1000000LL)
+				k->ptt_off_ns = 0;
+			if (k->ptt_off_ns == 0 && !k->ptt)
+			{
+				if (close < k->ptt_ns + k->qsk_dwell_ms * 1000000LL)
+					close = k->ptt_ns + k->qsk_dwell_ms * 1000000LL;
+				if (close > now_ns + KEYER_MERGE_NS)
+					return(close);
+				k->ptt = 1;
+				k->ptt_ns = k->idle ? now_ns : close;
+				continue;
+			}
+		}
+
+		if (k->ptt_off_ns != 0 && k->ptt_off_ns <= at)
+		{
+			if (k->ptt_off_ns > now_ns)
+				return(k->ptt_off_ns);
+			k->ptt = 0;
+			k->ptt_off_ns = 0;
+			k->ptt_ns = now_ns;
+			continue;
+		}
+		if (at > now_ns)
+			return(k->ptt_off_ns != 0 && k->ptt_off_ns < at ? k->ptt_off_ns : at);
+		k->idle = FALSE;
+		load(k, at);
+	}
+}
+
+int keyer_put(keyer * k, unsigned char c)
+{
+	if (k->count >= KEYER_BUFSIZE)
+		return(-1);
+	k->buf[(k->head + k->count) % KEYER_BUFSIZE] = c;
+	k->count++;
+	return(0);
+}
+
+/* Take back the last byte put, if it hasn't been sent */
+int keyer_backspace(keyer * k)
+{
+	if (k->count == 0)
+		return(-1);
+	k->count--;
+	return(0);
+}
+
+/* Drop the buffer and the character being sent, the key comes up now
+ * and PTT on the next keyer_run().
+ */
+void keyer_clear(keyer * k)
+{
+	k->count = 0;
+	k->n_ev = 0;
+	k->at = 0;
+	k->held = FALSE;
+	k->paused = FALSE;
+	k->buffered_wpm = 0;
+	if (!k->tune)
+		k->key = 0;
+	k->ptt_off_ns = k->ptt && !k->tune ? 1 : 0;
+}
+
+/* Key down (or up) at once, as for tuning */
+void keyer_tune(keyer * k, int on, long long now_ns)
+{
+	k->tune = on;
+	k->key = on;
+	k->edge_ns = 0;
+	if (on && (k->ptt_enable || k->qsk))
+	{
+		if (!k->ptt)
+			k->ptt_ns = now_ns;
+		k->ptt = 1;
+		k->ptt_off_ns = 0;
+	}
+	else if (!on && k->ptt && !k->held && k->at >= k->n_ev && k->count == 0)
+	{
+		k->ptt_off_ns = now_ns + tail_ns(k);
+		qsk_tail(k, now_ns);
+	}
+}
+
+int keyer_busy(const keyer * k)
+{
+	return(k->at < k->n_ev || (k->count > 0 && !k->paused));
+}
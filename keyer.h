@@ -0,0 +1,101 @@
+/* keyer.h - CW keyer, buffered text to key and PTT edges on deadlines.
+
+*/
+
+#ifndef __KEYER_H__
+#define __KEYER_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+#define KEYER_BUFSIZE		128			// Text and buffered commands
+#define KEYER_EVENTS		48			// Edges of one character
+#define KEYER_SENT			16			// Characters started, for echo
+#define DEF_KEYER_WPM		20
+#define KEYER_MERGE_NS		50000		// Edges this close go out together
+#define DEF_QSK_LEAD		5			// T/R closed to the first mark (ms)
+#define DEF_QSK_TAIL		5			// Last mark to T/R open (ms)
+#define DEF_QSK_DWELL		10			// Least time in either state (ms)
+#define QSK_SLACK_NS		100000		// Guard shortfall counted as a miss
+
+/* Buffered commands, in the text stream as the WinKeyer has them */
+#define KEYER_PTT			0x18		// <0|1> PTT off/on
+#define KEYER_KEY			0x19		// <s> key down for s seconds
+#define KEYER_WAIT			0x1A		// <s> wait s seconds
+#define KEYER_MERGE			0x1B		// <c1><c2> two characters as one
+#define KEYER_SPEED			0x1C		// <wpm> speed from here on
+#define KEYER_HSCW			0x1D		// <n> high speed CW, ignored
+#define KEYER_UNSPEED		0x1E		// back to the unbuffered speed
+#define KEYER_NOP			0x1F
+
+/* One scheduled change of the key or PTT line */
+typedef struct
+{
+	long long ns;				// When, CLOCK_MONOTONIC
+	signed char key;			// New key level, -1 to leave it
+	signed char ptt;			// New PTT level, -1 to leave it
+} keyer_event;
+
+typedef struct
+{
+	int wpm;					// Speed
+	int buffered_wpm;			// KEYER_SPEED in effect, 0 for none
+	int weight;					// Mark/space weighting 10-90, 50 for 1:1
+	int ratio;					// Dah/dit ratio 33-66, 50 for 3:1
+	int comp_ms;				// Added to every mark
+	int lead_ms;				// PTT on to the first mark
+	int tail_ms;				// Last mark to PTT off, 0 for the hang time
+	int hang;					// Hang time 0-3, 1 to 2 word spaces
+	int ptt_enable;				// Key PTT around the text
+	int paused;					// Buffer held, the character in hand finishes
+	int qsk;					// Full break-in, PTT is T/R around each character
+	int qsk_lead_ms;			// T/R closed to the first mark
+	int qsk_tail_ms;			// Last mark to T/R open, at least
+	int qsk_hang_ms;			// T/R held this long after the last mark
+	int qsk_dwell_ms;			// Least time the relay stays either way
+
+	unsigned char buf[KEYER_BUFSIZE];	// Text waiting to be sent
+	int head;
+	int count;
+
+	keyer_event ev[KEYER_EVENTS];		// The character being sent
+	int n_ev;
+	int at;						// Next event in 'ev'
+	long long load_ns;			// When the next character may start
+	int idle;					// Buffer ran dry at 'load_ns'
+	long long ptt_off_ns;		// PTT tail ends, 0 if not pending
+	long long ptt_ns;			// Last PTT change, applied or scheduled
+	int held;					// PTT held on by a KEYER_PTT
+	int tune;					// Key held down by keyer_tune()
+
+	int key;					// Key line level
+	int ptt;					// PTT line level
+	long long edge_ns;			// Due time of the last key edge applied
+	int edge_run;				// Edge follows the previous one in a run
+	int run;					// Elements since the keyer was last idle
+
+	unsigned char sent[KEYER_SENT];		// Characters started, not yet echoed
+	int n_sent;
+	unsigned long chars;		// Characters sent
+	unsigned long marks;		// Elements sent
+} keyer;
+
+void keyer_init(keyer * k, int wpm);
+void keyer_qsk(keyer * k, int lead_ms, int tail_ms, int hang_ms, int dwell_ms);
+int keyer_put(keyer * k, unsigned char c);
+int keyer_backspace(keyer * k);
+void keyer_clear(keyer * k);
+void keyer_tune(keyer * k, int on, long long now_ns);
+long long keyer_run(keyer * k, long long now_ns);
+int keyer_busy(const keyer * k);
+long long keyer_dit_ns(const keyer * k);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __KEYER_H__ */
@@ -0,0 +1,150 @@
+/* mirror.c - Extra keying paths mirroring an output line.
+ *
+ * Some radios want PTT on more than one path at once, so a failed cable
+ * or interface does not leave them unkeyed or, worse, keyed. An output
+ * line can carry up to MAX_MIRRORS 'mirror=' keys, each naming another
+ * path that follows the line:
+ *
+ *   tty:/dev/ttyUSB0:RTS        a modem line through the serial driver
+ *   cat:/dev/ttyUSB1:TX;:RX;    a CAT command for on and one for off
+ *   cm108:/dev/hidraw0:3        a CM108 sound card GPIO
+ *
+ * The line's own MCR bit is always written first, it is by far the
+ * fastest path. The mirrors are all opened non-blocking and issued one
+ * after the other straight after it, none of them waits for a reply, so
+ * they complete within a few us of each other.
+ *
+ * A path that fails is tried again every sample until it takes, so an
+ * unkey is never left undone. With mirror_fail=ABORT a path that fails
+ * to key unkeys every path of the line instead, until it is released.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include "mirror.h"
+
+/* Split off the next ':' separated field of 's' into 'field' */
+static const char * next_field(const char * s, char * field, int size)
+{
+	const char * end = strchr(s, ':');
+	int len = end != NULL ? end - s : (int)strlen(s);
+
+	if (len >= size)
+		len = size - 1;
+	memcpy(field, s, len);
+	field[len] = '\0';
+	return(end != NULL ? end + 1 : s + strlen(s));
+}
+
+int getMirrorPolicy(const char * policy)
+{
+	if (strcmp(policy, "IGNORE") == 0)
+		return(MIRROR_IGNORE);
+	if (strcmp(policy, "ABORT") == 0)
+		return(MIRROR_ABORT);
+	return(-1);
+}
+
+int mirror_open(mirror_path * m, const char * spec)
+{
+	char type[16];
+	char path[96];
+	char arg[32];
+	const char * p;
+
+	memset(m, 0x00, sizeof(mirror_path));
+	strncpy(m->spec, spec, sizeof(m->spec) - 1);
+	m->fd = -1;
+	m->state = -1;
+
+	p = next_field(spec, type, sizeof(type));
+	p = next_field(p, path, sizeof(path));
+
+	if (strcmp(type, "tty") == 0)
+	{
+		m->type = MIRROR_TTY;
+		if (strcmp(p, "DTR") == 0)
+			m->bits = TIOCM_DTR;
+		else if (strcmp(p, "RTS") == 0)
+			m->bits = TIOCM_RTS;
+		else
+			return(-1);
+	}
+	else if (strcmp(type, "cat") == 0)
+	{
+		m->type = MIRROR_CAT;
+		p = next_field(p, m->on, sizeof(m->on));
+		next_field(p, m->off, sizeof(m->off));
+		if (m->on[0] == '\0' || m->off[0] == '\0')
+			return(-1);
+	}
+	else if (strcmp(type, "cm108") == 0)
+	{
+		m->type = MIRROR_CM108;
+		next_field(p, arg, sizeof(arg));
+		if (atoi(arg) < 1 || atoi(arg) > 8)
+			return(-1);
+		m->bits = 1 << (atoi(arg) - 1);
+	}
+	else
+		return(-1);
+
+	m->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	return(m->fd < 0 ? -1 : 0);
+}
+
+/* Key (on = 1) or unkey the path. Returns 0 or -1. */
+int mirror_set(mirror_path * m, int on)
+{
+	unsigned char report[5];
+	const char * cmd;
+	int rc = -1;
+
+	if (m->fd < 0)
+		return(-1);
+
+	switch (m->type)
+	{
+		case MIRROR_TTY:
+			rc = ioctl(m->fd, on ? TIOCMBIS : TIOCMBIC, &m->bits);
+			break;
+
+		case MIRROR_CAT:
+			cmd = on ? m->on : m->off;
+			rc = write(m->fd, cmd, strlen(cmd)) == (ssize_t)strlen(cmd) ? 0 : -1;
+			break;
+
+		case MIRROR_CM108:
+			/* HID output report: report id, 0, GPIO mask, GPIO data, 0 */
+			report[0] = 0;
+			report[1] = 0;
+			report[2] = m->bits;
+			report[3] = on ? m->bits : 0;
+			report[4] = 0;
+			rc = write(m->fd, report, sizeof(report)) == sizeof(report) ? 0 : -1;
+			break;
+	}
+
+	m->ops++;
+	if (rc != 0)
+		m->fails++;
+	else
+		m->state = on;
+	return(rc);
+}
+
+void mirror_close(mirror_path * m)
+{
+	if (m->fd >= 0)
+		close(m->fd);
+	m->fd = -1;
+}
@@ -0,0 +1,50 @@
+/* mirror.h - Extra keying paths mirroring an output line.
+
+*/
+
+#ifndef __MIRROR_H__
+#define __MIRROR_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Kinds of mirror path */
+enum {
+	MIRROR_TTY,			// tty:<device>:<DTR|RTS>, modem line through the driver
+	MIRROR_CAT,			// cat:<device>:<on string>:<off string>
+	MIRROR_CM108		// cm108:<hidraw device>:<GPIO 1-8>
+};
+
+/* What to do when a mirror path fails to key, mirror_fail= */
+enum {
+	MIRROR_IGNORE,		// Count it and keep trying, the other paths stay keyed
+	MIRROR_ABORT		// Unkey every path until the line is next released
+};
+
+typedef struct
+{
+	char spec[128];				// As configured
+	int type;					// MIRROR_xxx
+	int fd;						// Device, -1 if it could not be opened
+	int bits;					// TTY: TIOCM_xxx, CM108: GPIO mask
+	char on[32];				// CAT: command to key
+	char off[32];				// CAT: command to unkey
+	int state;					// Last state set, -1 if not yet
+	unsigned long ops;			// Changes made
+	unsigned long fails;		// Changes that failed
+	long long delay_max;		// Worst completion after the primary (ns)
+	long long delay_sum;		// Sum of completions after the primary (ns)
+} mirror_path;
+
+int getMirrorPolicy(const char * policy);
+int mirror_open(mirror_path * m, const char * spec);
+int mirror_set(mirror_path * m, int on);
+void mirror_close(mirror_path * m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MIRROR_H__ */
@@ -0,0 +1,2552 @@
+/* monitor.c - Input line monitor loop.
+ *
+ * In monitor mode ptt stays resident and samples the MSR of every port
+ * that has an input line (dir=IN or BI on CTS, DSR, RI or DCD) defined
+ * in the config file. Each input is run through its debounce filter and
+ * the filtered COR inputs are ORed together. Output lines with state=PTT
+ * follow COR, so a receiver's squelch keys a transmitter. Output lines
+ * with state=ON or OFF are set once at start up.
+ *
+ * Output lines with state=PULSE are pulsed on their own schedule (every,
+ * pulse and offset, in ms), and state=PTT lines can have a time-out
+ * timer that unkeys them if COR is held too long. The schedules live in
+ * a timer wheel (timer.c) ticking once per sample period.
+ *
+ * Every change due in one sample period, from COR or from timers, is
+ * collected first and then written with one MCR write per port. On
+ * SIGINT or SIGTERM the PTT outputs are unkeyed and the raw and filtered
+ * edge counts of every input are printed, SIGUSR1 prints them at any
+ * time so the filter times can be tuned.
+ *
+ * With a [CTCSS] section, COR is further qualified by the presence of
+ * the configured tone in the receiver audio, see ctcss.c. With a
+ * [RECORD] section the same audio is cut into one file per PTT, see
+ * segment.c.
+ *
+ * An input with state=PPS is taken as a GPS one pulse per second and its
+ * rising edges discipline a clock (see pps.c). PULSE outputs with
+ * sync=PPS are then scheduled on that clock, on UTC multiples of 'every'
+ * plus 'offset', instead of counting ticks from start up, so several
+ * sites keying to the same schedule stay in step. Until the clock locks
+ * they run free.
+ *
+ * With a [STANDBY] section the MCR images and a lease are published in
+ * shared memory for a ptt --standby to take over from, see standby.c.
+ *
+ * SIGUSR2 re-execs ptt in place, handing the loop's state and open fds
+ * to the new binary (see handover.c), so an upgrade leaves the lines, the
+ * timers, the filters and a recording in progress as they were. The gap
+ * in sampling it causes is reported.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <poll.h>
+
+#include "ptt.h"
+#include "histlog.h"
+#include "uart.h"
+#include "debounce.h"
+#include "pcm.h"
+#include "ctcss.h"
+#include "segment.h"
+#include "timer.h"
+#include "pps.h"
+#include "standby.h"
+#include "status.h"
+#include "handover.h"
+#include "panic.h"
+#include "band.h"
+#include "rules.h"
+#include "keyer.h"
+#include "winkey.h"
+#include "sidetone.h"
+#include "shiftreg.h"
+#include "evdev.h"
+#include "mirror.h"
+#include "budget.h"
+#include "outlier.h"
+#include "probes.h"
+#include "monitor.h"
+
+typedef struct
+{
+	int used;					// Port has a line defined on it
+	int index;					// Port number
+	int inputs;					// Port has input lines, sample its MSR
+	int base;					// UART base IO address
+	int mcr;					// MCR IO address
+	unsigned char mcr_mask;		// MCR bits kept on write, from the UART type
+	unsigned char msr;			// Last MSR sample
+	unsigned char shadow;		// MCR as last written or read
+	int wrote;					// MCR written this period
+	int lock_fd;				// Port lock file, held open, -1 if none
+} mon_port;
+
+typedef struct
+{
+	line_def * ld;				// Config for this input
+	mon_port * port;			// Port the input is on, NULL for evdev
+	unsigned char msr_mask;		// MSR bit of the input
+	evdev_key ev;				// Input device key, fd -1 for a serial input
+	int raw;					// Last unfiltered level
+	debounce db;				// Input filter
+} mon_input;
+
+typedef struct
+{
+	line_def * ld;				// Config for this output
+	mon_port * port;			// Port the output is on
+	unsigned char mcr_bits;		// MCR bit(s) of the output
+	int sr_bit;					// line=SR: bit of the shift register chain, else -1
+	ptt_timer on_timer;			// PULSE: next pulse, PTT: time-out
+	ptt_timer off_timer;		// PULSE: end of this pulse
+	int timed_out;				// PTT: time-out timer has fired
+	int want;					// State last queued
+	int changed;				// 'want' changed this period
+	mirror_path mirrors[MAX_MIRRORS];	// Extra keying paths
+	int n_mirrors;
+	int aborted;				// A mirror failed to key, mirror_fail=ABORT
+	long long skew_max;			// Worst spread of the paths on one change (ns)
+} mon_output;
+
+static mon_port ports[MAX_PORTS];
+static mon_input inputs[MAX_LINES];
+static mon_output outputs[MAX_LINES];
+static int n_inputs;
+static int n_outputs;
+static unsigned long overruns;
+static pcm_in audio;
+static int use_audio;
+static ctcss tone;
+static int use_tone;
+static segmenter rec;
+static int use_record;
+
+static unsigned char pend_set[MAX_PORTS];	// MCR bits to set this period
+static unsigned char pend_clr[MAX_PORTS];	// MCR bits to clear this period
+
+static timer_wheel wheel;
+static int tick_us;							// Timer tick, the sample period
+static long long loop_ns;					// Start of this period, from t0
+static long long late_max;					// Worst timer lateness (ns)
+static long long late_sum;					// Total timer lateness (ns)
+static unsigned long timeouts;				// PTT time-outs
+
+static pps_clock pps;						// GPS disciplined clock
+static int use_pps;
+static long long prev_ns;					// Start of the last period
+
+static standby_shm * shared;				// Hot standby state, NULL if none
+static int lease_ms;
+static unsigned char safe_set[MAX_PORTS];	// MCR bits that release the
+static unsigned char safe_clr[MAX_PORTS];	// keyed outputs
+
+#define HANDOVER_MAGIC	0x50545448	// 'PTTH'
+#define UPGRADE_GRACE	1000		// Lease extension over an upgrade (ms)
+
+/* Everything the loop holds that an upgrade hands to the new binary. It
+ * is only read back by a binary with the same layout and line table.
+ */
+typedef struct
+{
+	unsigned int magic;			// HANDOVER_MAGIC
+	unsigned int size;			// sizeof(mon_handover)
+	int n_inputs;
+	int n_outputs;
+	struct timespec t0;			// Loop time base, kept so timers carry over
+	long long last_ns;			// Start of the last period before the exec
+	int last_cor;
+	unsigned long long wheel_now;
+	debounce db[MAX_LINES];
+	int raw[MAX_LINES];
+	unsigned long long on_expires[MAX_LINES];	// 0 if not armed
+	unsigned long long off_expires[MAX_LINES];
+	int timed_out[MAX_LINES];
+	int want[MAX_LINES];		// Outputs as last queued
+	pps_clock pps;
+	int use_audio;
+	pcm_in audio;
+	int use_tone;
+	ctcss tone;
+	int use_record;
+	segmenter rec;
+	unsigned long overruns;
+	unsigned long timeouts;
+	long long late_max;
+	long long late_sum;
+	unsigned long upgrades;		// Upgrades so far
+	long long stall_max;		// Longest sampling gap of an upgrade (ns)
+	int use_winkey;
+	winkey wk;					// pty and host protocol state
+	keyer cw;					// Text buffered and the character in hand
+	unsigned long cw_edges;
+	long long cw_late_max;
+	long long cw_late_sum;
+	long long cw_len_max;
+	int qsk_tr;					// T/R relay level and timing, for the guards
+	long long qsk_tr_ns;
+	long long qsk_up_ns;
+	unsigned long qsk_marks;
+	unsigned long qsk_open;
+	unsigned long qsk_lead_short;
+	long long qsk_lead_min;
+	unsigned long qsk_opens;
+	unsigned long qsk_tail_short;
+	long long qsk_tail_min;
+	unsigned long qsk_dwell_short;
+	long long qsk_dwell_min;
+	unsigned long qsk_merged;
+	int use_sidetone;
+	sidetone side;				// Output fd, stream position and tone state
+	int use_shift;
+	shift_reg chain;			// Image, what is latched and whether that's known
+	int rule_last;				// Rule table entry last driven
+	unsigned long rule_evals;
+	unsigned long rule_changes;
+} mon_handover;
+
+static mon_handover * handed;				// State from the last binary
+#ifdef PTT_EMBEDDED
+static mon_handover handing;				// State for the next binary
+#endif
+static unsigned long upgrades;
+static long long stall_last;
+static long long stall_max;
+
+static volatile sig_atomic_t running;
+static volatile sig_atomic_t report;
+static volatile sig_atomic_t upgrade;
+static volatile sig_atomic_t panicked;		// Signalled panic, latched
+static volatile sig_atomic_t in_write;		// port_write() in progress
+static volatile sig_atomic_t rewrite;		// Panic hit during port_write()
+static int estop;							// An E-stop input is active
+static int use_panic;						// Have keyed outputs to release
+
+static int use_mirrors;
+static unsigned long mirror_aborts;
+static int panic_seen;						// Signalled panic has been acted on
+
+static struct pollfd wake_fds[MAX_LINES + 2];	// fds that can wake the loop
+static int n_wake_fds;
+static int sampling;						// Serial inputs need sampling
+static int cur_period_us;					// Sample period now
+static int idle_period_us;					// Longest sample period
+static int idle_after_ms;					// Quiet time before slowing down
+static long long quiet_since;				// Last input activity, or slow down
+static unsigned long wakeups;
+
+static long long ev_lat_max;				// Worst key event to MCR write (ns)
+static long long ev_lat_sum;
+static unsigned long ev_lat_n;
+
+static band_decoder bands;
+static int use_bands;
+static int band_wake;						// Its wake_fds slot, -1 if none
+static long long band_late_max;				// Worst frequency read to write (ns)
+
+static rule_table rule_tab;				// [RULES], compiled
+static int use_rules;
+static int * rule_in[MAX_RULE_INPUTS];		// Level behind each name
+static mon_output * rule_out[MAX_RULES];	// Line each rule drives
+static int rule_last;						// Last table entry, -1 to drive all
+static unsigned long rule_evals;
+static unsigned long rule_changes;
+
+static keyer cw;							// [WINKEY] keyer
+static winkey wk;
+static int use_winkey;
+static unsigned long cw_edges;				// Key edges written
+static long long cw_late_max;				// Worst edge due to MCR write (ns)
+static long long cw_late_sum;
+static long long cw_late_last;				// Lateness of the last edge
+static long long cw_len_max;				// Worst element length error (ns)
+static int qsk_tr;							// T/R level last written
+static long long qsk_tr_ns;					// When T/R last changed
+static long long qsk_up_ns;					// When the key last came up
+static unsigned long qsk_marks;				// Elements checked for guard time
+static unsigned long qsk_open;				// Elements keyed with T/R open
+static unsigned long qsk_lead_short;		// Elements short of the lead guard
+static long long qsk_lead_min;				// Shortest lead guard, -1 for none
+static unsigned long qsk_opens;				// Times T/R opened
+static unsigned long qsk_tail_short;		// Opens short of the tail guard
+static long long qsk_tail_min;
+static unsigned long qsk_dwell_short;		// Relay changes short of the dwell
+static long long qsk_dwell_min;
+static unsigned long qsk_merged;			// T/R and key in one MCR write
+static sidetone side;						// Sidetone for the CW line
+static int use_sidetone;
+
+static shift_reg chain;						// [SHIFTREG] outputs
+static int use_shift;
+static int chain_port;						// Data and clock port
+static int chain_latch;						// Latch port
+
+static long heap_start;						// Heap in use when the loop started
+
+static status_shm * status;					// Published line state, NULL if none
+static const char * status_name;
+
+static outlier_log slow;					// Slow transitions, if logged
+static int use_outliers;
+static long long req_ns;					// When this period's changes were due
+
+static hist_writer hist;					// History log, if --log or LogFile
+static int use_hist;
+
+static void on_stop(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static void on_report(int sig)
+{
+	(void)sig;
+	report = 1;
+}
+
+static void on_upgrade(int sig)
+{
+	(void)sig;
+	upgrade = 1;
+}
+
+static void on_panic(int sig)
+{
+	(void)sig;
+	panic_fire(0);
+	panicked = 1;
+	if (in_write)
+		rewrite = 1;
+}
+
+static unsigned char line_mcr_bits(int line)
+{
+	switch (line)
+	{
+		case LINE_DTR: return(DTR_MASK);
+		case LINE_RTS: return(RTS_MASK);
+		case LINE_BOTH: return(DTR_MASK | RTS_MASK);
+		default: return(0);
+	}
+}
+
+static unsigned char line_msr_mask(int line)
+{
+	switch (line)
+	{
+		case LINE_CTS: return(CTS_MASK);
+		case LINE_DSR: return(DSR_MASK);
+		case LINE_RI: return(RI_MASK);
+		case LINE_DCD: return(DCD_MASK);
+		default: return(0);
+	}
+}
+
+static int ms_to_samples(int ms, int period_us)
+{
+	if (ms <= 0)
+		return(0);
+	return((ms * 1000 + period_us - 1) / period_us);
+}
+
+/* Keep the standby's copy of a port's MCR and the panic table up to
+ * date.
+ */
+static void publish_port(mon_port * p, unsigned char value)
+{
+	unsigned char safe;
+
+	p->shadow = value;
+	safe = ((value | safe_set[p->index]) & ~safe_clr[p->index]) & p->mcr_mask;
+	if (safe_set[p->index] | safe_clr[p->index])
+		panic_set(p->index, p->mcr, safe);
+
+	if (shared != NULL)
+	{
+		shared->ports[p->index].shadow = value;
+		shared->ports[p->index].safe = safe;
+	}
+}
+
+/* Read-modify-write the MCR of a port under the port lock */
+static void port_write(mon_port * p, unsigned char set, unsigned char clr)
+{
+	struct timespec t_out;
+	unsigned char old_value;
+	unsigned char new_value;
+
+	lock_take(p->lock_fd);
+	in_write = 1;
+
+	/* Whatever was queued before a panic, it must not key anything now */
+	if (panicked || estop)
+	{
+		set &= ~safe_clr[p->index];
+		clr &= ~safe_set[p->index];
+	}
+	old_value = inb(p->mcr);
+	PTT_PROBE_IO(inb, p->index, p->mcr, old_value, req_ns);
+	new_value = ((old_value | set) & ~clr) & p->mcr_mask;
+	outb(new_value, p->mcr);
+	PTT_PROBE_IO(outb, p->index, p->mcr, new_value, req_ns);
+	if (use_outliers)
+		clock_gettime(CLOCK_MONOTONIC, &t_out);
+
+	/* A panic between our inb and outb has just been undone, redo it */
+	if (rewrite)
+	{
+		rewrite = 0;
+		panic_write();
+	}
+	in_write = 0;
+	new_value = inb(p->mcr);
+	PTT_PROBE_IO(inb, p->index, p->mcr, new_value, req_ns);
+	if (use_outliers)
+		outlier_note(&slow, req_ns, t_out.tv_sec * 1000000000LL + t_out.tv_nsec,
+			p->index, p->mcr, old_value, new_value);
+	if (use_hist)
+		hist_add(&hist, HIST_MCR, p->mcr, 0, old_value, new_value);
+	lock_give(p->lock_fd);
+
+	p->wrote = TRUE;
+	publish_port(p, new_value);
+}
+
+/* Queue an output change for this period's MCR writes */
+static void pend_output(mon_output * o, int on)
+{
+	/* Nothing keys while a panic holds, or after a mirror failed to */
+	if ((panicked || estop) && isKeyedState(o->ld->state))
+		on = 0;
+	if (o->aborted)
+		on = 0;
+
+	if (on != o->want)
+		o->changed = 1;
+	o->want = on;
+	PTT_PROBE4(enqueue, o->ld->port, o->mcr_bits, on, req_ns);
+
+	/* The shift register chain is written as a whole in the flush */
+	if (o->sr_bit >= 0)
+	{
+		sr_set(&chain, o->sr_bit, on ^ o->ld->invert);
+		return;
+	}
+
+	if (on ^ o->ld->invert)
+	{
+		pend_set[o->ld->port] |= o->mcr_bits;
+		pend_clr[o->ld->port] &= ~o->mcr_bits;
+	}
+	else
+	{
+		pend_clr[o->ld->port] |= o->mcr_bits;
+		pend_set[o->ld->port] &= ~o->mcr_bits;
+	}
+}
+
+/* Shift out and latch the chain, under the locks of both its ports */
+static void shift_flush(void)
+{
+	mon_port * p = &ports[chain_port];
+	mon_port * l = &ports[chain_latch];
+	unsigned long long was = chain.valid ? chain.shifted : 0;
+	unsigned char p_old = p->shadow;
+	unsigned char l_old = l->shadow;
+	int i;
+
+	lock_take(p->lock_fd);
+	if (l != p)
+		lock_take(l->lock_fd);
+	in_write = 1;
+	sr_shift(&chain, &p->shadow, &l->shadow);
+
+	/* A panic during the shift was undone by it, redo it */
+	if (rewrite)
+	{
+		rewrite = 0;
+		panic_write();
+	}
+	in_write = 0;
+	if (l != p)
+		lock_give(l->lock_fd);
+	lock_give(p->lock_fd);
+
+	/* The MCRs' net change, and each output of the chain that changed */
+	if (use_hist)
+	{
+		hist_add(&hist, HIST_MCR, p->mcr, 0, p_old, p->shadow);
+		if (l != p)
+			hist_add(&hist, HIST_MCR, l->mcr, 0, l_old, l->shadow);
+		for (i = 0; i < chain.bits; i++)
+			if (((was ^ chain.shifted) >> i) & 1)
+				hist_add(&hist, HIST_SR, p->mcr, i, (was >> i) & 1, (chain.shifted >> i) & 1);
+	}
+
+	p->wrote = TRUE;
+	publish_port(p, p->shadow);
+	if (l != p)
+	{
+		l->wrote = TRUE;
+		publish_port(l, l->shadow);
+	}
+	if (shared != NULL)
+	{
+		shared->sr_image = chain.shifted;
+		shared->sr_valid = TRUE;
+	}
+}
+
+/* Write everything queued this period, one MCR write per port */
+static void flush_outputs(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		if (pend_set[i] | pend_clr[i])
+		{
+			PTT_PROBE4(dequeue, i, pend_set[i], pend_clr[i], req_ns);
+			port_write(&ports[i], pend_set[i], pend_clr[i]);
+		}
+		pend_set[i] = 0;
+		pend_clr[i] = 0;
+	}
+	if (use_shift && sr_dirty(&chain))
+		shift_flush();
+}
+
+/* Queue every output with the given state. For STATE_PTT outputs
+ * 'active' is the PTT value, for the fixed states it is ignored.
+ */
+static void drive_outputs(int state, int active)
+{
+	mon_output * o;
+	int i;
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->ld->state != state)
+			continue;
+
+		if (state == STATE_PTT)
+			pend_output(o, active && !o->timed_out);
+		else
+			pend_output(o, state == STATE_ON);
+	}
+}
+
+/* Queue every band output from the current band's pattern */
+static void drive_bands(void)
+{
+	unsigned int pattern = band_pattern(&bands);
+	mon_output * o;
+	int i;
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->ld->state == STATE_BAND)
+			pend_output(o, o->ld->bit < 32 && ((pattern >> o->ld->bit) & 1));
+	}
+}
+
+/* Look the rule outputs up from the names' levels, queueing those that
+ * changed, or all of them after rule_last was set to -1.
+ */
+static void drive_rules(void)
+{
+	unsigned int inputs = 0;
+	unsigned int diff;
+	unsigned int out;
+	int i;
+
+	for (i = 0; i < rule_tab.n_names; i++)
+		if (*rule_in[i] > 0)
+			inputs |= 1 << i;
+	out = rule_tab.table[inputs];
+	rule_evals++;
+
+	diff = rule_last < 0 ? 0xFFFF : out ^ rule_last;
+	if (diff == 0)
+		return;
+	if (rule_last >= 0)
+		rule_changes++;
+	rule_last = out;
+
+	for (i = 0; i < rule_tab.n_rules; i++)
+		if ((diff >> i) & 1)
+			pend_output(rule_out[i], (out >> i) & 1);
+}
+
+/* Queue the CW lines that differ from the keyer */
+static void drive_keyer(void)
+{
+	mon_output * o;
+	int i;
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->ld->state == STATE_CW && o->want != cw.key)
+			pend_output(o, cw.key);
+		else if (o->ld->state == STATE_CWPTT && o->want != cw.ptt)
+			pend_output(o, cw.ptt);
+	}
+}
+
+static void qsk_min(long long * min, long long d)
+{
+	if (*min < 0 || d < *min)
+		*min = d;
+}
+
+/* QSK: the guard times and relay dwell as written to the port at 't' */
+static void qsk_written(long long t)
+{
+	long long d;
+
+	if (cw.ptt != qsk_tr)
+	{
+		d = t - qsk_tr_ns;
+		if (qsk_tr_ns != 0)
+		{
+			qsk_min(&qsk_dwell_min, d);
+			if (d < cw.qsk_dwell_ms * 1000000LL - QSK_SLACK_NS)
+				qsk_dwell_short++;
+		}
+		if (!cw.ptt && qsk_up_ns != 0)
+		{
+			d = t - qsk_up_ns;
+			qsk_opens++;
+			qsk_min(&qsk_tail_min, d);
+			if (d < cw.qsk_tail_ms * 1000000LL - QSK_SLACK_NS)
+				qsk_tail_short++;
+		}
+		if (cw.edge_ns != 0)
+			qsk_merged++;
+		qsk_tr = cw.ptt;
+		qsk_tr_ns = t;
+	}
+
+	if (cw.edge_ns == 0)
+		return;
+	if (!cw.key)
+	{
+		qsk_up_ns = t;
+		return;
+	}
+	qsk_marks++;
+	if (!cw.ptt)
+	{
+		qsk_open++;
+		return;
+	}
+	d = t - qsk_tr_ns;
+	qsk_min(&qsk_lead_min, d);
+	if (d < cw.qsk_lead_ms * 1000000LL - QSK_SLACK_NS)
+		qsk_lead_short++;
+}
+
+/* After the flush: how late the key edge keyer_run() applied reached
+ * the port, how much that stretched or shrank the element or space
+ * before it, the QSK guard times and the sidetone edge for it
+ */
+static void keyer_written(void)
+{
+	struct timespec t;
+	long long late;
+	long long len;
+
+	if (cw.edge_ns == 0 && !(use_sidetone && side.key_set != cw.key) &&
+		!(cw.qsk && cw.ptt != qsk_tr))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	if (use_sidetone)
+		sidetone_edge(&side, cw.key, t.tv_sec * 1000000000LL + t.tv_nsec);
+	if (cw.qsk)
+		qsk_written(t.tv_sec * 1000000000LL + t.tv_nsec);
+	if (cw.edge_ns == 0)
+		return;
+
+	late = t.tv_sec * 1000000000LL + t.tv_nsec - cw.edge_ns;
+	cw_edges++;
+	cw_late_sum += late;
+	if (late > cw_late_max)
+		cw_late_max = late;
+	if (cw.edge_run)
+	{
+		len = late > cw_late_last ? late - cw_late_last : cw_late_last - late;
+		if (len > cw_len_max)
+			cw_len_max = len;
+	}
+	cw_late_last = late;
+}
+
+/* Start the WinKeyer emulation, the keyer needs a state=CW line to key */
+static int winkey_setup(configuration * cfg, int verbose)
+{
+	int i;
+
+	use_winkey = FALSE;
+	if (cfg->winkey_pty == NULL)
+		return(PASS);
+
+	for (i = 0; i < n_outputs; i++)
+		if (outputs[i].ld->state == STATE_CW)
+			break;
+	if (i == n_outputs)
+	{
+		printf("[WINKEY] needs an output line with state=CW\n");
+		return(FAIL);
+	}
+
+	keyer_init(&cw, cfg->winkey_wpm);
+	if (cfg->qsk)
+	{
+		for (i = 0; i < n_outputs; i++)
+			if (outputs[i].ld->state == STATE_CWPTT)
+				break;
+		if (i == n_outputs)
+		{
+			printf("[WINKEY] QSK needs an output line with state=CWPTT for T/R\n");
+			return(FAIL);
+		}
+		keyer_qsk(&cw, cfg->qsk_lead, cfg->qsk_tail, cfg->qsk_hang, cfg->qsk_dwell);
+		qsk_lead_min = -1;
+		qsk_tail_min = -1;
+		qsk_dwell_min = -1;
+	}
+	if (handed != NULL && handed->use_winkey)
+	{
+		cw = handed->cw;
+		winkey_adopt(&wk, &cw, &handed->wk);
+	}
+	else if (winkey_open(&wk, &cw, cfg->winkey_pty) != 0)
+	{
+		printf("Can't open WinKeyer pty '%s': %s\n", cfg->winkey_pty, strerror(errno));
+		return(FAIL);
+	}
+
+	/* Element edges are timed by the sleep, don't let the kernel round it */
+	prctl(PR_SET_TIMERSLACK, 1UL);
+	use_winkey = TRUE;
+	if (verbose)
+		printf("WinKeyer on '%s', %d wpm\n", cfg->winkey_pty, cw.wpm);
+	if (verbose && cw.qsk)
+		printf("QSK: T/R lead %d ms, tail %d ms, hang %d ms, dwell %d ms\n",
+			cw.qsk_lead_ms, cw.qsk_tail_ms, cw.qsk_hang_ms, cw.qsk_dwell_ms);
+
+	use_sidetone = FALSE;
+	if (cfg->sidetone != NULL)
+	{
+		/* The stream carries on from the old binary's sample count */
+		if (handed != NULL && handed->use_sidetone)
+			side = handed->side;
+		else if (sidetone_open(&side, cfg->sidetone, cfg->sidetone_hz, cfg->sidetone_rate,
+				cfg->sidetone_rise, mono_now_ns()) != 0)
+		{
+			printf("Can't open sidetone output '%s': %s\n", cfg->sidetone, strerror(errno));
+			return(FAIL);
+		}
+		use_sidetone = TRUE;
+		if (verbose)
+			printf("Sidetone to '%s', %d samples/s\n", cfg->sidetone, side.rate);
+	}
+	return(PASS);
+}
+
+/* Compile [RULES] and bind each name to an input's filtered level or an
+ * output's driven one, and each rule to its state=RULE output.
+ */
+static int rules_setup(configuration * cfg, int verbose)
+{
+	int i;
+	int k;
+
+	use_rules = FALSE;
+	rule_last = -1;
+	if (cfg->rule_count == 0)
+	{
+		for (i = 0; i < n_outputs; i++)
+			if (outputs[i].ld->state == STATE_RULE)
+			{
+				printf("%s '%s': state=RULE but no [RULES] entry\n",
+					outputs[i].ld->section, outputs[i].ld->name);
+				return(FAIL);
+			}
+		return(PASS);
+	}
+
+	if (rule_compile(&rule_tab, cfg->rules, cfg->rule_count) != PASS)
+		return(FAIL);
+
+	for (i = 0; i < rule_tab.n_names; i++)
+	{
+		rule_in[i] = NULL;
+		for (k = 0; k < n_inputs && rule_in[i] == NULL; k++)
+			if (strcasecmp(inputs[k].ld->section, rule_tab.names[i]) == 0)
+				rule_in[i] = &inputs[k].db.out;
+		for (k = 0; k < n_outputs && rule_in[i] == NULL; k++)
+			if (strcasecmp(outputs[k].ld->section, rule_tab.names[i]) == 0)
+				rule_in[i] = &outputs[k].want;
+		if (rule_in[i] == NULL)
+		{
+			printf("[RULES] '%s' is not an input or output line\n", rule_tab.names[i]);
+			return(FAIL);
+		}
+	}
+
+	for (i = 0; i < cfg->rule_count; i++)
+	{
+		rule_out[i] = NULL;
+		for (k = 0; k < n_outputs; k++)
+			if (strcasecmp(outputs[k].ld->section, cfg->rules[i].output) == 0)
+				rule_out[i] = &outputs[k];
+		if (rule_out[i] == NULL || rule_out[i]->ld->state != STATE_RULE)
+		{
+			printf("[RULES] %s: not an output line with state=RULE\n", cfg->rules[i].output);
+			return(FAIL);
+		}
+		for (k = 0; k < i; k++)
+			if (rule_out[k] == rule_out[i])
+			{
+				printf("[RULES] %s: more than one rule\n", cfg->rules[i].output);
+				return(FAIL);
+			}
+	}
+
+	use_rules = TRUE;
+	if (verbose)
+		printf("Rules: %d over %d lines, %d table entries\n", rule_tab.n_rules,
+			rule_tab.n_names, 1 << rule_tab.n_names);
+	return(PASS);
+}
+
+static int ms_to_ticks(int ms)
+{
+	return(ms_to_samples(ms, tick_us));
+}
+
+/* How far behind its tick a timer fired */
+static void timer_lateness(ptt_timer * t)
+{
+	long long late = loop_ns - (long long)t->expires * tick_us * 1000LL;
+
+	if (late < 0)
+		late = 0;
+	if (late > late_max)
+		late_max = late;
+	late_sum += late;
+}
+
+/* The tick of the next UTC multiple of 'every' plus 'offset' after
+ * monotonic time 'after_ns', by the PPS clock.
+ */
+static unsigned long long pps_slot_tick(mon_output * o, long long after_ns)
+{
+	long long now_ms = pps_utc_ms(&pps, after_ns);
+	long long slot;
+	double ns;
+
+	slot = now_ms - (now_ms - o->ld->offset_ms) % o->ld->every_ms;
+	while (slot <= now_ms)
+		slot += o->ld->every_ms;
+
+	ns = pps_mono_ns(&pps, slot);
+	return((unsigned long long)((ns + tick_us * 1000.0 - 1.0) / (tick_us * 1000.0)));
+}
+
+static int pulse_synced(mon_output * o)
+{
+	return(o->ld->sync && o->ld->every_ms > 0 && pps.locked);
+}
+
+static void pulse_on(ptt_timer * t)
+{
+	mon_output * o = (mon_output *)t->data;
+
+	timer_lateness(t);
+	pend_output(o, 1);
+	tw_add(&wheel, &o->off_timer, t->expires + ms_to_ticks(o->ld->pulse_ms));
+	if (pulse_synced(o))
+		tw_add(&wheel, t, pps_slot_tick(o, loop_ns));
+	else if (o->ld->every_ms > 0)
+		tw_add(&wheel, t, t->expires + ms_to_ticks(o->ld->every_ms));
+}
+
+/* The PPS clock just locked: move the synced pulses onto GPS time */
+static void pps_resync(void)
+{
+	mon_output * o;
+	int i;
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->ld->state == STATE_PULSE && o->ld->pulse_ms > 0 && pulse_synced(o))
+			tw_add(&wheel, &o->on_timer, pps_slot_tick(o, loop_ns));
+	}
+}
+
+/* A PPS rising edge was seen this period. It happened somewhere since
+ * the last sample, so it is stamped in the middle of the two.
+ */
+static void pps_sample(void)
+{
+	struct timespec rt;
+	int was_locked = pps.locked;
+
+	clock_gettime(CLOCK_REALTIME, &rt);
+	pps_edge(&pps, (prev_ns + loop_ns) / 2,
+		rt.tv_sec + (rt.tv_nsec >= 500000000L ? 1 : 0));
+	if (pps.locked && !was_locked)
+		pps_resync();
+}
+
+static void pulse_off(ptt_timer * t)
+{
+	timer_lateness(t);
+	pend_output((mon_output *)t->data, 0);
+}
+
+static void ptt_timeout(ptt_timer * t)
+{
+	mon_output * o = (mon_output *)t->data;
+
+	timer_lateness(t);
+	o->timed_out = 1;
+	pend_output(o, 0);
+	timeouts++;
+}
+
+/* COR changed: start or stop the time-out timers of the PTT outputs */
+static void ptt_timers(int cor)
+{
+	mon_output * o;
+	int i;
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->ld->state != STATE_PTT)
+			continue;
+
+		/* Released: a time-out or a mirror failure no longer holds */
+		if (!cor)
+		{
+			o->timed_out = 0;
+			o->aborted = 0;
+		}
+
+		if (o->ld->timeout_ms <= 0)
+			continue;
+		if (cor)
+			tw_add(&wheel, &o->on_timer, wheel.now + ms_to_ticks(o->ld->timeout_ms));
+		else
+			tw_cancel(&wheel, &o->on_timer);
+	}
+}
+
+/* Bring one output's mirror paths to its state. Returns TRUE if a path
+ * failed.
+ */
+static int mirror_output(mon_output * o, long long primary_ns)
+{
+	struct timespec t;
+	mirror_path * m;
+	long long delay;
+	long long spread = 0;
+	int failed = FALSE;
+	int k;
+
+	for (k = 0; k < o->n_mirrors; k++)
+	{
+		m = &o->mirrors[k];
+		if (m->state == o->want)
+			continue;
+		if (mirror_set(m, o->want) != 0)
+		{
+			failed = TRUE;
+			continue;
+		}
+
+		/* Only the first try counts towards the skew, retries come late */
+		if (!o->changed)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		delay = t.tv_sec * 1000000000LL + t.tv_nsec - primary_ns;
+		if (delay > m->delay_max)
+			m->delay_max = delay;
+		m->delay_sum += delay;
+		if (delay > spread)
+			spread = delay;
+	}
+	if (spread > o->skew_max)
+		o->skew_max = spread;
+	o->changed = 0;
+	return(failed);
+}
+
+/* After this period's MCR writes: the mirror paths follow, in order.
+ * Failed paths are retried every period.
+ */
+static void drive_mirrors(void)
+{
+	struct timespec t;
+	long long primary_ns;
+	mon_output * o;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	primary_ns = t.tv_sec * 1000000000LL + t.tv_nsec;
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->n_mirrors == 0)
+			continue;
+
+		if (mirror_output(o, primary_ns) && o->want &&
+			o->ld->mirror_policy == MIRROR_ABORT)
+		{
+			/* All or nothing: unkey the line and every path of it */
+			o->aborted = TRUE;
+			mirror_aborts++;
+			pend_output(o, 0);
+			flush_outputs();
+			mirror_output(o, primary_ns);
+			printf("%s '%s': mirror failed to key, unkeyed all paths\n",
+				o->ld->section, o->ld->name);
+		}
+	}
+}
+
+/* Publish this period's line state for status readers */
+static void monitor_status(long long sample_ns, int cor)
+{
+	status_port * sp;
+	status_line * sl;
+	mon_port * p;
+	long long now = mono_now_ns();
+	int level;
+	int i;
+
+	status_begin(status);
+	status->updated_ns = now;
+	status->cor = cor;
+	status->estop = estop;
+	status->panicked = panicked;
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		p = &ports[i];
+		if (!p->used)
+			continue;
+		sp = &status->ports[i];
+		sp->shadow = p->shadow;
+		if (p->wrote)
+			sp->written_ns = now;
+		p->wrote = FALSE;
+		if (p->inputs)
+		{
+			sp->msr = p->msr;
+			sp->sampled_ns = sample_ns;
+		}
+	}
+	for (i = 0; i < status->n_lines; i++)
+	{
+		sl = &status->lines[i];
+		if (i < n_inputs)
+			level = inputs[i].db.out;
+		else
+			level = outputs[i - n_inputs].want > 0;
+		if (level != sl->level)
+		{
+			sl->level = level;
+			sl->changed_ns = now;
+		}
+	}
+	status_end(status);
+}
+
+/* Set up the status block's ports and lines, which never change */
+static void status_setup(configuration * cfg, int verbose)
+{
+	status_line * sl;
+	line_def * ld;
+	int i;
+
+	status_name = cfg->status_name != NULL ? cfg->status_name : DEF_STATUS_NAME;
+	status = status_create(status_name);
+	if (status == NULL)
+	{
+		printf("Can't publish status at '%s': %s\n", status_name, strerror(errno));
+		return;
+	}
+
+	status_begin(status);
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		status->ports[i].used = ports[i].used;
+		status->ports[i].mcr = ports[i].mcr;
+		status->ports[i].sampled = ports[i].inputs;
+		status->ports[i].shadow = ports[i].shadow;
+	}
+	for (i = 0; i < n_inputs + n_outputs; i++)
+	{
+		sl = &status->lines[i];
+		ld = i < n_inputs ? inputs[i].ld : outputs[i - n_inputs].ld;
+		strncpy(sl->section, ld->section, sizeof(sl->section) - 1);
+		strncpy(sl->name, ld->name, sizeof(sl->name) - 1);
+		sl->port = (i < n_inputs && inputs[i].port == NULL) ? -1 : ld->port;
+		sl->line = ld->line;
+		sl->output = i >= n_inputs;
+		sl->state = ld->state;
+		sl->level = -1;
+	}
+	status->n_lines = n_inputs + n_outputs;
+	status_end(status);
+	if (verbose)
+		printf("Line state published at '%s'\n", status_name);
+}
+
+static void monitor_report(void)
+{
+	struct rusage ru;
+	double cpu;
+	mon_input * in;
+	mon_output * o;
+	mirror_path * m;
+	int i;
+	int k;
+
+	for (i = 0; i < n_inputs; i++)
+	{
+		in = &inputs[i];
+		printf("%s '%s' (%s): raw edges %lu, filtered edges %lu, now %s\n",
+			in->ld->section, in->ld->name, getLineName(in->ld->line),
+			in->db.raw_edges, in->db.edges, in->db.out ? "ON" : "OFF");
+	}
+	if (use_tone)
+		printf("CTCSS: %lu samples, %lu windows, %lu with tone, last ratio %.3f, now %s\n",
+			tone.samples, tone.windows, tone.hits, tone.ratio,
+			tone.present ? "ON" : "OFF");
+	if (use_record)
+		printf("Record: %lu files, %lu samples in, %lu written, %lu dropped, %lu writes, %.1f MB/s\n",
+			rec.files, rec.samples_in, rec.samples_out, rec.dropped, rec.writes,
+			rec.write_time > 0.0 ? rec.samples_out * 2 / rec.write_time / 1e6 : 0.0);
+	printf("Timers: %lu pending, %lu fired, lateness max %lld us, avg %lld us, %lu PTT time-outs\n",
+		wheel.pending, wheel.fired, late_max / 1000,
+		wheel.fired ? late_sum / (long long)wheel.fired / 1000 : 0LL, timeouts);
+	if (use_pps)
+		printf("PPS: %s, %lu edges, %lu rejected, phase error last %.1f us, rms %.1f us, max %.1f us, freq %+.3f ppm\n",
+			pps.locked ? "locked" : "unlocked", pps.edges, pps.rejected, pps.err_ns / 1000.0,
+			pps.err_n ? sqrt(pps.err_sq / pps.err_n) / 1000.0 : 0.0, pps.err_max / 1000.0,
+			(pps.period_ns - 1e9) / 1e3);
+	if (use_panic)
+		printf("Panic: %lu triggers, trigger to last outb last %.1f us, worst %.1f us, outb loop worst %.1f us%s\n",
+			panic_time.triggers, panic_time.last_ns / 1e3, panic_time.worst_ns / 1e3,
+			panic_time.write_ns / 1e3, panicked ? ", holding" : estop ? ", E-stop active" : "");
+	for (i = 0; i < n_outputs && use_mirrors; i++)
+	{
+		o = &outputs[i];
+		for (k = 0; k < o->n_mirrors; k++)
+		{
+			m = &o->mirrors[k];
+			printf("%s '%s' mirror %s: %lu changes, %lu failed, after MCR max %.1f us, avg %.1f us\n",
+				o->ld->section, o->ld->name, m->spec, m->ops, m->fails, m->delay_max / 1e3,
+				m->ops > m->fails ? m->delay_sum / 1e3 / (m->ops - m->fails) : 0.0);
+		}
+		if (o->n_mirrors > 0)
+			printf("%s '%s': path skew max %.1f us, now %s\n", o->ld->section, o->ld->name,
+				o->skew_max / 1e3, o->aborted ? "aborted" : o->want ? "ON" : "OFF");
+	}
+	if (mirror_aborts > 0)
+		printf("Mirror aborts: %lu\n", mirror_aborts);
+	if (ev_lat_n > 0)
+		printf("Input devices: %lu edges, key event to MCR write max %.1f us, avg %.1f us (filter time included)\n",
+			ev_lat_n, ev_lat_max / 1e3, ev_lat_sum / 1e3 / ev_lat_n);
+	for (i = 0; i < n_inputs; i++)
+		if (inputs[i].ev.lost > 0)
+			printf("%s '%s': %lu key changes lost, more than %d in one period\n",
+				inputs[i].ld->section, inputs[i].ld->name, inputs[i].ev.lost, EVDEV_QUEUE);
+	if (use_bands)
+		printf("Band: %lu frequencies, %lu bad lines, %lu band changes, %lu disconnects, now %s (%lld Hz), read to write max %.1f us\n",
+			bands.freqs, bands.errors, bands.changes, bands.disconnects, band_name(&bands),
+			bands.freq, band_late_max / 1e3);
+	if (use_rules)
+		printf("Rules: %lu lookups, %lu changes\n", rule_evals, rule_changes);
+	if (use_winkey)
+		printf("Keyer: %lu characters, %lu elements, %lu host bytes; key edge due to MCR write max %.1f us, avg %.1f us, element length error max %.1f us\n",
+			cw.chars, cw.marks, wk.bytes, cw_late_max / 1e3,
+			cw_edges > 0 ? cw_late_sum / 1e3 / cw_edges : 0.0, cw_len_max / 1e3);
+	if (use_winkey && cw.qsk)
+		printf("QSK: %lu elements, %lu keyed with T/R open, lead guard min %.2f ms (%lu short), %lu T/R opens, tail guard min %.2f ms (%lu short), relay dwell min %.2f ms (%lu short), %lu T/R edges merged with a key edge\n",
+			qsk_marks, qsk_open, qsk_lead_min > 0 ? qsk_lead_min / 1e6 : 0.0, qsk_lead_short,
+			qsk_opens, qsk_tail_min > 0 ? qsk_tail_min / 1e6 : 0.0, qsk_tail_short,
+			qsk_dwell_min > 0 ? qsk_dwell_min / 1e6 : 0.0, qsk_dwell_short,
+			qsk_merged);
+	if (use_sidetone)
+		printf("Sidetone: %llu samples written, %llu dropped, %lu gaps; %lu edges, key MCR write to its first sample written max %.1f us, avg %.1f us, on the sample to within %.1f us\n",
+			side.written, side.dropped, side.gaps, side.n_written, side.lat_max / 1e3,
+			side.n_written > 0 ? side.lat_sum / 1e3 / side.n_written : 0.0,
+			500000.0 / side.rate);
+	if (use_shift)
+		printf("Shift register: %lu refreshes, %.1f/s, %d outb()s each, refresh max %.1f us, avg %.1f us, up to %.0f/s\n",
+			chain.updates, loop_ns > 0 ? chain.updates / (loop_ns / 1e9) : 0.0,
+			2 * chain.bits + 3, chain.time_max / 1e3,
+			chain.updates > 0 ? chain.time_sum / 1e3 / chain.updates : 0.0,
+			chain.time_sum > 0 ? chain.updates / (chain.time_sum / 1e9) : 0.0);
+	if (use_hist)
+		printf("History: %lu records in %lu writes, %lu dropped, %d waiting\n",
+			hist.records, hist.writes, hist.dropped, hist.n);
+	if (use_outliers)
+		printf("Outliers: %lu over %.3f ms, worst request to outb %.3f ms\n",
+			slow.count, slow.threshold_ns / 1e6, slow.worst_ns / 1e6);
+	if (upgrades > 0)
+		printf("Upgrades: %lu, sampling gap last %.3f ms, max %.3f ms\n",
+			upgrades, stall_last / 1e6, stall_max / 1e6);
+	getrusage(RUSAGE_SELF, &ru);
+	cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+	if (loop_ns > 0)
+		printf("Wakeups: %lu, %.1f/s, CPU %.2f s/hour, %s\n", wakeups,
+			wakeups / (loop_ns / 1e9), cpu * 3600.0 / (loop_ns / 1e9),
+			sampling ? "sampling" : "event driven");
+	if (sampling)
+		printf("Sample period now %d us\n", cur_period_us);
+	printf("Sample overruns: %lu\n", overruns);
+	printf("Memory: resident %ld kB, peak %ld kB, locked %ld kB, heap %+ld bytes since start\n",
+		budget_proc_kb("VmRSS"), budget_proc_kb("VmHWM"), budget_proc_kb("VmLck"),
+		budget_heap() - heap_start);
+	fflush(stdout);
+}
+
+/* Take the standby lease and publish the ports we drive */
+static int monitor_share(configuration * cfg, int verbose)
+{
+	standby_port * sp;
+	int i;
+
+	shared = standby_attach(cfg->standby_name, TRUE);
+	if (shared == NULL)
+	{
+		printf("Can't attach standby memory '%s': %s\n", cfg->standby_name, strerror(errno));
+		return(FAIL);
+	}
+
+	lease_ms = cfg->standby_lease > 0 ? cfg->standby_lease : DEF_STANDBY_LEASE;
+
+	/* A quiet loop must still come round well inside the lease */
+	if (cfg->idle_period_us >= lease_ms * 1000)
+	{
+		printf("[MONITOR] IdlePeriod %d us must be below the [STANDBY] Lease of %d ms\n",
+			cfg->idle_period_us, lease_ms);
+		shared = NULL;
+		return(FAIL);
+	}
+
+	if (standby_claim(shared, lease_ms) != 0)
+	{
+		printf("Standby memory '%s' is leased to live pid %d\n", cfg->standby_name,
+			(int)shared->owner);
+		shared = NULL;
+		return(FAIL);
+	}
+
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		sp = &shared->ports[i];
+		sp->used = ports[i].used;
+		sp->mcr = ports[i].mcr;
+		sp->mcr_mask = ports[i].mcr_mask;
+		if (sp->used)
+			publish_port(&ports[i], inb(ports[i].mcr));
+	}
+
+	if (verbose)
+		printf("Holding standby lease on '%s', %d ms\n", cfg->standby_name, lease_ms);
+	return(PASS);
+}
+
+/* Let 'fd' wake the loop, if it is something poll() can wait on. A
+ * plain file always reads as ready, it is drained every wakeup anyway.
+ * Returns its slot, or -1.
+ */
+static int add_wake_fd(int fd)
+{
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) != 0)
+		return(-1);
+	if (!S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode) && !S_ISCHR(st.st_mode))
+		return(-1);
+	wake_fds[n_wake_fds].fd = fd;
+	wake_fds[n_wake_fds].events = POLLIN;
+	return(n_wake_fds++);
+}
+
+/* Sleep until 'deadline', or for good if it is NULL, unless a wake fd
+ * has data or a signal comes first.
+ */
+static void monitor_sleep(struct timespec * deadline)
+{
+	struct timespec now;
+	struct timespec rel;
+	long long ns;
+	int i;
+
+	if (n_wake_fds == 0)
+	{
+		if (deadline != NULL)
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+		else
+			pause();
+		return;
+	}
+
+	if (deadline != NULL)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ns = elapsed_ns(&now, deadline);
+		if (ns < 0)
+			ns = 0;
+		rel.tv_sec = ns / 1000000000LL;
+		rel.tv_nsec = ns % 1000000000LL;
+	}
+
+	if (ppoll(wake_fds, n_wake_fds, deadline != NULL ? &rel : NULL, NULL) > 0)
+		for (i = 0; i < n_wake_fds; i++)
+		{
+			/* FIFOs are opened read-write and never hang up, but a
+			 * pipe on stdin with no writer polls as hung up for ever:
+			 * stop waiting on it, it is still read on every wakeup.
+			 */
+			if ((wake_fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) &&
+				!(wake_fds[i].revents & POLLIN))
+				wake_fds[i].fd = -1;
+		}
+}
+
+static void ts_add_ns(struct timespec * t, long long ns)
+{
+	ns += t->tv_nsec;
+	t->tv_sec += ns / 1000000000LL;
+	t->tv_nsec = ns % 1000000000LL;
+}
+
+/* The sample period to use next: back to Period on any activity, and
+ * doubled for every IdleAfter of quiet, up to IdlePeriod.
+ */
+static int adapt_period(int period_us, int activity)
+{
+	if (activity)
+	{
+		quiet_since = loop_ns;
+		cur_period_us = period_us;
+	}
+	else if (cur_period_us < idle_period_us &&
+		loop_ns - quiet_since >= idle_after_ms * 1000000LL)
+	{
+		cur_period_us *= 2;
+		if (cur_period_us > idle_period_us)
+			cur_period_us = idle_period_us;
+		quiet_since = loop_ns;
+	}
+	return(cur_period_us);
+}
+
+static void add_input(line_def * ld, mon_port * p, int evfd, int period_us)
+{
+	mon_input * in = &inputs[n_inputs++];
+
+	in->ld = ld;
+	in->port = p;
+	in->msr_mask = p != NULL ? line_msr_mask(ld->line) : 0;
+	evdev_init(&in->ev, evfd, ld->key);
+	in->raw = 0;
+	debounce_init(&in->db, ld->filter,
+		ms_to_samples(ld->assert_ms, period_us),
+		ms_to_samples(ld->release_ms, period_us),
+		ms_to_samples(ld->minpulse_ms, period_us), 0);
+}
+
+/* After a takeover, start every filter settled on the level its line has
+ * now rather than at 0, or the first periods would see each held input
+ * as a fresh edge. COR lines start at the COR the standby took over with,
+ * so keyed PTT outputs stay keyed; a real change is then filtered as usual.
+ */
+static void seed_inputs(int cor)
+{
+	mon_input * in;
+	int level;
+	int i;
+
+	for (i = 0; i < n_inputs; i++)
+	{
+		in = &inputs[i];
+		if (in->port != NULL)
+			level = ((inb(in->port->base + UART_MSR) & in->msr_mask) != 0) ^ in->ld->invert;
+		else
+			level = in->ev.level ^ in->ld->invert;
+		in->raw = level;
+		debounce_init(&in->db, in->db.mode, in->db.assert_n, in->db.release_n,
+			in->db.minpulse_n, in->ld->state == STATE_COR ? cor : level);
+		in->db.raw = level;
+	}
+}
+
+/* Bytes of data monitor mode needs for 'cfg': its tables, which are
+ * static and sized for the most lines and ports, the buffers sized from
+ * the config at start up, and the config itself. Nothing else is
+ * allocated once the loop runs (in the embedded profile, not even for
+ * an upgrade), so this is the whole budget bar libc and the stack.
+ */
+long monitor_budget(configuration * cfg, int verbose)
+{
+	long tables;
+	long audio_bytes = 0;
+	long record = 0;
+	long shared_bytes = 0;
+	long upgrade = sizeof(mon_handover);
+	long config_bytes;
+	long total;
+	int rate;
+
+	tables = sizeof(ports) + sizeof(inputs) + sizeof(outputs) +
+		sizeof(pend_set) + sizeof(pend_clr) + sizeof(safe_set) + sizeof(safe_clr) +
+		sizeof(wheel) + sizeof(pps) + sizeof(wake_fds) + sizeof(bands) + sizeof(rule_tab) +
+		sizeof(cw) + sizeof(wk) + sizeof(side) + sizeof(chain) +
+		sizeof(slow) + sizeof(hist) + sizeof(status_shm) + MAX_PORTS * sizeof(panic_pair);
+
+	if (cfg->audio != NULL)
+	{
+		rate = cfg->audio_rate > 0 ? cfg->audio_rate : DEF_AUDIO_RATE;
+		audio_bytes = sizeof(audio) + PCM_CHUNK * sizeof(short);
+		if (cfg->ctcss_tone > 0.0)
+			audio_bytes += sizeof(tone);
+		if (cfg->record_dir != NULL)
+			record = sizeof(rec) + SEG_BUFSIZE + (long)rate *
+				(cfg->record_preroll > 0 ? cfg->record_preroll : DEF_SEG_PREROLL) /
+				1000 * sizeof(short);
+	}
+	if (cfg->standby_name != NULL)
+		shared_bytes = sizeof(standby_shm);
+
+#ifdef PTT_EMBEDDED
+	config_bytes = sizeof(configuration) + CFG_POOL_SIZE;
+#else
+	config_bytes = sizeof(configuration) + cfg_pool_used();
+#endif
+
+	total = tables + audio_bytes + record + shared_bytes + upgrade + config_bytes;
+	if (verbose)
+		printf("Memory budget: tables %ld, audio %ld, recording %ld, standby %ld, upgrade %ld, config %ld, total %ld bytes (%ld kB)\n",
+			tables, audio_bytes, record, shared_bytes, upgrade, config_bytes,
+			total, (total + 1023) / 1024);
+	return(total);
+}
+
+/* Get the IO grant for a port the first time a line uses it */
+static int port_open(mon_port * p)
+{
+	if (p->used)
+		return(PASS);
+
+	p->used = TRUE;
+	p->index = p - ports;
+	p->base = getPortAddress(p->index);
+	p->mcr = (p->base + MCR_ADDR_OFFSET) & IO_MASK;
+	p->mcr_mask = uart_mcr_mask(uart_cache_load(lockdir, p->base));
+
+	/* Opened once, each write then only costs the flock() pair */
+	p->lock_fd = lock_open(p->mcr);
+	if (p->lock_fd < 0 && strlen(lockdir) > 0)
+		printf("Warning, can't lock port 0x%04X in '%s', continuing unlocked\n",
+			p->mcr, lockdir);
+
+	/* MCR, LSR and MSR are consecutive */
+	if (ioperm(p->mcr, 3, ON) != 0)
+	{
+		printf("ptt: ioperm(0x%x) failed: %s\n", p->mcr, strerror(errno));
+		return(FAIL);
+	}
+	p->shadow = inb(p->mcr);
+	PTT_PROBE3(backend_open, p->index, p->mcr, p->mcr_mask);
+	return(PASS);
+}
+
+/* Set up the [SHIFTREG] chain. Its data, clock and latch lines are its
+ * own, no other output may use them.
+ */
+static int shift_setup(configuration * cfg, int verbose)
+{
+	unsigned char latch_bit;
+	mon_output * o;
+	int i;
+
+	use_shift = FALSE;
+	if (cfg->sr_bits == 0)
+		return(PASS);
+
+	chain_port = cfg->sr_port;
+	chain_latch = cfg->sr_latch_line == LINE_NONE ? cfg->sr_port : cfg->sr_latch_port;
+	latch_bit = cfg->sr_latch_line == LINE_NONE ? SR_OUT1 : line_mcr_bits(cfg->sr_latch_line);
+	if (port_open(&ports[chain_port]) != PASS || port_open(&ports[chain_latch]) != PASS)
+		return(FAIL);
+	if (!(ports[chain_latch].mcr_mask & latch_bit))
+	{
+		printf("[SHIFTREG] port %d's UART has no OUT1, give Latch=<port>:<DTR|RTS>\n",
+			chain_latch);
+		return(FAIL);
+	}
+
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		if (o->sr_bit >= 0)
+			continue;
+		if ((o->port->index == chain_port && (o->mcr_bits & (SR_DATA | SR_CLOCK))) ||
+			(o->port->index == chain_latch && (o->mcr_bits & latch_bit)))
+		{
+			printf("%s '%s': line is used by the [SHIFTREG] chain\n", o->ld->section, o->ld->name);
+			return(FAIL);
+		}
+	}
+
+	sr_init(&chain, cfg->sr_bits, ports[chain_port].mcr, ports[chain_latch].mcr, latch_bit,
+		ports[chain_port].mcr_mask, ports[chain_latch].mcr_mask);
+	use_shift = TRUE;
+	if (verbose)
+		printf("Shift register: %d bits on port %d, latch on port %d %s\n", chain.bits,
+			chain_port, chain_latch,
+			cfg->sr_latch_line == LINE_NONE ? "OUT1" : getLineName(cfg->sr_latch_line));
+	return(PASS);
+}
+
+/* Build the port, input and output tables from the config line table */
+static int monitor_setup(configuration * cfg, int period_us, int verbose)
+{
+	struct sched_param sp;
+	line_def * ld;
+	mon_port * p;
+	int evfd;
+	int rate;
+	int i;
+	int k;
+
+	memset(ports, 0x00, sizeof(ports));
+	memset(safe_set, 0x00, sizeof(safe_set));
+	memset(safe_clr, 0x00, sizeof(safe_clr));
+	use_mirrors = FALSE;
+	pps_init(&pps);
+	use_pps = FALSE;
+	n_inputs = 0;
+	n_outputs = 0;
+
+	for (i = 0; i < cfg->line_count; i++)
+	{
+		ld = &cfg->lines[i];
+		p = &ports[ld->port];
+
+		/* An input device key needs no serial port */
+		if (ld->device[0] != '\0' && ld->dir != DIR_OUT)
+		{
+			evfd = evdev_open(ld->device, ld->grab);
+			if (evfd < 0)
+			{
+				printf("Can't open input device '%s': %s\n", ld->device, strerror(errno));
+				return(FAIL);
+			}
+			add_input(ld, NULL, evfd, period_us);
+			if (verbose)
+				printf("%s '%s': %s key %d%s IN\n", ld->section, ld->name,
+					ld->device, ld->key, ld->grab ? " (grabbed)" : "");
+			continue;
+		}
+
+		if (line_msr_mask(ld->line) != 0 && ld->dir != DIR_OUT)
+		{
+			add_input(ld, p, -1, period_us);
+			p->inputs = TRUE;
+			if (ld->state == STATE_PPS)
+				use_pps = TRUE;
+		}
+		else if ((line_mcr_bits(ld->line) != 0 || ld->line == LINE_SR) && ld->dir != DIR_IN)
+		{
+			/* Shift register outputs are on the chain's port */
+			if (ld->line == LINE_SR)
+			{
+				if (ld->bit >= cfg->sr_bits)
+				{
+					printf("%s '%s': bit %d is not in the [SHIFTREG] chain\n",
+						ld->section, ld->name, ld->bit);
+					return(FAIL);
+				}
+				p = &ports[cfg->sr_port];
+			}
+			outputs[n_outputs].ld = ld;
+			outputs[n_outputs].port = p;
+			outputs[n_outputs].mcr_bits = line_mcr_bits(ld->line);
+			outputs[n_outputs].sr_bit = ld->line == LINE_SR ? ld->bit : -1;
+			outputs[n_outputs].timed_out = 0;
+			outputs[n_outputs].want = -1;
+			outputs[n_outputs].aborted = 0;
+			outputs[n_outputs].skew_max = 0;
+			outputs[n_outputs].n_mirrors = 0;
+			for (k = 0; k < ld->mirror_count; k++)
+			{
+				if (mirror_open(&outputs[n_outputs].mirrors[k], ld->mirror[k]) != 0)
+					printf("%s '%s': can't open mirror '%s': %s\n", ld->section, ld->name,
+						ld->mirror[k], strerror(errno));
+				outputs[n_outputs].n_mirrors++;
+				use_mirrors = TRUE;
+			}
+			tw_timer_init(&outputs[n_outputs].on_timer,
+				ld->state == STATE_PULSE ? pulse_on : ptt_timeout,
+				&outputs[n_outputs], 0);
+			tw_timer_init(&outputs[n_outputs].off_timer, pulse_off,
+				&outputs[n_outputs], 0);
+
+			/* Where the standby puts this output in a SAFE takeover */
+			if (isKeyedState(ld->state))
+			{
+				if (ld->invert)
+					safe_set[ld->port] |= line_mcr_bits(ld->line);
+				else
+					safe_clr[ld->port] |= line_mcr_bits(ld->line);
+			}
+			n_outputs++;
+		}
+		else
+			continue;
+
+		if (port_open(p) != PASS)
+			return(FAIL);
+
+		if (verbose)
+			printf("%s '%s': port %d (0x%04X) %s %s\n", ld->section, ld->name,
+				p->index, p->base, getLineName(ld->line),
+				ld->dir == DIR_OUT ? "OUT" : "IN");
+	}
+
+	if (shift_setup(cfg, verbose) != PASS)
+		return(FAIL);
+
+	if (n_inputs == 0 && n_outputs == 0)
+	{
+		printf("No input or output lines configured\n");
+		return(FAIL);
+	}
+
+	if (rules_setup(cfg, verbose) != PASS)
+		return(FAIL);
+
+	if (winkey_setup(cfg, verbose) != PASS)
+		return(FAIL);
+
+	/* Fill the panic table from what the ports hold now */
+	use_panic = FALSE;
+	for (i = 0; i < MAX_PORTS; i++)
+		if (ports[i].used && (safe_set[i] | safe_clr[i]))
+		{
+			publish_port(&ports[i], inb(ports[i].mcr));
+			use_panic = TRUE;
+		}
+
+	status_setup(cfg, verbose);
+
+	/* One grant for every port, so a panic never has to ask for one */
+	if (use_panic && panic_arm() != 0 && verbose)
+		printf("iopl() failed, panics use the per-port grants: %s\n", strerror(errno));
+
+	/* Load the time zone now, not on the first recording */
+	tzset();
+
+	if (cfg->priority > 0)
+	{
+		memset(&sp, 0x00, sizeof(sp));
+		sp.sched_priority = cfg->priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0 ||
+			mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+			printf("Can't run at real time priority %d: %s\n", cfg->priority, strerror(errno));
+		else if (verbose)
+			printf("Running at SCHED_FIFO priority %d, memory locked\n", cfg->priority);
+	}
+
+	if (cfg->standby_name != NULL && monitor_share(cfg, verbose) != PASS)
+		return(FAIL);
+
+	use_bands = FALSE;
+	if (cfg->band_source != NULL)
+	{
+		if (band_compile(cfg->bands, cfg->band_count) != PASS)
+			return(FAIL);
+		if (band_open(&bands, cfg->band_source, cfg->band_poll, cfg->bands,
+				cfg->band_count, cfg->band_default) != 0)
+		{
+			printf("Can't open band source '%s': %s\n", cfg->band_source, strerror(errno));
+			return(FAIL);
+		}
+		use_bands = TRUE;
+		if (verbose)
+			printf("Band data from '%s', %d bands\n", cfg->band_source, cfg->band_count);
+	}
+
+	use_hist = FALSE;
+	if (strlen(logfile) > 0)
+	{
+		if (hist_open(&hist, logfile) != 0)
+		{
+			printf("Can't open history '%s': %s\n", logfile, strerror(errno));
+			return(FAIL);
+		}
+		use_hist = TRUE;
+	}
+
+	use_outliers = FALSE;
+	if (cfg->outlier_us > 0 && cfg->outlier_log != NULL)
+	{
+		if (outlier_open(&slow, cfg->outlier_log, cfg->outlier_us, cfg->outlier_trace) != 0)
+		{
+			printf("Can't open outlier log '%s': %s\n", cfg->outlier_log, strerror(errno));
+			return(FAIL);
+		}
+		use_outliers = TRUE;
+		if (verbose)
+			printf("Transitions over %d us logged to '%s'\n", cfg->outlier_us, cfg->outlier_log);
+	}
+
+	use_audio = FALSE;
+	use_tone = FALSE;
+	use_record = FALSE;
+	if (cfg->audio == NULL)
+		return(PASS);
+
+	/* One receiver audio stream feeds both the tone detector and the
+	 * recorder.
+	 */
+	rate = cfg->audio_rate > 0 ? cfg->audio_rate : DEF_AUDIO_RATE;
+	if (handed != NULL && handed->use_audio)
+		audio = handed->audio;
+	else if (pcm_open(&audio, cfg->audio) != 0)
+	{
+		printf("Can't open audio '%s': %s\n", cfg->audio, strerror(errno));
+		return(FAIL);
+	}
+	use_audio = TRUE;
+
+	if (cfg->ctcss_tone > 0.0)
+	{
+		ctcss_init(&tone, rate, cfg->ctcss_tone,
+			cfg->ctcss_threshold > 0.0 ? cfg->ctcss_threshold : DEF_CTCSS_THRESHOLD,
+			cfg->ctcss_block > 0 ? cfg->ctcss_block : DEF_CTCSS_BLOCK);
+		if (handed != NULL && handed->use_tone)
+			tone = handed->tone;
+		use_tone = TRUE;
+		if (verbose)
+			printf("COR qualified by %.1f Hz CTCSS from '%s'\n",
+				cfg->ctcss_tone, cfg->audio);
+	}
+
+	if (cfg->record_dir != NULL)
+	{
+		if (segment_init(&rec, cfg->record_dir, rate,
+				cfg->record_preroll > 0 ? cfg->record_preroll : DEF_SEG_PREROLL) != 0)
+		{
+			printf("Can't allocate recording buffers\n");
+			return(FAIL);
+		}
+		if (handed != NULL && handed->use_record)
+			segment_adopt(&rec, &handed->rec);
+		use_record = TRUE;
+		if (verbose)
+			printf("Recording each transmission to '%s'\n", cfg->record_dir);
+	}
+	return(PASS);
+}
+
+/* Pick up the state of the binary we were upgraded from, if any, as
+ * long as it was running the same kind of loop on the same config.
+ */
+static void handover_check(configuration * cfg)
+{
+	size_t len = 0;
+
+	handed = (mon_handover *)handover_take(&len);
+	if (handed == NULL)
+		return;
+
+	if (len != sizeof(mon_handover) || handed->magic != HANDOVER_MAGIC ||
+		handed->use_audio != (cfg->audio != NULL) ||
+		handed->use_record != (cfg->record_dir != NULL) ||
+		handed->use_winkey != (cfg->winkey_pty != NULL) ||
+		handed->use_sidetone != (cfg->winkey_pty != NULL && cfg->sidetone != NULL) ||
+		handed->use_shift != (cfg->sr_bits != 0))
+	{
+		printf("Upgrade state doesn't match this binary or config, starting afresh\n");
+		if (len == sizeof(mon_handover) && handed->use_audio)
+			close(handed->audio.fd);
+		if (len == sizeof(mon_handover) && handed->use_record && handed->rec.fd >= 0)
+			close(handed->rec.fd);
+		if (len == sizeof(mon_handover) && handed->use_winkey)
+		{
+			close(handed->wk.slave);
+			close(handed->wk.fd);
+		}
+		if (len == sizeof(mon_handover) && handed->use_sidetone && handed->side.fd >= 0)
+			close(handed->side.fd);
+		free(handed);
+		handed = NULL;
+	}
+}
+
+/* Put the filters, timers and counters back as the old binary left them */
+static int handover_restore(void)
+{
+	mon_output * o;
+	int i;
+
+	if (handed->n_inputs != n_inputs || handed->n_outputs != n_outputs)
+		return(FAIL);
+
+	tw_init(&wheel, handed->wheel_now);
+	for (i = 0; i < n_inputs; i++)
+	{
+		inputs[i].db = handed->db[i];
+		inputs[i].raw = handed->raw[i];
+	}
+	for (i = 0; i < n_outputs; i++)
+	{
+		o = &outputs[i];
+		o->timed_out = handed->timed_out[i];
+		o->want = handed->want[i];
+		if (handed->on_expires[i] != 0)
+			tw_add(&wheel, &o->on_timer, handed->on_expires[i]);
+		if (handed->off_expires[i] != 0)
+			tw_add(&wheel, &o->off_timer, handed->off_expires[i]);
+	}
+
+	pps = handed->pps;
+	overruns = handed->overruns;
+	timeouts = handed->timeouts;
+	late_max = handed->late_max;
+	late_sum = handed->late_sum;
+	upgrades = handed->upgrades;
+	stall_max = handed->stall_max;
+
+	/* The registers still hold what the old binary latched */
+	if (use_shift)
+		chain = handed->chain;
+
+	cw_edges = handed->cw_edges;
+	cw_late_max = handed->cw_late_max;
+	cw_late_sum = handed->cw_late_sum;
+	cw_len_max = handed->cw_len_max;
+
+	/* The relay's dwell and tail guards are timed from its last change */
+	qsk_tr = handed->qsk_tr;
+	qsk_tr_ns = handed->qsk_tr_ns;
+	qsk_up_ns = handed->qsk_up_ns;
+	qsk_marks = handed->qsk_marks;
+	qsk_open = handed->qsk_open;
+	qsk_lead_short = handed->qsk_lead_short;
+	qsk_lead_min = handed->qsk_lead_min;
+	qsk_opens = handed->qsk_opens;
+	qsk_tail_short = handed->qsk_tail_short;
+	qsk_tail_min = handed->qsk_tail_min;
+	qsk_dwell_short = handed->qsk_dwell_short;
+	qsk_dwell_min = handed->qsk_dwell_min;
+	qsk_merged = handed->qsk_merged;
+
+	/* Rule outputs are only rewritten when the table entry changes */
+	rule_last = handed->rule_last;
+	rule_evals = handed->rule_evals;
+	rule_changes = handed->rule_changes;
+	return(PASS);
+}
+
+/* Hand everything to a fresh exec of ourselves. Only returns if that
+ * failed, and then the loop just carries on.
+ */
+static void monitor_upgrade(struct timespec * t0, int last_cor)
+{
+	mon_handover * h;
+	int fds[HANDOVER_MAX_FDS];
+	int nfds = 0;
+	int i;
+
+#ifdef PTT_EMBEDDED
+	h = &handing;
+	memset(h, 0x00, sizeof(mon_handover));
+#else
+	h = (mon_handover *)calloc(1, sizeof(mon_handover));
+	if (h == NULL)
+		return;
+#endif
+
+	h->magic = HANDOVER_MAGIC;
+	h->size = sizeof(mon_handover);
+	h->n_inputs = n_inputs;
+	h->n_outputs = n_outputs;
+	h->t0 = *t0;
+	h->last_ns = loop_ns;
+	h->last_cor = last_cor;
+	h->wheel_now = wheel.now;
+	for (i = 0; i < n_inputs; i++)
+	{
+		h->db[i] = inputs[i].db;
+		h->raw[i] = inputs[i].raw;
+	}
+	for (i = 0; i < n_outputs; i++)
+	{
+		h->timed_out[i] = outputs[i].timed_out;
+		h->want[i] = outputs[i].want;
+		h->on_expires[i] = tw_active(&outputs[i].on_timer) ? outputs[i].on_timer.expires : 0;
+		h->off_expires[i] = tw_active(&outputs[i].off_timer) ? outputs[i].off_timer.expires : 0;
+	}
+	h->pps = pps;
+	h->use_audio = use_audio;
+	h->audio = audio;
+	h->use_tone = use_tone;
+	h->tone = tone;
+	h->use_record = use_record;
+	if (use_record)
+	{
+		segment_detach(&rec);
+		h->rec = rec;
+	}
+	h->overruns = overruns;
+	h->timeouts = timeouts;
+	h->late_max = late_max;
+	h->late_sum = late_sum;
+	h->upgrades = upgrades + 1;
+	h->stall_max = stall_max;
+	h->use_winkey = use_winkey;
+	h->wk = wk;
+	h->cw = cw;
+	h->cw_edges = cw_edges;
+	h->cw_late_max = cw_late_max;
+	h->cw_late_sum = cw_late_sum;
+	h->cw_len_max = cw_len_max;
+	h->qsk_tr = qsk_tr;
+	h->qsk_tr_ns = qsk_tr_ns;
+	h->qsk_up_ns = qsk_up_ns;
+	h->qsk_marks = qsk_marks;
+	h->qsk_open = qsk_open;
+	h->qsk_lead_short = qsk_lead_short;
+	h->qsk_lead_min = qsk_lead_min;
+	h->qsk_opens = qsk_opens;
+	h->qsk_tail_short = qsk_tail_short;
+	h->qsk_tail_min = qsk_tail_min;
+	h->qsk_dwell_short = qsk_dwell_short;
+	h->qsk_dwell_min = qsk_dwell_min;
+	h->qsk_merged = qsk_merged;
+	h->use_sidetone = use_sidetone;
+	h->side = side;
+	h->use_shift = use_shift;
+	h->chain = chain;
+	h->rule_last = rule_last;
+	h->rule_evals = rule_evals;
+	h->rule_changes = rule_changes;
+
+	if (use_hist)
+		hist_flush(&hist);
+	if (use_audio)
+		fds[nfds++] = audio.fd;
+	if (use_record && rec.fd >= 0)
+		fds[nfds++] = rec.fd;
+	if (use_winkey)
+	{
+		fds[nfds++] = wk.fd;
+		fds[nfds++] = wk.slave;
+	}
+	if (use_sidetone && side.fd >= 0)
+		fds[nfds++] = side.fd;
+
+	/* Keep the standby off the lines while the new binary starts */
+	if (shared != NULL)
+		standby_renew(shared, lease_ms + UPGRADE_GRACE);
+
+	printf("Upgrading: re-exec '%s'\n", ptt_argv[0]);
+	handover_exec(ptt_argv, h, sizeof(mon_handover), fds, nfds);
+	printf("Upgrade failed: %s\n", strerror(errno));
+#ifndef PTT_EMBEDDED
+	free(h);
+#endif
+}
+
+/* 'resume' is -1 for a normal start, or the COR a standby took the lines
+ * over at, which leaves them as they are.
+ */
+int monitor_run(configuration * cfg, int verbose, int resume)
+{
+	struct timespec t0;
+	struct timespec next;
+	struct timespec now;
+	struct timespec t_done;
+	struct sigaction sa;
+	mon_input * in;
+	mon_output * o;
+	short pcm[PCM_CHUNK];
+	int period_us;
+	int level;
+	int stop;
+	int cor;
+	int n;
+	int last_cor = 0;
+	int was;
+	int edge;
+	int k;
+	int activity;
+	int settling = 0;
+	int cur;
+	unsigned long long due;
+	struct timespec wake;
+	struct timespec t_due;
+	struct timespec * deadline;
+	long long ev_edge_ns = 0;
+	long long wake_ns = 0;
+	long long cw_due = 0;
+	long long lat;
+	int band_changed = 0;
+	int fenced = 0;
+	int i;
+
+	period_us = cfg->period_us > 0 ? cfg->period_us : DEF_PERIOD_US;
+	tick_us = period_us;
+	tw_init(&wheel, 0);
+	handover_check(cfg);
+
+	if (monitor_setup(cfg, period_us, verbose) != PASS)
+		return(FAIL);
+
+	if (handed != NULL && handover_restore() != PASS)
+	{
+		printf("Upgrade state doesn't match the line table, starting afresh\n");
+		free(handed);
+		handed = NULL;
+	}
+
+#ifdef PTT_EMBEDDED
+	/* Everything is allocated now, fault it in and keep it there */
+	if (cfg->priority <= 0 && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+		printf("Can't lock memory: %s\n", strerror(errno));
+#endif
+	heap_start = budget_heap();
+	if (verbose)
+	{
+		monitor_budget(cfg, verbose);
+		printf("Resident %ld kB, locked %ld kB, heap %ld bytes\n",
+			budget_proc_kb("VmRSS"), budget_proc_kb("VmLck"), heap_start);
+	}
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sa_handler = on_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = on_report;
+	sigaction(SIGUSR1, &sa, NULL);
+	sa.sa_handler = on_upgrade;
+	sigaction(SIGUSR2, &sa, NULL);
+	sa.sa_handler = on_panic;
+	sigaction(PANIC_SIGNAL, &sa, NULL);
+	panic_pidfile(TRUE);
+
+	if (use_panic && verbose)
+		printf("Panic path: outb loop %.1f us dry run, an E-stop adds up to %d us of sampling\n",
+			panic_dry_run() / 1e3, period_us);
+
+	/* Fixed state outputs are set once, PTT and pulses start off. After
+	 * an upgrade or a takeover the lines are left as they are.
+	 */
+	if (handed != NULL)
+		last_cor = handed->last_cor;
+	else if (resume < 0)
+	{
+		drive_outputs(STATE_ON, 0);
+		drive_outputs(STATE_OFF, 0);
+		drive_outputs(STATE_PTT, 0);
+		drive_outputs(STATE_PULSE, 0);
+		if (use_bands)
+			drive_bands();
+		if (use_rules)
+			drive_rules();
+		flush_outputs();
+	}
+	else
+	{
+		last_cor = resume;
+		seed_inputs(resume);
+
+		/* The registers still hold what the primary last latched */
+		if (use_shift && shared != NULL && shared->sr_valid)
+		{
+			chain.image = shared->sr_image;
+			chain.shifted = shared->sr_image;
+			chain.valid = TRUE;
+		}
+	}
+
+	for (i = 0; i < n_outputs && handed == NULL; i++)
+	{
+		o = &outputs[i];
+		if (o->ld->state == STATE_PULSE && o->ld->pulse_ms > 0)
+			tw_add(&wheel, &o->on_timer, ms_to_ticks(o->ld->offset_ms));
+	}
+
+	/* What can wake the loop besides the sample period and timers */
+	n_wake_fds = 0;
+	sampling = FALSE;
+	for (i = 0; i < MAX_PORTS; i++)
+		if (ports[i].inputs)
+			sampling = TRUE;
+	for (i = 0; i < n_inputs; i++)
+		add_wake_fd(inputs[i].ev.fd);
+	band_wake = -1;
+	if (use_bands)
+		band_wake = add_wake_fd(bands.fd);
+	if (use_winkey)
+		add_wake_fd(wk.fd);
+	if (use_audio)
+		add_wake_fd(audio.fd);
+	cur_period_us = period_us;
+	idle_period_us = cfg->idle_period_us > period_us ? cfg->idle_period_us : period_us;
+
+	/* PPS edges are stamped mid-period, a longer period is a larger error */
+	if (use_pps)
+		idle_period_us = period_us;
+	idle_after_ms = cfg->idle_after_ms > 0 ? cfg->idle_after_ms : DEF_IDLE_AFTER;
+	quiet_since = 0;
+
+	if (verbose)
+	{
+		printf("Monitoring %d inputs, %d outputs every %d us\n",
+			n_inputs, n_outputs, period_us);
+		if (!sampling)
+			printf("No serial inputs, sleeping until an event or timer\n");
+		else if (idle_period_us > period_us)
+			printf("Slowing to %d us after %d ms quiet\n", idle_period_us, idle_after_ms);
+	}
+
+	/* No previous period yet, a PPS already high is not an edge */
+	loop_ns = -1;
+
+	running = 1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	next = t0;
+
+	/* Carry on the old binary's time base, so its timers still line up */
+	if (handed != NULL)
+	{
+		t0 = handed->t0;
+		loop_ns = handed->last_ns;
+	}
+
+	while (running)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		prev_ns = loop_ns;
+		loop_ns = elapsed_ns(&t0, &now);
+
+		/* Changes made this period were due when we meant to wake */
+		req_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+		if (wake_ns > 0 && wake_ns < req_ns)
+			req_ns = wake_ns;
+
+		if (handed != NULL)
+		{
+			stall_last = loop_ns - handed->last_ns;
+			if (stall_last > stall_max)
+				stall_max = stall_last;
+			free(handed);
+			handed = NULL;
+			if (verbose)
+				printf("Upgraded, sampling gap %.3f ms\n", stall_last / 1e6);
+		}
+
+		for (i = 0; i < MAX_PORTS; i++)
+			if (ports[i].inputs)
+			{
+				ports[i].msr = inb(ports[i].base + UART_MSR);
+				PTT_PROBE_IO(inb, i, ports[i].base + UART_MSR, ports[i].msr,
+					now.tv_sec * 1000000000LL + now.tv_nsec);
+			}
+
+		wakeups++;
+		cor = 0;
+		stop = 0;
+		activity = 0;
+		settling = 0;
+		for (i = 0; i < n_inputs; i++)
+		{
+			in = &inputs[i];
+			if (in->port != NULL)
+				level = ((in->port->msr & in->msr_mask) != 0) ^ in->ld->invert;
+			else
+			{
+				if (in->ev.fd >= 0 && evdev_read(&in->ev) < 0)
+				{
+					printf("%s '%s': input device gone\n", in->ld->section, in->ld->name);
+					evdev_close(in->ev.fd);
+					evdev_init(&in->ev, -1, in->ld->key);
+				}
+				level = in->ev.level ^ in->ld->invert;
+			}
+
+			/* An E-stop trips on the raw level, its filter only delays
+			 * the release.
+			 */
+			if (in->ld->state == STATE_ESTOP && level)
+				stop = 1;
+
+			/* PPS edges are timed unfiltered, a filter only adds delay */
+			if (in->ld->state == STATE_PPS && level && !in->raw && prev_ns >= 0)
+				pps_sample();
+			edge = (level != in->raw);
+			if (edge)
+				activity = 1;
+			in->raw = level;
+
+			was = in->db.out;
+			if (debounce_sample(&in->db, level))
+			{
+				if (in->ld->state == STATE_COR)
+					cor = 1;
+				else if (in->ld->state == STATE_ESTOP)
+					stop = 1;
+			}
+			if (in->port == NULL && in->db.out != was)
+				ev_edge_ns = in->ev.when_ns;
+			if (use_hist && in->db.out != was)
+				hist_add(&hist, HIST_INPUT, in->port != NULL ? in->port->base + UART_MSR : 0,
+					in->ld - cfg->lines, was, in->db.out);
+			if (edge || in->db.out != was)
+				PTT_PROBE6(input_edge, i, in->port != NULL ? in->port->index : -1,
+					in->port != NULL ? in->msr_mask : in->ld->key, level, in->db.out,
+					in->port != NULL ? now.tv_sec * 1000000000LL + now.tv_nsec : in->ev.when_ns);
+
+			/* A filter part way through a change needs sampling on time */
+			if (level != in->db.out)
+				settling = 1;
+		}
+
+		/* A signalled panic has written the MCRs, the rest follows here */
+		if (panicked && !panic_seen)
+		{
+			panic_seen = 1;
+			drive_outputs(STATE_PTT, 0);
+			drive_outputs(STATE_PULSE, 0);
+			drive_outputs(STATE_RULE, 0);
+		}
+
+		if (stop && !estop)
+		{
+			panic_fire(now.tv_sec * 1000000000LL + now.tv_nsec);
+			estop = 1;
+			printf("E-stop: keyed outputs released\n");
+		}
+		else if (!stop && estop)
+		{
+			estop = 0;
+			if (!panicked)
+			{
+				drive_outputs(STATE_PTT, last_cor);
+				rule_last = -1;
+			}
+			printf("E-stop released\n");
+		}
+
+		/* The audio is drained every sample so the stream never backs up */
+		if (use_audio)
+			while ((n = pcm_read(&audio, pcm, PCM_CHUNK)) > 0)
+			{
+				if (use_tone)
+					ctcss_feed(&tone, pcm, n);
+				if (use_record)
+					segment_feed(&rec, pcm, n);
+			}
+
+		if (use_tone && !tone.present)
+			cor = 0;
+
+		/* A band change is written in this period's flush */
+		if (use_bands && band_poll(&bands, now.tv_sec * 1000000000LL + now.tv_nsec))
+		{
+			drive_bands();
+			band_changed = 1;
+		}
+
+		/* A rigctld reconnect is a new socket, -1 until it is made */
+		if (band_wake >= 0 && bands.poll_ms > 0)
+			wake_fds[band_wake].fd = bands.fd;
+
+		/* Run the timers up to this period */
+		tw_advance(&wheel, loop_ns / (tick_us * 1000LL));
+
+		if (cor != last_cor)
+		{
+			ptt_timers(cor);
+			drive_outputs(STATE_PTT, cor);
+			if (use_record)
+				segment_edge(&rec, cor);
+			last_cor = cor;
+			if (verbose)
+				printf("COR %s\n", cor ? "ON" : "OFF");
+		}
+
+		/* The keyer runs on its own deadlines, the host may have sent more */
+		if (use_winkey)
+		{
+			winkey_poll(&wk, now.tv_sec * 1000000000LL + now.tv_nsec);
+			if (panicked || estop)
+			{
+				/* Nothing is sent while they hold, or kept for after */
+				keyer_tune(&cw, 0, 0);
+				keyer_clear(&cw);
+			}
+			cw_due = keyer_run(&cw, now.tv_sec * 1000000000LL + now.tv_nsec);
+			drive_keyer();
+			winkey_update(&wk);
+		}
+
+		/* Rules see this period's inputs and the outputs queued so far */
+		if (use_rules)
+			drive_rules();
+
+		flush_outputs();
+		if (use_mirrors)
+			drive_mirrors();
+
+		if (use_winkey)
+			keyer_written();
+		if (use_sidetone)
+			sidetone_fill(&side, mono_now_ns());
+
+		if (ev_edge_ns != 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &t_done);
+			lat = t_done.tv_sec * 1000000000LL + t_done.tv_nsec - ev_edge_ns;
+			if (lat > ev_lat_max)
+				ev_lat_max = lat;
+			ev_lat_sum += lat;
+			ev_lat_n++;
+			ev_edge_ns = 0;
+		}
+
+		if (band_changed)
+		{
+			band_changed = 0;
+			clock_gettime(CLOCK_MONOTONIC, &t_done);
+			if (elapsed_ns(&now, &t_done) > band_late_max)
+				band_late_max = elapsed_ns(&now, &t_done);
+			if (verbose)
+				printf("Band %s (%lld Hz)\n", band_name(&bands), bands.freq);
+		}
+
+		/* Only now, with this period's writes done */
+		if (slow.pending)
+			outlier_capture(&slow);
+		if (use_hist && hist_due(&hist, mono_now_ns()))
+			hist_flush(&hist);
+
+		if (status != NULL)
+			monitor_status(now.tv_sec * 1000000000LL + now.tv_nsec, last_cor);
+
+		if (shared != NULL)
+		{
+			shared->cor = last_cor;
+			if (standby_renew(shared, lease_ms) != 0)
+			{
+				fenced = 1;
+				break;
+			}
+		}
+
+		if (report)
+		{
+			report = 0;
+			monitor_report();
+		}
+
+		if (upgrade)
+		{
+			upgrade = 0;
+			monitor_upgrade(&t0, last_cor);
+		}
+
+		/* The next sample is due a period on, if anything needs sampling */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		deadline = NULL;
+		if (sampling || settling)
+		{
+			cur = (sampling && !settling) ?
+				adapt_period(period_us, activity || cor || estop) : period_us;
+			if (!sampling || elapsed_ns(&next, &now) >= 0)
+			{
+				if (!sampling)
+					next = now;
+				ts_add_ns(&next, cur * 1000LL);
+
+				/* If we fell more than a period behind, start again from now */
+				if (elapsed_ns(&next, &now) > cur * 1000L)
+				{
+					overruns++;
+					next = now;
+				}
+			}
+			wake = next;
+			deadline = &wake;
+		}
+
+		/* Or sooner if a timer is */
+		due = tw_next(&wheel);
+		if (due != 0)
+		{
+			t_due = t0;
+			ts_add_ns(&t_due, (long long)due * tick_us * 1000LL);
+			if (deadline == NULL || elapsed_ns(&t_due, deadline) > 0)
+			{
+				wake = t_due;
+				deadline = &wake;
+			}
+		}
+
+		/* Or when the rigctld is next to be asked, or reconnected to */
+		if (use_bands && band_due(&bands) != 0)
+		{
+			t_due.tv_sec = 0;
+			t_due.tv_nsec = 0;
+			ts_add_ns(&t_due, band_due(&bands));
+			if (deadline == NULL || elapsed_ns(&t_due, deadline) > 0)
+			{
+				wake = t_due;
+				deadline = &wake;
+			}
+		}
+
+		/* Or when the keyer's next edge is */
+		if (use_winkey && cw_due != 0)
+		{
+			t_due.tv_sec = cw_due / 1000000000LL;
+			t_due.tv_nsec = cw_due % 1000000000LL;
+			if (deadline == NULL || elapsed_ns(&t_due, deadline) > 0)
+			{
+				wake = t_due;
+				deadline = &wake;
+			}
+		}
+
+		/* Or when the history batch is due out */
+		if (use_hist && hist.n > 0)
+		{
+			t_due.tv_sec = hist_next(&hist) / 1000000000LL;
+			t_due.tv_nsec = hist_next(&hist) % 1000000000LL;
+			if (deadline == NULL || elapsed_ns(&t_due, deadline) > 0)
+			{
+				wake = t_due;
+				deadline = &wake;
+			}
+		}
+
+		/* Or when the sidetone stream wants topping up */
+		if (use_sidetone)
+		{
+			t_due.tv_sec = sidetone_next(&side) / 1000000000LL;
+			t_due.tv_nsec = sidetone_next(&side) % 1000000000LL;
+			if (deadline == NULL || elapsed_ns(&t_due, deadline) > 0)
+			{
+				wake = t_due;
+				deadline = &wake;
+			}
+		}
+
+		/* And never past half the standby lease from its last renewal */
+		if (shared != NULL)
+		{
+			t_due.tv_sec = 0;
+			t_due.tv_nsec = 0;
+			ts_add_ns(&t_due, shared->renewed_ns + lease_ms * 500000LL);
+			if (deadline == NULL || elapsed_ns(&t_due, deadline) > 0)
+			{
+				wake = t_due;
+				deadline = &wake;
+			}
+		}
+
+		wake_ns = deadline != NULL ? deadline->tv_sec * 1000000000LL + deadline->tv_nsec : 0;
+		monitor_sleep(deadline);
+	}
+
+	panic_pidfile(FALSE);
+
+	/* The standby has the lines now, keep our hands off them */
+	if (fenced)
+	{
+		printf("Lease taken over by pid %d, exiting\n", (int)shared->owner);
+		if (use_hist)
+			hist_close(&hist);
+		if (use_record)
+			segment_close(&rec);
+		if (use_audio)
+			pcm_close(&audio);
+		return(FAIL);
+	}
+
+	/* Never leave a transmitter keyed behind us */
+	drive_outputs(STATE_PTT, 0);
+	drive_outputs(STATE_PULSE, 0);
+	drive_outputs(STATE_RULE, 0);
+	drive_outputs(STATE_CW, 0);
+	drive_outputs(STATE_CWPTT, 0);
+	flush_outputs();
+	if (use_mirrors)
+		drive_mirrors();
+	for (i = 0; i < n_outputs; i++)
+		for (k = 0; k < outputs[i].n_mirrors; k++)
+			mirror_close(&outputs[i].mirrors[k]);
+	if (use_record)
+		segment_close(&rec);
+	if (shared != NULL)
+		standby_release(shared);
+	if (status != NULL)
+		status_remove(status, status_name);
+	monitor_report();
+
+	if (use_audio)
+		pcm_close(&audio);
+	if (use_bands)
+		band_close(&bands);
+	if (use_outliers)
+		outlier_close(&slow);
+	if (use_hist)
+		hist_close(&hist);
+	if (use_winkey)
+		winkey_close(&wk);
+	if (use_sidetone)
+		sidetone_close(&side);
+	for (i = 0; i < n_inputs; i++)
+		evdev_close(inputs[i].ev.fd);
+
+	return(PASS);
+}
@@ -0,0 +1,22 @@
+/* monitor.h - Input line monitor loop.
+
+*/
+
+#ifndef __MONITOR_H__
+#define __MONITOR_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+int monitor_run(configuration * cfg, int verbose, int resume);
+long monitor_budget(configuration * cfg, int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MONITOR_H__ */
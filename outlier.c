@@ -0,0 +1,175 @@
+/* outlier.c - Log of slow line transitions with scheduling context.
+ *
+ * Averages hide what breaks a transmission: the one PTT change in ten
+ * thousand that goes out 30 ms late. Monitor mode notes every MCR write
+ * here, with the time the change was due and the time the outb() was
+ * done, in a small ring. Noting is a few stores; nothing is read from
+ * the system on the normal path.
+ *
+ * When a transition takes longer than the threshold, the loop captures
+ * it once its writes for the period are done: the run queue figures
+ * from /proc/self/schedstat (time on the CPU, time waiting for one,
+ * timeslices), the voluntary and involuntary context switches and page
+ * faults from getrusage(), each with its change since the last capture,
+ * the CPU we are on, and the transitions that led up to it. All of it
+ * goes to the outlier log in one write().
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#include "outlier.h"
+
+/* Run time, run queue wait and timeslices, 0 if unavailable */
+static void read_schedstat(long long * run, long long * wait, long long * slices)
+{
+	char buf[128];
+	ssize_t n;
+	int fd;
+
+	*run = 0;
+	*wait = 0;
+	*slices = 0;
+	fd = open("/proc/self/schedstat", O_RDONLY);
+	if (fd < 0)
+		return;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+	sscanf(buf, "%lld %lld %lld", run, wait, slices);
+}
+
+int outlier_open(outlier_log * o, const char * file, int threshold_us, int depth)
+{
+	struct rusage ru;
+
+	memset(o, 0x00, sizeof(outlier_log));
+	o->threshold_ns = threshold_us * 1000LL;
+	o->depth = depth > 0 ? depth : DEF_OUTLIER_TRACE;
+	if (o->depth > OUTLIER_RING - 1)
+		o->depth = OUTLIER_RING - 1;
+
+	o->fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (o->fd < 0)
+		return(-1);
+
+	/* The first capture reports its changes from here */
+	read_schedstat(&o->run_ns, &o->wait_ns, &o->slices);
+	getrusage(RUSAGE_SELF, &ru);
+	o->nvcsw = ru.ru_nvcsw;
+	o->nivcsw = ru.ru_nivcsw;
+	o->minflt = ru.ru_minflt;
+	o->majflt = ru.ru_majflt;
+	return(0);
+}
+
+/* Note one MCR write. Flags an outlier for outlier_capture(), only the
+ * first one until it has been captured.
+ */
+void outlier_note(outlier_log * o, long long req_ns, long long out_ns, int port,
+	int mcr, unsigned char old_mcr, unsigned char new_mcr)
+{
+	outlier_entry * e = &o->trace[o->head % OUTLIER_RING];
+
+	e->req_ns = req_ns;
+	e->out_ns = out_ns;
+	e->port = port;
+	e->mcr = mcr;
+	e->old_mcr = old_mcr;
+	e->new_mcr = new_mcr;
+
+	if (out_ns - req_ns > o->worst_ns)
+		o->worst_ns = out_ns - req_ns;
+	if (out_ns - req_ns > o->threshold_ns && !o->pending)
+	{
+		o->pending = 1;
+		o->pending_at = o->head;
+	}
+	o->head++;
+}
+
+/* Write the flagged outlier and its context to the log */
+void outlier_capture(outlier_log * o)
+{
+	char buf[8192];
+	struct rusage ru;
+	struct timespec ts;
+	struct tm tm;
+	outlier_entry * x;
+	outlier_entry * e;
+	long long run;
+	long long wait;
+	long long slices;
+	unsigned long first;
+	unsigned long i;
+	int len;
+	int cpu;
+
+	if (!o->pending)
+		return;
+	o->pending = 0;
+	o->count++;
+
+	read_schedstat(&run, &wait, &slices);
+	getrusage(RUSAGE_SELF, &ru);
+	cpu = sched_getcpu();
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+
+	x = &o->trace[o->pending_at % OUTLIER_RING];
+	len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+	len += snprintf(buf + len, sizeof(buf) - len,
+		".%06ld port %d (0x%04X) 0x%02X -> 0x%02X: request to outb %.3f ms (threshold %.3f ms), CPU %d\n",
+		ts.tv_nsec / 1000, x->port, x->mcr, x->old_mcr, x->new_mcr,
+		(x->out_ns - x->req_ns) / 1e6, o->threshold_ns / 1e6, cpu);
+	len += snprintf(buf + len, sizeof(buf) - len,
+		"  schedstat: on CPU %lld ns (+%lld), run queue wait %lld ns (+%lld), timeslices %lld (+%lld)\n",
+		run, run - o->run_ns, wait, wait - o->wait_ns, slices, slices - o->slices);
+	len += snprintf(buf + len, sizeof(buf) - len,
+		"  context switches: voluntary %ld (+%ld), involuntary %ld (+%ld); page faults: minor %ld (+%ld), major %ld (+%ld)\n",
+		ru.ru_nvcsw, ru.ru_nvcsw - o->nvcsw, ru.ru_nivcsw, ru.ru_nivcsw - o->nivcsw,
+		ru.ru_minflt, ru.ru_minflt - o->minflt, ru.ru_majflt, ru.ru_majflt - o->majflt);
+
+	/* The transitions before it, times relative to its outb */
+	first = o->pending_at > (unsigned long)o->depth ? o->pending_at - o->depth : 0;
+	if (o->head - first > OUTLIER_RING)
+		first = o->head - OUTLIER_RING;
+	for (i = first; i < o->pending_at && len < (int)sizeof(buf) - 128; i++)
+	{
+		e = &o->trace[i % OUTLIER_RING];
+		len += snprintf(buf + len, sizeof(buf) - len,
+			"  %+12.3f ms port %d 0x%02X -> 0x%02X, request to outb %.1f us\n",
+			(e->out_ns - x->out_ns) / 1e6, e->port, e->old_mcr, e->new_mcr,
+			(e->out_ns - e->req_ns) / 1e3);
+	}
+	if (write(o->fd, buf, len) != len)
+		printf("Outlier log write failed\n");
+
+	o->run_ns = run;
+	o->wait_ns = wait;
+	o->slices = slices;
+	o->nvcsw = ru.ru_nvcsw;
+	o->nivcsw = ru.ru_nivcsw;
+	o->minflt = ru.ru_minflt;
+	o->majflt = ru.ru_majflt;
+}
+
+void outlier_close(outlier_log * o)
+{
+	if (o->fd >= 0)
+		close(o->fd);
+	o->fd = -1;
+}
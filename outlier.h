@@ -0,0 +1,56 @@
+/* outlier.h - Log of slow line transitions with scheduling context.
+
+*/
+
+#ifndef __OUTLIER_H__
+#define __OUTLIER_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OUTLIER_RING		64			// Transitions kept for context
+#define DEF_OUTLIER_TRACE	16			// Transitions logged before an outlier
+
+typedef struct
+{
+	long long req_ns;			// When the change was due (CLOCK_MONOTONIC)
+	long long out_ns;			// Just after the outb()
+	int port;					// Port number
+	int mcr;					// MCR IO address
+	unsigned char old_mcr;		// MCR before the write
+	unsigned char new_mcr;		// MCR read back after it
+} outlier_entry;
+
+typedef struct
+{
+	int fd;						// Outlier log, opened for append
+	long long threshold_ns;		// Request to outb time that is an outlier
+	int depth;					// Transitions logged before each outlier
+	outlier_entry trace[OUTLIER_RING];	// The last transitions
+	unsigned long head;			// Transitions noted so far
+	int pending;				// An outlier waits to be captured
+	unsigned long pending_at;	// Its transition number
+	long long run_ns;			// /proc/self/schedstat at the last capture
+	long long wait_ns;
+	long long slices;
+	long nvcsw;					// getrusage() at the last capture
+	long nivcsw;
+	long minflt;
+	long majflt;
+	unsigned long count;		// Outliers so far
+	long long worst_ns;			// Slowest transition seen
+} outlier_log;
+
+int outlier_open(outlier_log * o, const char * file, int threshold_us, int depth);
+void outlier_note(outlier_log * o, long long req_ns, long long out_ns, int port,
+	int mcr, unsigned char old_mcr, unsigned char new_mcr);
+void outlier_capture(outlier_log * o);
+void outlier_close(outlier_log * o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __OUTLIER_H__ */
@@ -0,0 +1,215 @@
+/* panic.c - Emergency unkey of every PTT and sequencing output.
+ *
+ * A panic releases every state=PTT and state=PULSE output on every
+ * configured port at once. Monitor mode keeps, for each port it drives,
+ * the MCR value it would have with those outputs released, updated on
+ * every write, so a panic is nothing but a loop of outb()s over a short
+ * table. Access to the ports is granted once with iopl() when monitor
+ * mode starts, so the loop makes no system calls and can run straight
+ * from a signal handler. The port locks are not taken, a panic does not
+ * wait for anyone.
+ *
+ * Triggers are SIGQUIT, an input line with state=ESTOP (checked first
+ * in every sample, unfiltered), or ptt --panic from any shell, which
+ * does the same writes itself from the config and signals a running
+ * monitor so it stays unkeyed.
+ *
+ * The time from the trigger to the last outb() is measured on every
+ * panic. For an E-stop the trigger is the sample that saw it, so add one
+ * sample period for the worst case from the switch itself.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/io.h>
+
+#include "ptt.h"
+#include "uart.h"
+#include "panic.h"
+
+panic_stats panic_time;
+
+static panic_pair pairs[MAX_PORTS];
+
+static long long now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return(t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+/* Grant access to every IO port up front, the panic loop can't stop to
+ * ask for it.
+ */
+int panic_arm(void)
+{
+	return(iopl(3));
+}
+
+/* Publish a port's safe MCR value. The signal handler may run between
+ * any two stores here, so the value goes in first and the address, which
+ * makes the pair live, is release-stored after it; the handler never
+ * sees an address without its value.
+ */
+void panic_set(int port, int mcr, unsigned char safe)
+{
+	__atomic_store_n(&pairs[port].safe, safe, __ATOMIC_RELAXED);
+	__atomic_store_n(&pairs[port].mcr, mcr, __ATOMIC_RELEASE);
+}
+
+/* Write every port's safe MCR. Async signal safe. */
+void panic_write(void)
+{
+	int mcr;
+	int i;
+
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		mcr = __atomic_load_n(&pairs[i].mcr, __ATOMIC_ACQUIRE);
+		if (mcr != 0)
+			outb(__atomic_load_n(&pairs[i].safe, __ATOMIC_RELAXED), mcr);
+	}
+}
+
+/* Panic, timing it from 'start_ns' (CLOCK_MONOTONIC), or from now if
+ * that is 0. Async signal safe.
+ */
+void panic_fire(long long start_ns)
+{
+	long long t0 = now_ns();
+	long long t1;
+
+	panic_write();
+
+	t1 = now_ns();
+	panic_time.triggers++;
+	panic_time.last_ns = t1 - (start_ns > 0 ? start_ns : t0);
+	if (panic_time.last_ns > panic_time.worst_ns)
+		panic_time.worst_ns = panic_time.last_ns;
+	if (t1 - t0 > panic_time.write_ns)
+		panic_time.write_ns = t1 - t0;
+}
+
+/* Time the loop writing back what each port has now, which changes
+ * nothing, to give the cost of a real panic before one is needed. This
+ * is a measurement, not a bound: nothing stops a real panic taking longer.
+ */
+long long panic_dry_run(void)
+{
+	long long t0 = now_ns();
+	int mcr;
+	int i;
+
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		mcr = __atomic_load_n(&pairs[i].mcr, __ATOMIC_ACQUIRE);
+		if (mcr != 0)
+			outb(inb(mcr), mcr);
+	}
+	return(now_ns() - t0);
+}
+
+/* Create (or remove) the pid file ptt --panic signals the monitor by */
+int panic_pidfile(int create)
+{
+	char path[256];
+	char pid[16];
+	int fd;
+
+	if (strlen(lockdir) == 0)
+		return(ERROR);
+	snprintf(path, sizeof(path), "%s/ptt-monitor.pid", lockdir);
+
+	if (!create)
+		return(unlink(path));
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return(ERROR);
+	snprintf(pid, sizeof(pid), "%d\n", (int)getpid());
+	if (write(fd, pid, strlen(pid)) < 0)
+		pid[0] = '\0';
+	close(fd);
+	return(PASS);
+}
+
+static void panic_signal_monitor(void)
+{
+	char path[256];
+	FILE * f;
+	int pid = 0;
+
+	snprintf(path, sizeof(path), "%s/ptt-monitor.pid", lockdir);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	if (fscanf(f, "%d", &pid) == 1 && pid > 0 && kill(pid, PANIC_SIGNAL) == 0)
+		printf("Signalled monitor pid %d\n", pid);
+	fclose(f);
+}
+
+/* ptt --panic: release the keyed outputs of every configured line from
+ * here, whether or not a monitor is running, and tell the monitor.
+ */
+int panic_run(configuration * cfg)
+{
+	unsigned char set[MAX_PORTS];
+	unsigned char clr[MAX_PORTS];
+	unsigned char bits;
+	line_def * ld;
+	long long t0;
+	int base;
+	int mcr;
+	int i;
+
+	t0 = now_ns();
+	memset(set, 0x00, sizeof(set));
+	memset(clr, 0x00, sizeof(clr));
+
+	for (i = 0; i < cfg->line_count; i++)
+	{
+		ld = &cfg->lines[i];
+		if (ld->dir == DIR_IN || !isKeyedState(ld->state))
+			continue;
+
+		bits = (ld->line == LINE_DTR ? DTR_MASK : 0) |
+			(ld->line == LINE_RTS ? RTS_MASK : 0) |
+			(ld->line == LINE_BOTH ? DTR_MASK | RTS_MASK : 0);
+		if (ld->invert)
+			set[ld->port] |= bits;
+		else
+			clr[ld->port] |= bits;
+	}
+
+	if (panic_arm() != 0)
+	{
+		printf("ptt: iopl() failed: %s\n", strerror(errno));
+		return(FAIL);
+	}
+
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		if ((set[i] | clr[i]) == 0)
+			continue;
+		base = getPortAddress(i);
+		mcr = (base + MCR_ADDR_OFFSET) & IO_MASK;
+		panic_set(i, mcr, ((inb(mcr) | set[i]) & ~clr[i]) &
+			uart_mcr_mask(uart_cache_load(lockdir, base)));
+	}
+	panic_fire(t0);
+
+	printf("Panic: keyed outputs released in %.1f us\n", panic_time.last_ns / 1e3);
+	panic_signal_monitor();
+	return(PASS);
+}
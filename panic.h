@@ -0,0 +1,45 @@
+/* panic.h - Emergency unkey of every PTT and sequencing output.
+
+*/
+
+#ifndef __PANIC_H__
+#define __PANIC_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+#define PANIC_SIGNAL	SIGQUIT			// Signal that triggers a panic
+
+typedef struct
+{
+	int mcr;					// MCR IO address, 0 if unused
+	unsigned char safe;			// MCR value with the keyed outputs released
+} panic_pair;
+
+typedef struct
+{
+	unsigned long triggers;		// Panics so far
+	long long last_ns;			// Trigger to last outb, last panic
+	long long worst_ns;			// Trigger to last outb, worst panic
+	long long write_ns;			// Worst time for the outb loop alone
+} panic_stats;
+
+extern panic_stats panic_time;
+
+int panic_arm(void);
+void panic_set(int port, int mcr, unsigned char safe);
+void panic_write(void);
+void panic_fire(long long start_ns);
+long long panic_dry_run(void);
+int panic_pidfile(int create);
+int panic_run(configuration * cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PANIC_H__ */
@@ -0,0 +1,82 @@
+/* pcm.c - Non-blocking reader for a raw PCM audio stream.
+ *
+ * Receiver audio reaches ptt as raw signed 16 bit little endian mono
+ * PCM from a file, a FIFO, or stdin ('-'). The stream is opened non
+ * blocking so the monitor loop can drain whatever is waiting on every
+ * sample without ever stalling on it. A read may end half way through
+ * a sample, the odd byte is kept for the next read.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "pcm.h"
+
+int pcm_open(pcm_in * p, const char * path)
+{
+	struct stat sb;
+
+	memset(p, 0x00, sizeof(pcm_in));
+
+	if (strcmp(path, "-") == 0)
+		p->fd = dup(0);
+	else if (stat(path, &sb) == 0 && S_ISFIFO(sb.st_mode))
+		/* Read-write, so it never hangs up when a writer closes it */
+		p->fd = open(path, O_RDWR | O_NONBLOCK);
+	else
+		p->fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (p->fd < 0)
+		return(-1);
+	fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_NONBLOCK);
+	return(0);
+}
+
+/* Read up to 'max' samples (max <= PCM_CHUNK) that are already waiting.
+ * Returns the number of samples read, 0 if there were none.
+ */
+int pcm_read(pcm_in * p, short * pcm, int max)
+{
+	unsigned char buf[PCM_CHUNK * 2];
+	int len;
+	int off = 0;
+	int n;
+	int i;
+
+	if (max > PCM_CHUNK)
+		max = PCM_CHUNK;
+
+	len = read(p->fd, buf + p->have_odd, max * 2 - p->have_odd);
+	if (len <= 0)
+		return(0);
+
+	if (p->have_odd)
+	{
+		buf[0] = p->odd;
+		len++;
+	}
+
+	n = len / 2;
+	for (i = 0; i < n; i++, off += 2)
+		pcm[i] = (short)(buf[off] | (buf[off + 1] << 8));
+
+	p->have_odd = len & 1;
+	if (p->have_odd)
+		p->odd = buf[len - 1];
+
+	p->samples += n;
+	return(n);
+}
+
+void pcm_close(pcm_in * p)
+{
+	if (p->fd >= 0)
+		close(p->fd);
+	p->fd = -1;
+}
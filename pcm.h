@@ -0,0 +1,32 @@
+/* pcm.h - Non-blocking reader for a raw PCM audio stream.
+
+*/
+
+#ifndef __PCM_H__
+#define __PCM_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEF_AUDIO_RATE		8000	// Audio sample rate (Hz)
+#define PCM_CHUNK			2048	// Samples read per call, maximum
+
+typedef struct
+{
+	int fd;						// PCM input, S16_LE mono, non-blocking
+	int have_odd;				// A byte of a split sample is pending
+	unsigned char odd;			// The pending byte
+	unsigned long samples;		// Samples read so far
+} pcm_in;
+
+int pcm_open(pcm_in * p, const char * path);
+int pcm_read(pcm_in * p, short * pcm, int max);
+void pcm_close(pcm_in * p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PCM_H__ */
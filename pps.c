@@ -0,0 +1,105 @@
+/* pps.c - PPS disciplined clock from a DCD (or other MSR) input.
+ *
+ * GPS receivers put out a pulse at the top of every second, commonly
+ * wired to DCD. In monitor mode an input line with state=PPS has its
+ * rising edges timestamped by the sample loop and fed to a small type 2
+ * PLL here. The loop tracks both where the second boundaries fall on
+ * the monotonic clock (phase) and how long a PPS second is in monotonic
+ * ns (frequency), so keying scheduled against it stays on GPS time even
+ * when the host clock is loose. The host clock is only used to number
+ * the seconds, so it needs to be right to within half a second.
+ *
+ * An edge is timestamped at the middle of the sample period it was seen
+ * in, so the raw timestamp error is up to half a period. The PLL
+ * averages that down; the phase error of every edge against the loop's
+ * prediction is kept for the monitor report.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "pps.h"
+
+void pps_init(pps_clock * p)
+{
+	memset(p, 0x00, sizeof(pps_clock));
+	p->period_ns = 1e9;
+}
+
+/* A rising PPS edge was seen at 'mono_ns', during UTC second 'utc_sec'
+ * by the host clock.
+ */
+void pps_edge(pps_clock * p, long long mono_ns, long long utc_sec)
+{
+	double seconds;
+	double predicted;
+	double err;
+	long long n;
+
+	p->edges++;
+
+	if (!p->acquired)
+	{
+		p->acquired = 1;
+		p->edge_ns = (double)mono_ns;
+		p->utc_sec = utc_sec;
+		return;
+	}
+
+	seconds = ((double)mono_ns - p->edge_ns) / p->period_ns;
+	n = llround(seconds);
+	predicted = p->edge_ns + n * p->period_ns;
+	err = (double)mono_ns - predicted;
+
+	if (n < 1 || fabs(err) > PPS_MAX_ERR)
+	{
+		p->rejected++;
+		p->good = 0;
+		if (++p->bad >= PPS_REACQUIRE)
+		{
+			p->acquired = 0;
+			p->locked = 0;
+			p->bad = 0;
+			p->period_ns = 1e9;
+		}
+		return;
+	}
+
+	p->bad = 0;
+	p->err_ns = err;
+
+	/* Type 2 loop: the frequency integrates the error, the phase takes
+	 * a share of it directly.
+	 */
+	p->period_ns += PPS_KI * err / n;
+	p->edge_ns = predicted + PPS_KP * err;
+	p->utc_sec += n;
+
+	if (p->locked)
+	{
+		p->err_sq += err * err;
+		p->err_n++;
+		if (fabs(err) > p->err_max)
+			p->err_max = fabs(err);
+	}
+	else if (++p->good >= PPS_LOCK_EDGES)
+		p->locked = 1;
+}
+
+/* The UTC time, in ms since the epoch, at monotonic time 'mono_ns'.
+ * Kept in integer ms so the epoch does not eat the double's precision.
+ */
+long long pps_utc_ms(const pps_clock * p, long long mono_ns)
+{
+	return(p->utc_sec * 1000 + (long long)floor(((double)mono_ns - p->edge_ns) * 1e3 / p->period_ns));
+}
+
+/* The monotonic time of UTC time 'utc_ms' */
+double pps_mono_ns(const pps_clock * p, long long utc_ms)
+{
+	return(p->edge_ns + (double)(utc_ms - p->utc_sec * 1000) * p->period_ns / 1e3);
+}
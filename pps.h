@@ -0,0 +1,45 @@
+/* pps.h - PPS disciplined clock from a DCD (or other MSR) input.
+
+*/
+
+#ifndef __PPS_H__
+#define __PPS_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PPS_KP			0.3			// Phase gain
+#define PPS_KI			0.05		// Frequency gain
+#define PPS_MAX_ERR		50000000.0	// Edge further off than this (ns) is rejected
+#define PPS_LOCK_EDGES	4			// Good edges in a row before locked
+#define PPS_REACQUIRE	3			// Rejected edges in a row before restarting
+
+typedef struct
+{
+	int acquired;				// Have a first edge to work from
+	int locked;					// Enough good edges to schedule from
+	int good;					// Good edges in a row
+	int bad;					// Rejected edges in a row
+	double edge_ns;				// Disciplined monotonic time of the last second
+	double period_ns;			// Monotonic ns per PPS second
+	long long utc_sec;			// UTC second of the last edge
+	double err_ns;				// Phase error of the last edge
+	double err_sq;				// Sum of squared errors while locked
+	double err_max;				// Largest error while locked
+	unsigned long err_n;		// Errors summed while locked
+	unsigned long edges;		// Edges seen
+	unsigned long rejected;		// Edges rejected as glitches
+} pps_clock;
+
+void pps_init(pps_clock * p);
+void pps_edge(pps_clock * p, long long mono_ns, long long utc_sec);
+long long pps_utc_ms(const pps_clock * p, long long mono_ns);
+double pps_mono_ns(const pps_clock * p, long long utc_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PPS_H__ */
@@ -0,0 +1,155 @@
+/* probes.h - USDT static tracepoints for perf, bpftrace and SystemTap.
+
+*/
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#include <time.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Each probe is a single nop in the code plus a SystemTap SDT note in the
+ * ELF file, so it costs nothing until a tracer attaches to it, e.g.
+ *
+ *   bpftrace -e 'usdt:./ptt:ptt:outb { printf("%x %x\n", arg1, arg2); }'
+ *   perf probe -x ./ptt sdt_ptt:outb
+ *
+ * The notes are written here rather than by <sys/sdt.h>, so every x86 build
+ * has them without systemtap-sdt-dev installed. -DPTT_NO_USDT leaves them
+ * out. Provider 'ptt', times are CLOCK_MONOTONIC ns:
+ *
+ *   config_start   file
+ *   config_end     file, result (PASS/ERROR), [LINEn] sections
+ *   backend_open   port, MCR address, MCR bits the UART implements
+ *   inb            port, address, value, time of the read, time it was due
+ *   outb           port, address, value, time of the write, time it was due
+ *   enqueue        port, MCR bits, on, time the change was due
+ *   dequeue        port, bits to set, bits to clear, time the change was due
+ *   timer_fire     owner argument, tick it was due, tick it ran on
+ *   input_edge     line index, port (-1 for an input device), MSR mask or
+ *                  key code, raw level, filtered level, time
+ *
+ * Every probe has a semaphore the tracer counts up while it is attached.
+ * inb and outb only read the clock for their access time when it is set
+ * (perf needs Linux 4.20 or later for that; older kernels never fire them).
+ */
+
+#if !defined(PTT_NO_USDT)
+#if defined(__x86_64__)
+#define PTT_USDT
+#define PTT_SDT_ADDR	".8byte"
+#define PTT_SDT_ARG		"-8@"
+#elif defined(__i386__)
+#define PTT_USDT
+#define PTT_SDT_ADDR	".4byte"
+#define PTT_SDT_ARG		"-4@"
+#else
+#warning "USDT probes are only written for x86, building ptt without them"
+#endif
+#endif
+
+#ifdef PTT_USDT
+
+/* One per probe, shared by every object that includes this file */
+#define PTT_SEMAPHORE(name) \
+	unsigned short ptt_##name##_semaphore __attribute__((weak, section(".probes")))
+
+PTT_SEMAPHORE(config_start);
+PTT_SEMAPHORE(config_end);
+PTT_SEMAPHORE(backend_open);
+PTT_SEMAPHORE(inb);
+PTT_SEMAPHORE(outb);
+PTT_SEMAPHORE(enqueue);
+PTT_SEMAPHORE(dequeue);
+PTT_SEMAPHORE(timer_fire);
+PTT_SEMAPHORE(input_edge);
+
+#define PTT_PROBE_ENABLED(name) \
+	__builtin_expect(*(volatile unsigned short *)&ptt_##name##_semaphore != 0, 0)
+
+/* The note layout of <sys/sdt.h> version 3: probe address, the address of
+ * .stapsdt.base (to undo prelinking), semaphore, provider, name, arguments
+ */
+#define PTT_SDT_NOTE(name, args) \
+	"990:	nop\n" \
+	"	.pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	"	.balign 4\n" \
+	"	.4byte 992f-991f, 994f-993f, 3\n" \
+	"991:	.asciz \"stapsdt\"\n" \
+	"992:	.balign 4\n" \
+	"993:	" PTT_SDT_ADDR " 990b\n" \
+	"	" PTT_SDT_ADDR " _.stapsdt.base\n" \
+	"	" PTT_SDT_ADDR " ptt_" #name "_semaphore\n" \
+	"	.asciz \"ptt\"\n" \
+	"	.asciz \"" #name "\"\n" \
+	"	.asciz \"" args "\"\n" \
+	"994:	.balign 4\n" \
+	"	.popsection\n" \
+	"	.ifndef _.stapsdt.base\n" \
+	"	.pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	"	.weak _.stapsdt.base\n" \
+	"	.hidden _.stapsdt.base\n" \
+	"_.stapsdt.base:	.space 1\n" \
+	"	.size _.stapsdt.base, 1\n" \
+	"	.popsection\n" \
+	"	.endif\n"
+
+#define PTT_SDT_ARGS1	PTT_SDT_ARG "%[a1]"
+#define PTT_SDT_ARGS3	PTT_SDT_ARGS1 " " PTT_SDT_ARG "%[a2] " PTT_SDT_ARG "%[a3]"
+#define PTT_SDT_ARGS4	PTT_SDT_ARGS3 " " PTT_SDT_ARG "%[a4]"
+#define PTT_SDT_ARGS5	PTT_SDT_ARGS4 " " PTT_SDT_ARG "%[a5]"
+#define PTT_SDT_ARGS6	PTT_SDT_ARGS5 " " PTT_SDT_ARG "%[a6]"
+
+#define PTT_PROBE1(name, a) \
+	__asm__ __volatile__ (PTT_SDT_NOTE(name, PTT_SDT_ARGS1) \
+		: : [a1] "nor" ((long)(a)))
+#define PTT_PROBE3(name, a, b, c) \
+	__asm__ __volatile__ (PTT_SDT_NOTE(name, PTT_SDT_ARGS3) \
+		: : [a1] "nor" ((long)(a)), [a2] "nor" ((long)(b)), \
+		[a3] "nor" ((long)(c)))
+#define PTT_PROBE4(name, a, b, c, d) \
+	__asm__ __volatile__ (PTT_SDT_NOTE(name, PTT_SDT_ARGS4) \
+		: : [a1] "nor" ((long)(a)), [a2] "nor" ((long)(b)), \
+		[a3] "nor" ((long)(c)), [a4] "nor" ((long)(d)))
+#define PTT_PROBE5(name, a, b, c, d, e) \
+	__asm__ __volatile__ (PTT_SDT_NOTE(name, PTT_SDT_ARGS5) \
+		: : [a1] "nor" ((long)(a)), [a2] "nor" ((long)(b)), \
+		[a3] "nor" ((long)(c)), [a4] "nor" ((long)(d)), \
+		[a5] "nor" ((long)(e)))
+#define PTT_PROBE6(name, a, b, c, d, e, f) \
+	__asm__ __volatile__ (PTT_SDT_NOTE(name, PTT_SDT_ARGS6) \
+		: : [a1] "nor" ((long)(a)), [a2] "nor" ((long)(b)), \
+		[a3] "nor" ((long)(c)), [a4] "nor" ((long)(d)), \
+		[a5] "nor" ((long)(e)), [a6] "nor" ((long)(f)))
+
+/* An inb or outb just done, stamped with the time it happened */
+#define PTT_PROBE_IO(name, port, address, value, due) \
+	do { \
+		struct timespec probe_t; \
+		if (PTT_PROBE_ENABLED(name)) \
+		{ \
+			clock_gettime(CLOCK_MONOTONIC, &probe_t); \
+			PTT_PROBE5(name, port, address, value, \
+				probe_t.tv_sec * 1000000000LL + probe_t.tv_nsec, due); \
+		} \
+	} while (0)
+
+#else
+#define PTT_PROBE_ENABLED(name)				0
+#define PTT_PROBE1(name, a)					do { } while (0)
+#define PTT_PROBE3(name, a, b, c)			do { } while (0)
+#define PTT_PROBE4(name, a, b, c, d)		do { } while (0)
+#define PTT_PROBE5(name, a, b, c, d, e)		do { } while (0)
+#define PTT_PROBE6(name, a, b, c, d, e, f)	do { } while (0)
+#define PTT_PROBE_IO(name, port, address, value, due)	do { } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PROBES_H__ */
@@ -44,8 +44,23 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <sys/ioctl.h>
+#include <sys/file.h>
 #include <getopt.h>
 #include "ini.h"
+#include "histlog.h"
+#include "uart.h"
+#include "debounce.h"
+#include "monitor.h"
+#include "standby.h"
+#include "status.h"
+#include "panic.h"
+#include "band.h"
+#include "rules.h"
+#include "sidetone.h"
+#include "mirror.h"
+#include "timer.h"
+#include "budget.h"
+#include "probes.h"
 
 #include "ptt.h"
 
@@ -53,13 +68,31 @@ static int verbose;			// Verbose Reporting {0|1} {OFF|ON}
 static int quiet;			// Silent Output {0|1} {OFF|ON}
 static int debug;			// Debug reporting {0|1} {OFF|ON}
 static int level;			// Debug level {0|5}
+static int probe;			// Probe UART type and exit {0|1}
+static int monitor;			// Run the input monitor loop {0|1}
+static int standby;			// Stand by for a monitor to take over {0|1}
+static int panic;			// Release every keyed output now {0|1}
+static int status;			// Show the state of every port and line {0|1}
+static int fast;			// Show it from the monitor's published copy {0|1}
+static int config_status;	// What load_config() returned {PASS|ERROR}
 int port_number;            // The specified serial port number 0-3
 unsigned char ctrl_line;	// The specified line to ctrl (DTR or RTS)
 int numlines;				// Number of lines to control
 char * devicename;			// serial device name
 char * linename;			// serial line name
 char * cfgfile;				// Config file name
+char * logfile;				// Transition history file name
+char * history;				// History query window 't1,t2'
+char * export;				// Trace export window 't1,t2'
+char * tracefile;			// Trace export file, '-' for stdout
+char * lockdir;				// Per-port lock file directory
+int bench_timers;			// Timer wheel benchmark size, 0 for none
+long bench_rules;			// Rule table benchmark samples, 0 for none
+int bench_sidetone;			// Sidetone benchmark seconds, 0 for none
+long bench_lock;			// Port lock benchmark iterations, 0 for none
+char ** ptt_argv;			// Our command line, to re-exec on upgrade
 unsigned char value;		// The specified state ON or OFF
+int uart_type;				// Probed UART type, UART_UNKNOWN if never probed
 
 configuration config;
 
@@ -75,9 +108,14 @@ int load_defaults(void)
 	numlines = ERROR;
 	value = DEF_VALUE;
 
-    devicename = strdup(DEF_DEVICENAME);
-    linename = strdup(DEF_LINENAME);
-    cfgfile = strdup(DEF_CFGFILE);
+    devicename = cfg_strdup(DEF_DEVICENAME);
+    linename = cfg_strdup(DEF_LINENAME);
+    cfgfile = cfg_strdup(DEF_CFGFILE);
+    logfile = cfg_strdup(DEF_LOGFILE);
+    history = NULL;
+    export = NULL;
+    tracefile = cfg_strdup(DEF_TRACEFILE);
+    lockdir = cfg_strdup(DEF_LOCKDIR);
     port_number = DEF_PORTNUM;
 
 
@@ -99,11 +137,14 @@ int load_defaults(void)
 		printf("  devicename: '%s'\n", devicename);
 		printf("  linename: '%s'\n", linename);
 		printf("  cfgfile: '%s'\n", cfgfile);
+		printf("  logfile: '%s'\n", logfile);
 		printf("  port_number: %d\n", port_number);
 	}
 
 }
 
+static int handler(void* user, const char* section, const char* name, const char* value);
+
 /* This function will match section and name to sets specified below to parse
  * an ini file line into it's value. This value is stored in the configuration*
  * structure. From the 'ini' file lib.
@@ -112,7 +153,7 @@ static int handler(void* user, const char* section, const char* name, const char
 {
     configuration* pconfig = (configuration*)user;
 
-    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+    #define MATCH(s, n) (strcmp(section, s) == 0 && strcmp(name, n) == 0)
     if (MATCH("DEBUG", "Debug")) {
         pconfig->debug = atoi(value);
     } else if (MATCH("DEBUG", "Verbose")) {
@@ -122,21 +163,259 @@ static int handler(void* user, const char* section, const char* name, const char
     } else if (MATCH("DEBUG", "Level")) {
         pconfig->level = atoi(value);
     } else if (MATCH("DEVICES", "DeviceName")) {
-        pconfig->devicename = strdup(value);
+        pconfig->devicename = cfg_strdup(value);
+        if (pconfig->devicename == NULL)
+            return 0;  /* no room, error */
     } else if (MATCH("DEVICES", "LineName")) {
-        pconfig->linename = strdup(value);
+        pconfig->linename = cfg_strdup(value);
+        if (pconfig->linename == NULL)
+            return 0;  /* no room, error */
     } else if (MATCH("DEVICES", "ControlLine")) {
         pconfig->ctrl_line = atoi(value);
     } else if (MATCH("DEVICES", "PortNumber")) {
         pconfig->port_number = atoi(value);
+    } else if (MATCH("LOG", "LogFile")) {
+        pconfig->logfile = cfg_strdup(value);
+        if (pconfig->logfile == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("DEVICES", "LockDir")) {
+        pconfig->lockdir = cfg_strdup(value);
+        if (pconfig->lockdir == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("MONITOR", "Period")) {
+        pconfig->period_us = atoi(value);
+    } else if (MATCH("MONITOR", "Priority")) {
+        pconfig->priority = atoi(value);
+    } else if (MATCH("MONITOR", "IdlePeriod")) {
+        pconfig->idle_period_us = atoi(value);
+    } else if (MATCH("MONITOR", "IdleAfter")) {
+        pconfig->idle_after_ms = atoi(value);
+    } else if (MATCH("MONITOR", "MemBudget")) {
+        pconfig->mem_budget = atol(value);
+    } else if (MATCH("MONITOR", "OutlierUs")) {
+        pconfig->outlier_us = atoi(value);
+    } else if (MATCH("MONITOR", "OutlierLog")) {
+        pconfig->outlier_log = cfg_strdup(value);
+        if (pconfig->outlier_log == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("MONITOR", "OutlierTrace")) {
+        pconfig->outlier_trace = atoi(value);
+    } else if (MATCH("MONITOR", "Status")) {
+        pconfig->status_name = cfg_strdup(value);
+        if (pconfig->status_name == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("CTCSS", "Audio") || MATCH("RECORD", "Audio")) {
+        pconfig->audio = cfg_strdup(value);
+        if (pconfig->audio == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("CTCSS", "Rate") || MATCH("RECORD", "Rate")) {
+        pconfig->audio_rate = atoi(value);
+    } else if (MATCH("CTCSS", "Tone")) {
+        pconfig->ctcss_tone = atof(value);
+    } else if (MATCH("CTCSS", "Threshold")) {
+        pconfig->ctcss_threshold = atof(value);
+    } else if (MATCH("CTCSS", "Block")) {
+        pconfig->ctcss_block = atoi(value);
+    } else if (MATCH("RECORD", "Dir")) {
+        pconfig->record_dir = cfg_strdup(value);
+        if (pconfig->record_dir == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("RECORD", "PreRoll")) {
+        pconfig->record_preroll = atoi(value);
+    } else if (MATCH("STANDBY", "Name")) {
+        pconfig->standby_name = cfg_strdup(value);
+        if (pconfig->standby_name == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("STANDBY", "Lease")) {
+        pconfig->standby_lease = atoi(value);
+    } else if (MATCH("STANDBY", "Failover")) {
+        pconfig->standby_policy = getFailoverMode(value);
+        if (pconfig->standby_policy == ERROR)
+            return 0;  /* bad value, error */
+    } else if (MATCH("BANDS", "Source")) {
+        pconfig->band_source = cfg_strdup(value);
+        if (pconfig->band_source == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("BANDS", "Poll")) {
+        pconfig->band_poll = atoi(value);
+    } else if (MATCH("BANDS", "Default")) {
+        pconfig->band_default = strtoul(value, NULL, 0);
+    } else if (strcmp(section, "BANDS") == 0) {
+        /* <name>=<low Hz>-<high Hz>,<pattern> */
+        if (pconfig->band_count >= MAX_BANDS)
+            return 0;  /* too many bands, error */
+        if (band_parse(&pconfig->bands[pconfig->band_count], name, value) != PASS)
+            return 0;  /* bad value, error */
+        pconfig->band_count++;
+    } else if (strcmp(section, "RULES") == 0) {
+        /* <output section>=<expression over line sections> */
+        if (pconfig->rule_count >= MAX_RULES)
+            return 0;  /* too many rules, error */
+        if (rule_parse(&pconfig->rules[pconfig->rule_count], name, value) != PASS)
+            return 0;  /* too long, error */
+        pconfig->rule_count++;
+    } else if (MATCH("WINKEY", "Pty")) {
+        pconfig->winkey_pty = cfg_strdup(value);
+        if (pconfig->winkey_pty == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("WINKEY", "Speed")) {
+        pconfig->winkey_wpm = atoi(value);
+    } else if (MATCH("WINKEY", "Sidetone")) {
+        pconfig->sidetone = cfg_strdup(value);
+        if (pconfig->sidetone == NULL)
+            return 0;  /* no room, error */
+    } else if (MATCH("WINKEY", "SidetoneHz")) {
+        pconfig->sidetone_hz = atoi(value);
+    } else if (MATCH("WINKEY", "SidetoneRate")) {
+        pconfig->sidetone_rate = atoi(value);
+    } else if (MATCH("WINKEY", "SidetoneRise")) {
+        pconfig->sidetone_rise = atoi(value);
+    } else if (MATCH("WINKEY", "QSK")) {
+        pconfig->qsk = atoi(value) != 0;
+    } else if (MATCH("WINKEY", "QskLead")) {
+        pconfig->qsk_lead = atoi(value);
+    } else if (MATCH("WINKEY", "QskTail")) {
+        pconfig->qsk_tail = atoi(value);
+    } else if (MATCH("WINKEY", "QskHang")) {
+        pconfig->qsk_hang = atoi(value);
+    } else if (MATCH("WINKEY", "QskDwell")) {
+        pconfig->qsk_dwell = atoi(value);
+    } else if (MATCH("SHIFTREG", "Port")) {
+        pconfig->sr_port = atoi(value);
+        if (pconfig->sr_port < 0 || pconfig->sr_port >= MAX_PORTS)
+            return 0;  /* bad value, error */
+    } else if (MATCH("SHIFTREG", "Bits")) {
+        pconfig->sr_bits = atoi(value);
+        if (pconfig->sr_bits < 1 || pconfig->sr_bits > 64)
+            return 0;  /* bad value, error */
+    } else if (MATCH("SHIFTREG", "Latch")) {
+        /* OUT1 of the same port, or <port>:<DTR|RTS> */
+        if (strcmp(value, "OUT1") == 0)
+            pconfig->sr_latch_line = LINE_NONE;
+        else if (sscanf(value, "%d:", &pconfig->sr_latch_port) != 1 ||
+                strchr(value, ':') == NULL ||
+                pconfig->sr_latch_port < 0 || pconfig->sr_latch_port >= MAX_PORTS ||
+                ((pconfig->sr_latch_line = getLineId(strchr(value, ':') + 1)) != LINE_DTR &&
+                pconfig->sr_latch_line != LINE_RTS))
+            return 0;  /* bad value, error */
     } else if (MATCH("LINES", "Lines")) {
         pconfig->numlines = atoi(value);
+    } else if (strcmp(section, "LINES") == 0 && strncmp(name, "line", 4) == 0) {
+        /* lineN=<section> labels, the sections themselves define the lines */
+    } else if (is_line_section(section)) {
+        return line_handler(pconfig, section, name, value);
     } else {
         return 0;  /* unknown section/name, error */
     }
     return 1;
 }
 
+/* Any section that isn't one of the fixed ones is a line definition */
+int is_line_section(const char * section)
+{
+	const char * fixed[] = { "", "DEBUG", "DEVICES", "LINES", "LOG", "MONITOR", "CTCSS", "RECORD", "STANDBY", "BANDS", "RULES", "WINKEY", "SHIFTREG", NULL };
+	int i;
+
+	for (i = 0; fixed[i] != NULL; i++)
+		if (strcmp(section, fixed[i]) == 0)
+			return(FALSE);
+	return(TRUE);
+}
+
+/* This function stores one name=value pair of a line definition section
+ * ([LINE1], [BOOGA], ...) in the line table, creating the table entry the
+ * first time the section is seen.
+ */
+int line_handler(configuration * pconfig, const char * section, const char * name, const char * value)
+{
+	line_def * ld = NULL;
+	int i;
+
+	for (i = 0; i < pconfig->line_count; i++)
+		if (strcmp(pconfig->lines[i].section, section) == 0)
+			ld = &pconfig->lines[i];
+
+	if (ld == NULL)
+	{
+		if (pconfig->line_count >= MAX_LINES)
+			return 0;	/* too many lines, error */
+		ld = &pconfig->lines[pconfig->line_count++];
+		memset(ld, 0x00, sizeof(line_def));
+		strncpy(ld->section, section, sizeof(ld->section) - 1);
+		ld->line = LINE_NONE;
+		ld->dir = DIR_OUT;
+		ld->state = STATE_IGNORE;
+		ld->filter = FILTER_COUNTER;
+	}
+
+	if (strcmp(name, "name") == 0) {
+		strncpy(ld->name, value, sizeof(ld->name) - 1);
+	} else if (strcmp(name, "port") == 0) {
+		ld->port = atoi(value);
+	} else if (strcmp(name, "line") == 0) {
+		ld->line = getLineId(value);
+	} else if (strcmp(name, "dir") == 0) {
+		ld->dir = getDirId(value);
+	} else if (strcmp(name, "state") == 0) {
+		ld->state = getStateId(value);
+	} else if (strcmp(name, "level") == 0) {
+		ld->invert = (strcmp(value, "INVERT") == 0);
+	} else if (strcmp(name, "action") == 0) {
+		/* inactive at this time */
+	} else if (strcmp(name, "filter") == 0) {
+		ld->filter = getFilterMode(value);
+	} else if (strcmp(name, "assert") == 0) {
+		ld->assert_ms = atoi(value);
+	} else if (strcmp(name, "release") == 0) {
+		ld->release_ms = atoi(value);
+	} else if (strcmp(name, "minpulse") == 0) {
+		ld->minpulse_ms = atoi(value);
+	} else if (strcmp(name, "every") == 0) {
+		ld->every_ms = atoi(value);
+	} else if (strcmp(name, "pulse") == 0) {
+		ld->pulse_ms = atoi(value);
+	} else if (strcmp(name, "offset") == 0) {
+		ld->offset_ms = atoi(value);
+	} else if (strcmp(name, "timeout") == 0) {
+		ld->timeout_ms = atoi(value);
+	} else if (strcmp(name, "device") == 0) {
+		strncpy(ld->device, value, sizeof(ld->device) - 1);
+		ld->dir = DIR_IN;
+	} else if (strcmp(name, "key") == 0) {
+		ld->key = strcmp(value, "ANY") == 0 ? -1 : atoi(value);
+	} else if (strcmp(name, "grab") == 0) {
+		ld->grab = atoi(value);
+	} else if (strcmp(name, "mirror") == 0) {
+		/* May be given more than once */
+		if (ld->mirror_count >= MAX_MIRRORS)
+			return 0;  /* too many mirrors, error */
+		strncpy(ld->mirror[ld->mirror_count++], value, sizeof(ld->mirror[0]) - 1);
+	} else if (strcmp(name, "mirror_fail") == 0) {
+		ld->mirror_policy = getMirrorPolicy(value);
+		if (ld->mirror_policy < 0)
+			return 0;  /* bad value, error */
+	} else if (strcmp(name, "bit") == 0) {
+		ld->bit = atoi(value);
+		if (ld->bit < 0 || ld->bit > 63)
+			return 0;  /* bad value, error */
+	} else if (strcmp(name, "sync") == 0) {
+		if (strcmp(value, "PPS") == 0)
+			ld->sync = 1;
+		else if (strcmp(value, "NONE") == 0)
+			ld->sync = 0;
+		else
+			return 0;  /* bad value, error */
+	} else {
+		return 0;  /* unknown name, error */
+	}
+
+	if (ld->line == ERROR || ld->dir == ERROR || ld->state == ERROR || ld->filter == ERROR)
+		return 0;  /* bad value, error */
+	if (ld->port < 0 || ld->port >= MAX_PORTS)
+		return 0;
+	return 1;
+}
+
 /* This function accomplishes the loading of the ini file into the configuration */
 int load_config(char * cfile)
 {
@@ -146,8 +425,10 @@ int load_config(char * cfile)
 //	configuration config;
 	char * p;
 
+	PTT_PROBE1(config_start, cfile);
 	if (ini_parse(cfile, handler, &config) < 0) {
 		printf("Can't load '%s'\n",cfile);
+		PTT_PROBE3(config_end, cfile, ERROR, config.line_count);
 		return(ERROR);
 	}
 	printf("Config loaded from '%s':\n", cfile);
@@ -175,20 +456,32 @@ int load_config(char * cfile)
 	level = config.level;
 	quiet = config.quiet;
 
-	if (config.devicename != "")
-		strcpy(devicename, config.devicename);
+	if (config.devicename != NULL)
+		devicename = (char *)config.devicename;
 
 	if (debug)
 		printf("devicename: '%s'\n", devicename);
 
 	port_number = getPortNumber(devicename);
 
-	if (config.linename != "")
-		strcpy(linename, config.linename);
+	if (config.linename != NULL)
+		linename = (char *)config.linename;
 
 	if (debug)
 		printf("linename: '%s'\n", linename);
 
+	if (config.logfile != NULL)
+		logfile = (char *)config.logfile;
+
+	if (debug)
+		printf("logfile: '%s'\n", logfile);
+
+	if (config.lockdir != NULL)
+		lockdir = (char *)config.lockdir;
+
+	if (debug)
+		printf("lockdir: '%s'\n", lockdir);
+
 	ctrl_line = getCtrlLine(linename);
 
 	if (config.port_number != ERROR)
@@ -230,6 +523,15 @@ int load_config(char * cfile)
 		printf("  port_number: %d\n", port_number);
 	}
 
+	/* Know the whole memory bill before anything is opened */
+	if (config.mem_budget > 0 && monitor_budget(&config, verbose) > config.mem_budget * 1024)
+	{
+		printf("Config needs more than the %ld kB memory budget\n", config.mem_budget);
+		PTT_PROBE3(config_end, cfile, ERROR, config.line_count);
+		return(ERROR);
+	}
+
+	PTT_PROBE3(config_end, cfile, PASS, config.line_count);
 	return(PASS);
 }
 
@@ -260,6 +562,13 @@ void usage(char * name)
 	printf("  --nodebug                   Turn OFF debug reporting.\n");
 	printf("  --quiet                     Turn ON quiet mode.\n");
 	printf("  --unquiet                   Turn OFF quiet mode.\n");
+	printf("  --probe                     Identify and cache the UART type, then exit.\n");
+	printf("  --monitor                   Run the input line monitor until killed.\n");
+	printf("                              (SIGUSR1 reports, SIGUSR2 re-execs an upgraded ptt)\n");
+	printf("  --standby                   Take over from a failed --monitor, see [STANDBY].\n");
+	printf("  --panic                     Release every PTT and PULSE line now (or SIGQUIT).\n");
+	printf("  --status [--fast]           Show every port's MCR/MSR; --fast shows every\n");
+	printf("                              line from the running monitor, no port IO\n");
 	printf("  --help, -h                  Show version info and exit.\n");
 	printf("  --version, -v               Show version info and exit.\n");
 	printf("  --port, -p <port>           Serial port number [0-7]\n");
@@ -267,6 +576,15 @@ void usage(char * name)
 	printf("  --line, -l <ctrl_line>      Line to control [NONE, DTR, RTS, BOTH] \n");
 	printf("  --file, -f <config file>    Use alternate config file\n");
 	printf("  --set, -s <value>           Specify new state value ['0','1'] \n") ;
+	printf("  --log, -L <history file>    Append each transition to history file\n");
+	printf("  --history, -H <t1>,<t2>     Report line ON times from history file\n");
+	printf("                              (times are epoch or YYYY-MM-DD[THH:MM:SS])\n");
+	printf("  --export, -E <t1>,<t2>      Write all ports' history as a Chrome trace\n");
+	printf("  --out, -o <trace file>      Trace file for --export ['-' for stdout]\n");
+	printf("  --bench-timers, -T <count>  Benchmark the timer wheel and exit\n");
+	printf("  --bench-rules, -R <samples> Benchmark the [RULES] table and exit\n");
+	printf("  --bench-sidetone, -S <seconds> Benchmark the CW sidetone and exit\n");
+	printf("  --bench-lock, -B <count>    Benchmark the port lock against the MCR I/O and exit\n");
 	printf("  <value> is '0' or '1' for ON or OFF\n") ;
 }
 
@@ -278,10 +596,31 @@ void print_line_state(int bit_mask, int value)
         printf("OFF, ");
 }
 
+/* Pick a -f/--file out of the command line ahead of parse_args(), so the
+ * config it names is the one loaded and the rest of the command line can
+ * still override what that file sets.
+ */
+void find_cfgfile(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--") == 0)
+			break;
+		if (strncmp(argv[i], "--file=", 7) == 0)
+			cfgfile = cfg_strdup(argv[i] + 7);
+		else if (strncmp(argv[i], "-f", 2) == 0 && argv[i][2] != '\0')
+			cfgfile = cfg_strdup(argv[i] + 2);
+		else if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--file") == 0) && i + 1 < argc)
+			cfgfile = cfg_strdup(argv[++i]);
+	}
+}
+
 void parse_args(int argc, char *argv[])
 {
     int chopt;
-    char * valstr;
+    char valstr[64];
 
     if (debug)
     	printf("parse_args()\n");
@@ -297,6 +636,12 @@ void parse_args(int argc, char *argv[])
 			{"nodebug",		no_argument,		  &debug, 0},	// default
 			{"quiet",		no_argument,		  &quiet, 1},
 			{"unquiet",		no_argument,		  &quiet, 0},	// default
+			{"probe",		no_argument,		  &probe, 1},
+			{"monitor",		no_argument,		&monitor, 1},
+			{"standby",		no_argument,		&standby, 1},
+			{"panic",		no_argument,		  &panic, 1},
+			{"status",		no_argument,		 &status, 1},
+			{"fast",		no_argument,		   &fast, 1},
 			/* These options don't set a flag.
 			   We distinguish them by their indices. */
 			{"help",		no_argument,		0, 'h'},
@@ -306,12 +651,20 @@ void parse_args(int argc, char *argv[])
 			{"line",		required_argument,	0, 'l'},
 			{"file",		required_argument,	0, 'f'},
 			{"set",			required_argument,	0, 's'},
+			{"log",			required_argument,	0, 'L'},
+			{"history",		required_argument,	0, 'H'},
+			{"export",		required_argument,	0, 'E'},
+			{"out",			required_argument,	0, 'o'},
+			{"bench-timers",	required_argument,	0, 'T'},
+			{"bench-rules",		required_argument,	0, 'R'},
+			{"bench-sidetone",	required_argument,	0, 'S'},
+			{"bench-lock",		required_argument,	0, 'B'},
 			{0, 0, 0, 0}
 		};
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		chopt = getopt_long (argc, argv, "hvd:p:l:f:s:",
+		chopt = getopt_long (argc, argv, "hvd:p:l:f:s:L:H:E:o:T:R:S:B:",
 				long_options, &option_index);
 
 		/* Detect the end of the options. */
@@ -343,7 +696,7 @@ void parse_args(int argc, char *argv[])
 			case 'd':
 				if (debug)
 					printf ("option '-%c' with value '%s'\n", chopt, optarg);
-				devicename = strdup(optarg);
+				devicename = cfg_strdup(optarg);
 				break;
 
 			case 'p':
@@ -355,13 +708,13 @@ void parse_args(int argc, char *argv[])
 			case 'l':
 				if (debug)
 					printf ("option '-%c' with value '%s'\n", chopt, optarg);
-				linename = strdup(optarg);
+				linename = cfg_strdup(optarg);
 				break;
 
 			case 'f':
 				if (debug)
 					printf ("option '-%c' with value '%s'\n", chopt, optarg);
-				cfgfile = strdup(optarg);
+				cfgfile = cfg_strdup(optarg);
 				break;
 
 			case 's':
@@ -370,6 +723,54 @@ void parse_args(int argc, char *argv[])
 				value = atoi(optarg) & 0x01;
 				break;
 
+			case 'L':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				logfile = cfg_strdup(optarg);
+				break;
+
+			case 'H':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				history = cfg_strdup(optarg);
+				break;
+
+			case 'E':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				export = cfg_strdup(optarg);
+				break;
+
+			case 'o':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				tracefile = cfg_strdup(optarg);
+				break;
+
+			case 'T':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				bench_timers = atoi(optarg);
+				break;
+
+			case 'R':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				bench_rules = atol(optarg);
+				break;
+
+			case 'S':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				bench_sidetone = atoi(optarg);
+				break;
+
+			case 'B':
+				if (debug)
+					printf ("option '-%c' with value '%s'\n", chopt, optarg);
+				bench_lock = atol(optarg);
+				break;
+
 			case '?':
 				/* getopt_long already printed an error message. */
 				break;
@@ -395,7 +796,7 @@ void parse_args(int argc, char *argv[])
 		memset(valstr,0x00,sizeof(valstr));
 //		printf ("non-option ARGV-elements: ");
 		while (optind < argc)
-			strcat(valstr, argv[optind++]);
+			strncat(valstr, argv[optind++], sizeof(valstr) - strlen(valstr) - 1);
 //			printf ("%s ", argv[optind++]);
 //		putchar ('\n');
 		if (debug)
@@ -449,6 +850,65 @@ int getCtrlLine(char * line)
 
 }
 
+int getLineId(const char * name)
+{
+	const char * names[] = { "NONE", "DTR", "RTS", "BOTH", "CTS", "DSR", "RI", "DCD", "SR", NULL };
+	int i;
+
+	for (i = 0; names[i] != NULL; i++)
+		if (strcmp(name, names[i]) == 0)
+			return(i);
+	return(ERROR);
+}
+
+const char * getLineName(int line)
+{
+	const char * names[] = { "NONE", "DTR", "RTS", "BOTH", "CTS", "DSR", "RI", "DCD", "SR" };
+
+	if (line < LINE_NONE || line > LINE_SR)
+		return("ERROR");
+	return(names[line]);
+}
+
+int getDirId(const char * dir)
+{
+	if (strcmp(dir,"OUT") ==0)
+		return(DIR_OUT);
+	else if (strcmp(dir,"IN") ==0)
+		return(DIR_IN);
+	else if (strcmp(dir,"BI") ==0)
+		return(DIR_BI);
+	else
+		return(ERROR);
+}
+
+int getStateId(const char * state)
+{
+	const char * names[] = { "OFF", "ON", "TOGGLE", "PTT", "COR", "IGNORE", "PULSE", "PPS", "ESTOP", "BAND", "RULE", "CW", "CWPTT", NULL };
+	int i;
+
+	for (i = 0; names[i] != NULL; i++)
+		if (strcmp(state, names[i]) == 0)
+			return(i);
+	return(ERROR);
+}
+
+const char * getStateName(int state)
+{
+	const char * names[] = { "OFF", "ON", "TOGGLE", "PTT", "COR", "IGNORE", "PULSE", "PPS", "ESTOP", "BAND", "RULE", "CW", "CWPTT" };
+
+	if (state < STATE_OFF || state > STATE_CWPTT)
+		return("ERROR");
+	return(names[state]);
+}
+
+/* Outputs that can key a transmitter, released by a panic or E-stop */
+int isKeyedState(int state)
+{
+	return(state == STATE_PTT || state == STATE_PULSE || state == STATE_RULE ||
+		state == STATE_CW || state == STATE_CWPTT);
+}
+
 int getPortNumber(char * portname)
 {
 
@@ -476,7 +936,7 @@ int getPortNumber(char * portname)
 int getPortAddress(int portnum)
 {
 	int port_address;
-    switch (port_number)
+    switch (portnum)
     {
 		case 0: port_address = 0x3F8; break;
 		case 1: port_address = 0x2F8; break;
@@ -492,11 +952,262 @@ int getPortAddress(int portnum)
     return(port_address);
 }
 
+/* Parse a 't1,t2' history window */
+int parse_window(char * window, time_t * t1, time_t * t2)
+{
+	char * comma;
+
+	comma = strchr(window, ',');
+	if (comma == NULL)
+	{
+		printf("History window must be given as <t1>,<t2>\n");
+		return(FAIL);
+	}
+	*comma = '\0';
+
+	*t1 = hist_parse_time(window);
+	*t2 = hist_parse_time(comma + 1);
+	if (*t1 < 0 || *t2 < 0 || *t2 < *t1)
+	{
+		printf("Invalid history window '%s,%s'\n", window, comma + 1);
+		return(FAIL);
+	}
+	return(PASS);
+}
+
+/* Parse the 't1,t2' history window and report the line ON times of the
+ * MCR at 'address' from the history file.
+ */
+int history_report(char * window, int address)
+{
+	time_t t1;
+	time_t t2;
+
+	if (strlen(logfile) == 0)
+	{
+		printf("No history file configured, use --log <file>\n");
+		return(FAIL);
+	}
+
+	if (parse_window(window, &t1, &t2) != PASS)
+		return(FAIL);
+
+	if (hist_query(logfile, address, t1, t2, verbose) < 0 ||
+		hist_inputs(logfile, t1, t2, verbose) < 0)
+	{
+		printf("Can't read history '%s'\n", logfile);
+		return(FAIL);
+	}
+
+	return(PASS);
+}
+
+/* Write every port's transitions in the 't1,t2' window, and the slow ones
+ * from the outlier log, to the trace file as a Chrome trace.
+ */
+int history_export(char * window)
+{
+	FILE * out;
+	time_t t1;
+	time_t t2;
+	int found;
+
+	if (strlen(logfile) == 0)
+	{
+		printf("No history file configured, use --log <file>\n");
+		return(FAIL);
+	}
+
+	if (parse_window(window, &t1, &t2) != PASS)
+		return(FAIL);
+
+	out = strcmp(tracefile, "-") == 0 ? stdout : fopen(tracefile, "w");
+	if (out == NULL)
+	{
+		printf("Can't create '%s': %s\n", tracefile, strerror(errno));
+		return(FAIL);
+	}
+
+	found = hist_export(out, logfile, config.outlier_log, t1, t2);
+	if (out != stdout)
+		fclose(out);
+	if (found < 0)
+	{
+		printf("Can't read history '%s'\n", logfile);
+		return(FAIL);
+	}
+
+	if (out != stdout)
+		printf("%d transitions written to '%s'\n", found, tracefile);
+	return(PASS);
+}
+
+/* Open the lock file of the MCR at 'address' without taking the lock.
+ * The lock is an flock() on a file in lockdir named after the port
+ * address; the kernel drops it if we die holding it. Returns the fd, or
+ * ERROR if the file can't be opened (an empty lockdir disables locking).
+ * Resident modes open it once and only lock_take/lock_give per write.
+ */
+int lock_open(int address)
+{
+	char path[256];
+
+	if (strlen(lockdir) == 0)
+		return(ERROR);
+
+	snprintf(path, sizeof(path), "%s/ptt-0x%04X.lock", lockdir, address);
+	return(open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666));
+}
+
+/* Take the exclusive lock on an open lock fd, a no-op on a negative one */
+int lock_take(int fd)
+{
+	if (fd < 0)
+		return(ERROR);
+
+	while (flock(fd, LOCK_EX) != 0)
+		if (errno != EINTR)
+			return(ERROR);
+	return(PASS);
+}
+
+void lock_give(int fd)
+{
+	if (fd >= 0)
+		flock(fd, LOCK_UN);
+}
+
+long elapsed_ns(struct timespec * t0, struct timespec * t1)
+{
+	return((t1->tv_sec - t0->tv_sec) * 1000000000L + (t1->tv_nsec - t0->tv_nsec));
+}
+
+/* Take an exclusive lock on the MCR at 'address' so that concurrent ptt
+ * invocations can't interleave their inb/modify/outb sequences and undo
+ * each other's changes. Returns the lock fd, or ERROR if it can't be
+ * had. For one-shot use, this opens and closes the lock file each time.
+ */
+int lock_port(int address)
+{
+	int fd;
+
+	fd = lock_open(address);
+	if (fd < 0)
+		return(ERROR);
+
+	if (lock_take(fd) != PASS)
+	{
+		close(fd);
+		return(ERROR);
+	}
+	return(fd);
+}
+
+void unlock_port(int fd)
+{
+	if (fd < 0)
+		return;
+	lock_give(fd);
+	close(fd);
+}
+
+/* Time 'count' uncontended lock cycles on the MCR at 'address', both the
+ * one-shot open+flock+close and the resident flock/unflock on a held fd,
+ * against the inb() of the MCR they protect. The I/O is only timed if we
+ * may have the port.
+ */
+int lock_bench(int address, long count)
+{
+	struct timespec t0;
+	struct timespec t1;
+	double oneshot_ns;
+	double held_ns;
+	double io_ns = 0.0;
+	long i;
+	int fd;
+
+	fd = lock_open(address);
+	if (fd < 0)
+	{
+		printf("Can't open the lock file of 0x%04X in '%s'\n", address, lockdir);
+		return(FAIL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < count; i++)
+		unlock_port(lock_port(address));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	oneshot_ns = elapsed_ns(&t0, &t1);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < count; i++)
+	{
+		lock_take(fd);
+		lock_give(fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	held_ns = elapsed_ns(&t0, &t1);
+	close(fd);
+
+	if (ioperm(address, MCR_REG_ONLY, ON) == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < count; i++)
+			inb(address);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		io_ns = elapsed_ns(&t0, &t1);
+	}
+
+	printf("Port lock: %ld cycles on 0x%04X in '%s'\n", count, address, lockdir);
+	printf("  open+flock+close: %.1f ns/cycle\n", oneshot_ns / count);
+	printf("  flock held fd:    %.1f ns/cycle\n", held_ns / count);
+	if (io_ns > 0.0)
+		printf("  MCR inb:          %.1f ns/read, held lock is %.1fx one read\n",
+			io_ns / count, held_ns / io_ns);
+	else
+		printf("  MCR inb:          not timed, no access to the port\n");
+	return(PASS);
+}
+
+/* Identify the UART at 'base', cache the result for later invocations
+ * and report it. The probe needs access to all of the UART registers
+ * and is serialized against other ptt processes by the MCR port lock.
+ */
+int probe_report(int base)
+{
+	int lock_fd;
+	int type;
+
+	if (ioperm(base, WHOLE_UART, ON) != 0)
+	{
+		printf("ptt: ioperm(0x%x) failed: %s\n", base, strerror(errno));
+		return(FAIL);
+	}
+
+	lock_fd = lock_port((base + MCR_ADDR_OFFSET) & IO_MASK);
+	type = uart_probe(base);
+	unlock_port(lock_fd);
+
+	ioperm(base, WHOLE_UART, OFF);
+
+	printf("UART at 0x%04X: %s\n", base, uart_type_name(type));
+
+	if (uart_cache_save(lockdir, base, type) != 0)
+		printf("Warning, can't cache UART type in '%s'\n", lockdir);
+
+	return(PASS);
+}
+
 int main(int argc, char *argv[])
 {
     int port_address;		    // The serial port base I/O port address
+    int base_address;			// The serial port base I/O address, unmodified
     unsigned char old_value;	// The original value of the MCR register
     unsigned char new_value;	// The new value of the MCR register
+    int lock_fd;				// Per-port lock, held across inb/outb
+    struct timespec t_req;	// Request time, for the probes
+
+	ptt_argv = argv;
 
 	/* Load the defaults into global config variables */
 	load_defaults();
@@ -518,8 +1229,9 @@ int main(int argc, char *argv[])
     	copyright();
 	}
 
-	/* Load defaults from ini config file */
-	load_config(cfgfile);
+	/* Load defaults from ini config file, the one given by -f if any */
+	find_cfgfile(argc, argv);
+	config_status = load_config(cfgfile);
 
 	/* Parse command line arguments */
 	parse_args(argc,argv);
@@ -551,6 +1263,37 @@ int main(int argc, char *argv[])
 		printf("cfgfile: '%s'\n", cfgfile);
 	}
 
+	/* The timer wheel benchmark needs no hardware */
+	if (bench_timers > 0)
+		exit(tw_bench(bench_timers) == 0 ? 0 : 1);
+
+	/* Nor does the rule table one, it uses the config's [RULES] if any */
+	if (bench_rules > 0)
+		exit(rule_bench(config.rules, config.rule_count, bench_rules) == 0 ? 0 : 1);
+	if (bench_sidetone > 0)
+		exit(sidetone_bench(bench_sidetone, config.sidetone_hz, config.sidetone_rate,
+			config.sidetone_rise) == 0 ? 0 : 1);
+
+	/* A panic comes before anything else that could key a line */
+	if (panic)
+		exit(panic_run(&config) == PASS ? 0 : 1);
+
+	/* A status query never changes anything */
+	if (status)
+		exit(status_run(&config, fast, verbose) == PASS ? 0 : 1);
+
+	/* The resident modes don't start on a config that failed to load */
+	if ((monitor || standby) && config_status == ERROR)
+		exit(1);
+
+	/* Monitor mode runs from the [LINEn] sections until it is signalled */
+	if (monitor)
+		exit(monitor_run(&config, verbose, -1) == PASS ? 0 : 1);
+
+	/* A standby waits for the monitor's lease to lapse, then becomes it */
+	if (standby)
+		exit(standby_run(&config, verbose) == PASS ? 0 : 1);
+
 	//exit(0);
 //    /* Ensure that the user has supplied exactly three parameters
 //     * (argc = 4) supplied to the program on the command line. If not,
@@ -574,6 +1317,7 @@ int main(int argc, char *argv[])
      * 0-3 may not work and is dependant on specific hardware.
      */
 	port_address = getPortAddress(port_number);
+	base_address = port_address;
 
 	/* Setup the default control pin BIT map */
     switch(ctrl_line)
@@ -602,6 +1346,31 @@ int main(int argc, char *argv[])
     if (verbose)
         printf("COM Port MCR Register address: 0x%02X\n",port_address);
 
+    /* A history query only reads the log file, never the hardware */
+    if (history != NULL)
+        exit(history_report(history, port_address) == PASS ? 0 : 1);
+    if (export != NULL)
+        exit(history_export(export) == PASS ? 0 : 1);
+
+    /* A probe identifies the UART, caches what it found and exits */
+    if (probe)
+        exit(probe_report(base_address) == PASS ? 0 : 1);
+
+    /* The lock benchmark times the I/O too, if we may have the port */
+    if (bench_lock > 0)
+        exit(lock_bench(port_address, bench_lock) == PASS ? 0 : 1);
+
+    /* Use the cached UART type to decide which MCR bits to preserve */
+    uart_type = uart_cache_load(lockdir, base_address);
+    if (verbose)
+        printf("UART type: %s\n", uart_type_name(uart_type));
+
+    if (uart_type == UART_NONE)
+    {
+        printf("No UART at 0x%04X, MCR not changed\n", base_address);
+        exit(1);
+    }
+
     /* If the port_address is less than 0x3FF, then we do a simple ioperm()
      * action to set the perms on the ioport so that the user can change
      * the value in the MCR register.
@@ -610,9 +1379,19 @@ int main(int argc, char *argv[])
         error ("ptt: ioperm(0x%x) failed: %s", port_address, strerror(errno));
         return -1;
     }
+    PTT_PROBE3(backend_open, port_number, port_address, uart_mcr_mask(uart_type));
+
+    /* Serialize against other ptt processes touching this MCR */
+    lock_fd = lock_port(port_address);
+    clock_gettime(CLOCK_MONOTONIC, &t_req);
+    if (lock_fd < 0 && strlen(lockdir) > 0)
+        printf("Warning, can't lock port 0x%04X in '%s', continuing unlocked\n",
+            port_address, lockdir);
 
     /* Get the initial value of the MCR */
     old_value = inb( port_address );
+    PTT_PROBE_IO(inb, port_number, port_address, old_value,
+        t_req.tv_sec * 1000000000LL + t_req.tv_nsec);
 
     /* Show this value to the operator */
     if (verbose)
@@ -718,7 +1497,7 @@ int main(int argc, char *argv[])
 			break;
     }
 
-    new_value = MCR_MASK & new_value;
+    new_value = uart_mcr_mask(uart_type) & new_value;
 
     /* Show this to the operator */
     if (verbose)
@@ -726,14 +1505,25 @@ int main(int argc, char *argv[])
 
     /* Send the new value to the MCR */
     outb( new_value, port_address);
+    PTT_PROBE_IO(outb, port_number, port_address, new_value,
+        t_req.tv_sec * 1000000000LL + t_req.tv_nsec);
 
     /* Read it back in for verification */
     new_value = inb( port_address );
+    PTT_PROBE_IO(inb, port_number, port_address, new_value,
+        t_req.tv_sec * 1000000000LL + t_req.tv_nsec);
 
     /* Show the read back value to the operator */
     if (verbose)
         printf("New Value: 0x%02X\n",new_value);
 
+    /* Record the transition in the history file, if one is configured */
+    if (strlen(logfile) > 0)
+        if (hist_append(logfile, port_address, old_value, new_value) != 0)
+            printf("Warning, can't append to history '%s'\n", logfile);
+
+    unlock_port(lock_fd);
+
     /* Show the operator the end result! */
     if (!quiet)
     {
@@ -15,6 +15,8 @@ extern "C" {
  */
 #define HAVE_SYS_IO_H
 
+#include <time.h>
+
 #ifdef HAVE_SYS_IO_H
     #include <sys/io.h>
     #define WITH_OUTB
@@ -60,6 +62,11 @@ extern "C" {
 
 #define MCR_MASK 	0x03	// Mask off all but lower 2 bits of MCR
 
+#define CTS_MASK 	0x10	// MSR Bit 4: 2^4
+#define DSR_MASK 	0x20	// MSR Bit 5: 2^5
+#define RI_MASK 	0x40	// MSR Bit 6: 2^6
+#define DCD_MASK 	0x80	// MSR Bit 7: 2^7
+
 #define UPPER_MCR_MASK 	0xC0	// Mask off all but upper 2 bits of MCR
 
 /* define which pins will be used to control PTT, choices are
@@ -76,7 +83,7 @@ enum {
  * register from the COM port base register IO address.
  * This value is usually 0x04 for the MCR of a serial port.
  */
-int MCR_ADDR_OFFSET = 0x04;
+#define MCR_ADDR_OFFSET 0x04
 
 /* IO_MASK is used to mask off the upper portion of the
  * IO address when creating the port address. This is
@@ -84,12 +91,24 @@ int MCR_ADDR_OFFSET = 0x04;
  * addressing an IO port address greater than 0x3FF without
  * using iopl().
  */
-//int IO_MASK = 0x3FF;
-int IO_MASK = 0xFFFF;
+//#define IO_MASK 0x3FF
+#define IO_MASK 0xFFFF
 
 #define DEF_DEVICENAME 	"/dev/ttyS0"
 #define DEF_LINENAME 	"BOTH"
 #define DEF_CFGFILE 	"ptt.conf"
+#define DEF_LOGFILE 	""
+#define DEF_LOCKDIR 	"/run/lock"
+#define DEF_TRACEFILE 	"ptt-trace.json"
+#define DEF_PERIOD_US 	1000
+#define DEF_IDLE_AFTER 	1000
+
+/* Upper limits on what the config file may define */
+#define MAX_LINES 		16
+#define MAX_PORTS 		9
+#define MAX_BANDS 		32
+#define MAX_MIRRORS 		3
+#define MAX_RULES 			16
 #define DEF_PORTNUM 	0
 #define DEF_VALUE 		OFF
 
@@ -98,6 +117,90 @@ int IO_MASK = 0xFFFF;
 #define MINOR_VER 		3
 #define COPY_YEARS 		"2009-2018"
 
+/* Control and status lines a [LINEn] section can name with 'line='.
+ * The first four match the CTRL_xxx values, the rest are MSR inputs.
+ */
+enum {
+    LINE_NONE,
+    LINE_DTR,
+    LINE_RTS,
+    LINE_BOTH,
+    LINE_CTS,
+    LINE_DSR,
+    LINE_RI,
+    LINE_DCD,
+    LINE_SR		// A bit of the [SHIFTREG] chain
+};
+
+/* Line directions, 'dir=' */
+enum {
+    DIR_OUT,
+    DIR_IN,
+    DIR_BI
+};
+
+/* Line states, 'state=' */
+enum {
+    STATE_OFF,		// Line stays LOW
+    STATE_ON,		// Line stays HIGH
+    STATE_TOGGLE,	// Line changes to the opposite state
+    STATE_PTT,		// Line follows PTT (COR inputs in monitor mode)
+    STATE_COR,		// Line input drives COR
+    STATE_IGNORE,	// Line is not changed
+    STATE_PULSE,	// Line pulses on a schedule (monitor mode)
+    STATE_PPS,		// Line input is a GPS PPS (monitor mode)
+    STATE_ESTOP,	// Line input is an emergency stop (monitor mode)
+    STATE_BAND,		// Line is one bit of the band data (monitor mode)
+    STATE_RULE,		// Line follows its [RULES] entry (monitor mode)
+    STATE_CW,		// Line is the [WINKEY] keyer's key (monitor mode)
+    STATE_CWPTT		// Line is the [WINKEY] keyer's PTT (monitor mode)
+};
+
+/* One [BANDS] entry */
+typedef struct
+{
+	char name[16];					// Band name, e.g. '20m'
+	long long low;					// Lowest frequency (Hz)
+	long long high;					// Highest frequency (Hz)
+	unsigned int pattern;			// Band data bits
+} band_def;
+
+/* One [RULES] entry, '<output section>=<expression>' */
+typedef struct
+{
+	char output[32];				// Section of the output line it drives
+	char expr[128];					// e.g. 'COR1 & !INHIBIT | FOOTSW'
+} rule_def;
+
+/* One [LINEn] section of the config file */
+typedef struct
+{
+	char section[32];				// Config section name, e.g. 'LINE1'
+	char name[64];					// Human readable label
+	int port;						// Serial port number 0-8
+	int line;						// LINE_xxx
+	int dir;						// DIR_xxx
+	int state;						// STATE_xxx
+	int invert;						// level=INVERT {0|1}
+	int filter;						// Input filter mode, FILTER_xxx
+	int assert_ms;					// Input active time before COR asserts
+	int release_ms;					// Input inactive time before COR releases
+	int minpulse_ms;				// Minimum filtered pulse width
+	int every_ms;					// state=PULSE repeat interval
+	int pulse_ms;					// state=PULSE active time
+	int offset_ms;					// state=PULSE first pulse delay
+	int sync;						// sync=PPS {0|1}, PULSE schedule on GPS time
+	int bit;						// state=BAND bit of the band pattern,
+									// line=SR bit of the shift register chain
+	char device[128];				// Input device path or 'name:<name>'
+	int key;						// Input device key code, -1 for any
+	int grab;						// grab=1 takes the input device for ptt
+	char mirror[MAX_MIRRORS][128];	// Extra keying paths, 'mirror='
+	int mirror_count;
+	int mirror_policy;				// mirror_fail=, MIRROR_xxx
+	int timeout_ms;					// state=PTT time-out timer, 0 is none
+} line_def;
+
 typedef struct
 {
 	int verbose;					// Verbose Reporting {0|1} {OFF|ON}
@@ -110,23 +213,93 @@ typedef struct
 	int numlines;					// Number of lines to control
     const char* devicename;			// serial device name
     const char* linename;			// serial line name
+    const char* logfile;			// transition history file name
+    const char* lockdir;			// per-port lock file directory
+    int period_us;					// monitor sample period (us)
+    int priority;					// monitor SCHED_FIFO priority, 0 for none
+    int idle_period_us;				// monitor longest sample period when idle (us)
+    int idle_after_ms;				// monitor quiet time before slowing (ms)
+    long mem_budget;				// monitor memory budget (kB), 0 for none
+    int outlier_us;					// monitor slow transition threshold (us), 0 for none
+    const char* outlier_log;		// monitor slow transition log
+    int outlier_trace;				// transitions logged before each slow one
+    const char* status_name;		// monitor status shared memory name
+    const char* audio;				// receiver audio (PCM) source
+    int audio_rate;					// receiver audio sample rate (Hz)
+    double ctcss_tone;				// CTCSS tone frequency (Hz)
+    double ctcss_threshold;			// CTCSS tone power ratio threshold
+    int ctcss_block;				// CTCSS sub-block length (ms)
+    const char* record_dir;			// per-transmission recording directory
+    int record_preroll;				// recording pre-roll (ms)
+    const char* standby_name;		// hot standby shared memory name
+    int standby_lease;				// hot standby lease time (ms)
+    int standby_policy;				// hot standby takeover, FAILOVER_xxx
+    const char* band_source;		// band decoder frequency source
+    int band_poll;					// band decoder rigctld poll interval (ms)
+    unsigned int band_default;		// band data outside every band
+    int band_count;					// number of [BANDS] entries
+    band_def bands[MAX_BANDS];		// the [BANDS] entries
+    int rule_count;					// number of [RULES] entries
+    rule_def rules[MAX_RULES];		// the [RULES] entries
+    const char* winkey_pty;			// WinKeyer emulation pty link
+    int winkey_wpm;					// WinKeyer emulation start up speed
+    const char* sidetone;			// CW sidetone PCM output, '-' for stdout
+    int sidetone_hz;				// CW sidetone frequency (Hz)
+    int sidetone_rate;				// CW sidetone sample rate (Hz)
+    int sidetone_rise;				// CW sidetone rise and fall time (ms)
+    int qsk;						// Full break-in, CWPTT is T/R per character
+    int qsk_lead;					// QSK T/R closed to the first mark (ms)
+    int qsk_tail;					// QSK last mark to T/R open (ms)
+    int qsk_hang;					// QSK T/R held after the last mark (ms)
+    int qsk_dwell;					// QSK least relay time either way (ms)
+    int sr_port;					// shift register data/clock port
+    int sr_bits;					// shift register chain length, 0 for none
+    int sr_latch_port;				// shift register latch port
+    int sr_latch_line;				// shift register latch line, LINE_NONE for OUT1
+    int line_count;					// number of [LINEn] sections parsed
+    line_def lines[MAX_LINES];		// the [LINEn] sections
 
 } configuration;
 
 
 // Global Prototypes
 int load_defaults(void);
-static int handler(void* user, const char* section, const char* name, const char* value);
 int load_config(char * cfile);
 void prt_hdr(char * name);
 void copyright(void);
 void version(char * name);
 void usage(char * name);
 void print_line_state(int bit_mask, int value);
+void find_cfgfile(int argc, char *argv[]);
 void parse_args(int argc, char *argv[]);
 char * getCtrlLineName(int cline);
 int getCtrlLine(char * line);
 int getPortNumber(char * portname);
+int getPortAddress(int portnum);
+int parse_window(char * window, time_t * t1, time_t * t2);
+int history_report(char * window, int address);
+int history_export(char * window);
+int lock_open(int address);
+int lock_take(int fd);
+void lock_give(int fd);
+int lock_port(int address);
+void unlock_port(int fd);
+int lock_bench(int address, long count);
+long elapsed_ns(struct timespec * t0, struct timespec * t1);
+int probe_report(int base);
+int is_line_section(const char * section);
+int getLineId(const char * name);
+int getDirId(const char * dir);
+int getStateId(const char * state);
+const char * getStateName(int state);
+int isKeyedState(int state);
+const char * getLineName(int line);
+int line_handler(configuration * pconfig, const char * section, const char * name, const char * value);
+
+// Globals shared with the other modules
+extern char * logfile;
+extern char * lockdir;
+extern char ** ptt_argv;
 
 
 #ifdef __cplusplus
@@ -0,0 +1,303 @@
+/* rules.c - Combinational output rules compiled to a lookup table.
+ *
+ * Most repeater and station logic is combinational: 'the PTT is on
+ * while COR1 is and the inhibit switch isn't, or the footswitch is'. A
+ * [RULES] section gives each such output line its expression over other
+ * lines by section name:
+ *
+ *   [RULES]
+ *   TXPTT=COR1 & !INHIBIT | FOOTSW
+ *
+ * with ! (or NOT) binding tightest, then & (AND), then | (OR), and
+ * parentheses as usual. A name can be an input line (its filtered level)
+ * or an output line (the level it was last driven to).
+ *
+ * When monitor mode starts, each rule is compiled to a short postfix
+ * program and all of them are run once for every combination of the
+ * names they use. The result is one table, indexed by the packed input
+ * bits, whose entry has one bit per rule. Each sample then costs a table
+ * lookup and a compare with the last entry, however many rules there are
+ * and however long they are.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "rules.h"
+
+/* Parser state for one expression */
+typedef struct
+{
+	rule_table * rt;
+	const char * p;				// Next character
+	short * prog;				// Program being built
+	int len;
+	int error;
+} rule_parser;
+
+static void skip_space(rule_parser * rp)
+{
+	while (isspace((unsigned char)*rp->p))
+		rp->p++;
+}
+
+static void emit(rule_parser * rp, short op)
+{
+	if (rp->len >= MAX_RULE_OPS)
+	{
+		rp->error = 1;
+		return;
+	}
+	rp->prog[rp->len++] = op;
+}
+
+/* Does the next token match 'op' or the keyword 'word' */
+static int accept(rule_parser * rp, char op, const char * word)
+{
+	size_t n = strlen(word);
+
+	skip_space(rp);
+	if (*rp->p == op)
+	{
+		rp->p++;
+		return(1);
+	}
+	if (strncasecmp(rp->p, word, n) == 0 &&
+		!isalnum((unsigned char)rp->p[n]) && rp->p[n] != '_')
+	{
+		rp->p += n;
+		return(1);
+	}
+	return(0);
+}
+
+/* The bit of a name, adding it if new */
+static int name_index(rule_table * rt, const char * name, int len)
+{
+	int i;
+
+	if (len >= (int)sizeof(rt->names[0]))
+		return(-1);
+	for (i = 0; i < rt->n_names; i++)
+		if ((int)strlen(rt->names[i]) == len && strncmp(rt->names[i], name, len) == 0)
+			return(i);
+	if (rt->n_names >= MAX_RULE_INPUTS)
+		return(-1);
+	memcpy(rt->names[rt->n_names], name, len);
+	rt->names[rt->n_names][len] = '\0';
+	return(rt->n_names++);
+}
+
+static void parse_or(rule_parser * rp);
+
+static void parse_not(rule_parser * rp)
+{
+	const char * start;
+	int index;
+
+	if (accept(rp, '!', "NOT"))
+	{
+		parse_not(rp);
+		emit(rp, RULE_NOT);
+		return;
+	}
+
+	skip_space(rp);
+	if (*rp->p == '(')
+	{
+		rp->p++;
+		parse_or(rp);
+		skip_space(rp);
+		if (*rp->p != ')')
+			rp->error = 1;
+		else
+			rp->p++;
+		return;
+	}
+
+	start = rp->p;
+	while (isalnum((unsigned char)*rp->p) || *rp->p == '_')
+		rp->p++;
+	index = name_index(rp->rt, start, rp->p - start);
+	if (rp->p == start || index < 0)
+		rp->error = 1;
+	else
+		emit(rp, index);
+}
+
+static void parse_and(rule_parser * rp)
+{
+	parse_not(rp);
+	while (!rp->error && accept(rp, '&', "AND"))
+	{
+		parse_not(rp);
+		emit(rp, RULE_AND);
+	}
+}
+
+static void parse_or(rule_parser * rp)
+{
+	parse_and(rp);
+	while (!rp->error && accept(rp, '|', "OR"))
+	{
+		parse_and(rp);
+		emit(rp, RULE_OR);
+	}
+}
+
+/* Store one '<output>=<expression>' entry from the config */
+int rule_parse(rule_def * r, const char * output, const char * expr)
+{
+	memset(r, 0x00, sizeof(rule_def));
+	if (strlen(output) >= sizeof(r->output) || strlen(expr) >= sizeof(r->expr))
+		return(FAIL);
+	strcpy(r->output, output);
+	strcpy(r->expr, expr);
+	return(PASS);
+}
+
+/* Run one rule's program for one combination of the names */
+int rule_eval(const rule_table * rt, int rule, unsigned int inputs)
+{
+	int stack[MAX_RULE_OPS];
+	int sp = 0;
+	short op;
+	int i;
+
+	for (i = 0; i < rt->prog_len[rule]; i++)
+	{
+		op = rt->prog[rule][i];
+		if (op >= 0)
+			stack[sp++] = (inputs >> op) & 1;
+		else if (op == RULE_NOT)
+			stack[sp - 1] = !stack[sp - 1];
+		else if (op == RULE_AND)
+		{
+			sp--;
+			stack[sp - 1] &= stack[sp];
+		}
+		else
+		{
+			sp--;
+			stack[sp - 1] |= stack[sp];
+		}
+	}
+	return(stack[0]);
+}
+
+/* Compile the rules and fill the table. Rule n drives bit n of each
+ * entry, names are numbered in the order they first appear.
+ */
+int rule_compile(rule_table * rt, const rule_def * rules, int count)
+{
+	rule_parser rp;
+	unsigned int v;
+	int r;
+
+	memset(rt, 0x00, sizeof(rule_table));
+	if (count > MAX_RULES)
+		return(FAIL);
+
+	for (r = 0; r < count; r++)
+	{
+		memset(&rp, 0x00, sizeof(rp));
+		rp.rt = rt;
+		rp.p = rules[r].expr;
+		rp.prog = rt->prog[r];
+		parse_or(&rp);
+		skip_space(&rp);
+		if (rp.error || *rp.p != '\0')
+		{
+			printf("[RULES] %s: can't compile '%s' at '%s'%s\n", rules[r].output,
+				rules[r].expr, rp.p, rt->n_names >= MAX_RULE_INPUTS ? " (too many names)" : "");
+			return(FAIL);
+		}
+		rt->prog_len[r] = rp.len;
+	}
+	rt->n_rules = count;
+
+	for (v = 0; v < (1U << rt->n_names); v++)
+		for (r = 0; r < count; r++)
+			if (rule_eval(rt, r, v))
+				rt->table[v] |= 1 << r;
+	return(PASS);
+}
+
+static double bench_ns(struct timespec * t0, struct timespec * t1)
+{
+	return((t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec));
+}
+
+/* Time 'samples' table lookups against running every rule's program on
+ * the same inputs, and check they agree. Uses a made up set of rules if
+ * the config has none.
+ */
+int rule_bench(const rule_def * rules, int count, long samples)
+{
+	static rule_table rt;
+	static unsigned short vecs[4096];
+	rule_def demo[4];
+	struct timespec t0;
+	struct timespec t1;
+	struct timespec t2;
+	unsigned int seed = 1;
+	unsigned int mask;
+	unsigned int v;
+	unsigned int sum_table = 0;
+	unsigned int sum_eval = 0;
+	unsigned int out;
+	long i;
+	int r;
+
+	if (count == 0)
+	{
+		rule_parse(&demo[0], "PTT", "COR1 & !INHIBIT | FOOTSW");
+		rule_parse(&demo[1], "LINK", "(COR1 | COR2) & !INHIBIT & NOT (TOT | ESTOP)");
+		rule_parse(&demo[2], "FAN", "PTT | LINK | TEMP");
+		rule_parse(&demo[3], "ID", "!COR1 & !COR2 & (IDTIMER | IDREQ)");
+		rules = demo;
+		count = 4;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (rule_compile(&rt, rules, count) != PASS)
+		return(-1);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("Rules: %d rules over %d names, %d table entries, compiled in %.1f us\n",
+		count, rt.n_names, 1 << rt.n_names, bench_ns(&t0, &t1) / 1e3);
+
+	/* Random input combinations, made up front to keep rand() out of it */
+	mask = (1U << rt.n_names) - 1;
+	for (i = 0; i < 4096; i++)
+		vecs[i] = rand_r(&seed) & mask;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < samples; i++)
+		sum_table += rt.table[vecs[i & 4095]];
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	for (i = 0; i < samples; i++)
+	{
+		v = vecs[i & 4095];
+		out = 0;
+		for (r = 0; r < count; r++)
+			out |= rule_eval(&rt, r, v) << r;
+		sum_eval += out;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	printf("  table lookup: %.1f ns/sample, %.0f samples/s\n",
+		bench_ns(&t0, &t1) / samples, samples / (bench_ns(&t0, &t1) / 1e9));
+	printf("  interpreted:  %.1f ns/sample, %.0f samples/s\n",
+		bench_ns(&t1, &t2) / samples, samples / (bench_ns(&t1, &t2) / 1e9));
+	printf("  results %s\n", sum_table == sum_eval ? "agree" : "DIFFER");
+	return(sum_table == sum_eval ? 0 : -1);
+}
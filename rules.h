@@ -0,0 +1,44 @@
+/* rules.h - Combinational output rules compiled to a lookup table.
+
+*/
+
+#ifndef __RULES_H__
+#define __RULES_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+#define MAX_RULE_INPUTS		12			// Distinct names the rules may use
+#define MAX_RULE_OPS		64			// Compiled length of one rule
+
+/* Compiled rule program, postfix: a name index, or one of these */
+enum {
+	RULE_NOT = -1,
+	RULE_AND = -2,
+	RULE_OR = -3
+};
+
+typedef struct
+{
+	int n_names;								// Names the rules use
+	char names[MAX_RULE_INPUTS][32];			// Line sections, in bit order
+	int n_rules;
+	short prog[MAX_RULES][MAX_RULE_OPS];		// Each rule, postfix
+	int prog_len[MAX_RULES];
+	unsigned short table[1 << MAX_RULE_INPUTS];	// Input bits to output bits
+} rule_table;
+
+int rule_parse(rule_def * r, const char * output, const char * expr);
+int rule_compile(rule_table * rt, const rule_def * rules, int count);
+int rule_eval(const rule_table * rt, int rule, unsigned int inputs);
+int rule_bench(const rule_def * rules, int count, long samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RULES_H__ */
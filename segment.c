@@ -0,0 +1,247 @@
+/* segment.c - Per-transmission audio recorder driven by COR/PTT edges.
+ *
+ * For logging repeater traffic, monitor mode can cut the receiver audio
+ * stream into one WAV file per transmission. The boundaries are the PTT
+ * edges the monitor loop already makes, and the last PreRoll ms of audio
+ * before each key up are kept in a ring buffer so the start of the first
+ * word isn't lost.
+ *
+ * Audio always goes through the ring, and while a transmission is in
+ * progress it is also copied into an aligned 64 KiB buffer that is
+ * written with one write() when it fills. Finishing a file is one short
+ * write and a 44 byte header patch, done between two audio reads, so no
+ * input is lost while it happens; any bytes a write fails to take are
+ * counted as dropped.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "segment.h"
+
+int segment_init(segmenter * s, const char * dir, int rate, int preroll_ms)
+{
+	void * buf;
+
+	memset(s, 0x00, sizeof(segmenter));
+	strncpy(s->dir, dir, sizeof(s->dir) - 1);
+	s->rate = rate;
+	s->fd = -1;
+
+	s->ring_len = (int)((long)rate * preroll_ms / 1000);
+	if (s->ring_len < 1)
+		s->ring_len = 1;
+	s->ring = (short *)calloc(s->ring_len, sizeof(short));
+
+	if (posix_memalign(&buf, SEG_ALIGN, SEG_BUFSIZE) != 0)
+		buf = NULL;
+	s->buf = (unsigned char *)buf;
+
+	if (s->ring == NULL || s->buf == NULL)
+		return(-1);
+	return(0);
+}
+
+static void put_le32(unsigned char * p, unsigned long v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = (v >> 24) & 0xFF;
+}
+
+static void put_le16(unsigned char * p, unsigned int v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+/* Build a 16 bit mono PCM WAV header for 'data_bytes' of audio */
+static void wav_header(unsigned char * h, int rate, unsigned long data_bytes)
+{
+	memcpy(h, "RIFF", 4);
+	put_le32(h + 4, 36 + data_bytes);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le32(h + 16, 16);			// fmt chunk size
+	put_le16(h + 20, 1);			// PCM
+	put_le16(h + 22, 1);			// mono
+	put_le32(h + 24, rate);
+	put_le32(h + 28, rate * 2);		// byte rate
+	put_le16(h + 32, 2);			// block align
+	put_le16(h + 34, 16);			// bits per sample
+	memcpy(h + 36, "data", 4);
+	put_le32(h + 40, data_bytes);
+}
+
+static void segment_flush(segmenter * s)
+{
+	struct timespec t0;
+	struct timespec t1;
+	ssize_t n;
+
+	if (s->buf_used == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n = write(s->fd, s->buf, s->buf_used);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	s->writes++;
+	s->write_time += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	if (n < 0)
+		n = 0;
+	if (n < s->buf_used)
+		s->dropped += (s->buf_used - n) / 2;
+	s->buf_used = 0;
+}
+
+/* Append samples to the current recording */
+static void segment_write(segmenter * s, const short * pcm, int count)
+{
+	unsigned char * p;
+	int i;
+
+	if (s->fd < 0)
+	{
+		s->dropped += count;
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (s->buf_used + 2 > SEG_BUFSIZE)
+			segment_flush(s);
+		p = s->buf + s->buf_used;
+		p[0] = pcm[i] & 0xFF;
+		p[1] = (pcm[i] >> 8) & 0xFF;
+		s->buf_used += 2;
+	}
+	s->data_bytes += count * 2;
+	s->samples_out += count;
+}
+
+void segment_feed(segmenter * s, const short * pcm, int count)
+{
+	int i;
+
+	s->samples_in += count;
+
+	if (s->active)
+		segment_write(s, pcm, count);
+
+	for (i = 0; i < count; i++)
+	{
+		s->ring[s->ring_head] = pcm[i];
+		if (++s->ring_head >= s->ring_len)
+			s->ring_head = 0;
+	}
+	s->ring_fill += count;
+	if (s->ring_fill > s->ring_len)
+		s->ring_fill = s->ring_len;
+}
+
+static void segment_start(segmenter * s)
+{
+	struct timespec ts;
+	struct tm tm;
+	char stamp[32];
+	int start;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(s->name, sizeof(s->name), "%s/ptt-%s-%03ld.wav",
+		s->dir, stamp, ts.tv_nsec / 1000000);
+
+	s->fd = open(s->name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	s->active = 1;
+	s->data_bytes = 0;
+	s->buf_used = 0;
+
+	/* Header placeholder, patched with the real sizes at the end */
+	if (s->fd >= 0)
+	{
+		wav_header(s->buf, s->rate, 0);
+		s->buf_used = SEG_WAV_HEADER;
+	}
+
+	/* The pre-roll, oldest sample first */
+	start = s->ring_head - s->ring_fill;
+	if (start < 0)
+	{
+		segment_write(s, s->ring + s->ring_len + start, -start);
+		segment_write(s, s->ring, s->ring_head);
+	}
+	else
+		segment_write(s, s->ring + start, s->ring_fill);
+}
+
+static void segment_finish(segmenter * s)
+{
+	unsigned char h[SEG_WAV_HEADER];
+
+	s->active = 0;
+	if (s->fd < 0)
+		return;
+
+	segment_flush(s);
+	wav_header(h, s->rate, s->data_bytes);
+	if (pwrite(s->fd, h, sizeof(h), 0) != sizeof(h))
+		s->dropped += s->data_bytes / 2;
+	close(s->fd);
+	s->fd = -1;
+	s->files++;
+}
+
+/* Called on every PTT edge, starts or finishes a recording */
+void segment_edge(segmenter * s, int active)
+{
+	if (active && !s->active)
+		segment_start(s);
+	else if (!active && s->active)
+		segment_finish(s);
+}
+
+/* Before an upgrade re-exec: write out what is buffered, leaving the
+ * recording open for the new binary to adopt.
+ */
+void segment_detach(segmenter * s)
+{
+	if (s->fd >= 0)
+		segment_flush(s);
+}
+
+/* After an upgrade re-exec: carry on with the old binary's recording.
+ * The pre-roll audio does not survive, the recording does.
+ */
+void segment_adopt(segmenter * s, const segmenter * old)
+{
+	s->active = old->active;
+	s->fd = old->fd;
+	s->data_bytes = old->data_bytes;
+	memcpy(s->name, old->name, sizeof(s->name));
+	s->files = old->files;
+	s->samples_in = old->samples_in;
+	s->samples_out = old->samples_out;
+	s->dropped = old->dropped;
+	s->writes = old->writes;
+	s->write_time = old->write_time;
+}
+
+void segment_close(segmenter * s)
+{
+	segment_finish(s);
+	free(s->ring);
+	free(s->buf);
+	s->ring = NULL;
+	s->buf = NULL;
+}
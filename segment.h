@@ -0,0 +1,51 @@
+/* segment.h - Per-transmission audio recorder driven by COR/PTT edges.
+
+*/
+
+#ifndef __SEGMENT_H__
+#define __SEGMENT_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEF_SEG_PREROLL		500			// Audio kept from before the edge (ms)
+#define SEG_BUFSIZE			(64 * 1024)	// Write buffer, written in one write()
+#define SEG_ALIGN			4096		// Write buffer alignment
+#define SEG_WAV_HEADER		44			// Bytes of WAV header per file
+
+typedef struct
+{
+	char dir[256];				// Directory the recordings go in
+	int rate;					// Sample rate (Hz)
+	short * ring;				// Pre-roll ring buffer
+	int ring_len;				// Ring size in samples
+	int ring_head;				// Next ring slot to write
+	int ring_fill;				// Samples in the ring
+	unsigned char * buf;		// Aligned write buffer
+	int buf_used;				// Bytes in the write buffer
+	int active;					// A transmission is in progress
+	int fd;						// Current recording, -1 if none
+	unsigned long data_bytes;	// PCM bytes in the current recording
+	char name[320];				// Current recording file name
+	unsigned long files;		// Recordings finished
+	unsigned long samples_in;	// Samples fed in
+	unsigned long samples_out;	// Samples written to recordings
+	unsigned long dropped;		// Samples lost to failed writes
+	unsigned long writes;		// write() calls
+	double write_time;			// Seconds spent in write()
+} segmenter;
+
+int segment_init(segmenter * s, const char * dir, int rate, int preroll_ms);
+void segment_feed(segmenter * s, const short * pcm, int count);
+void segment_edge(segmenter * s, int active);
+void segment_detach(segmenter * s);
+void segment_adopt(segmenter * s, const segmenter * old);
+void segment_close(segmenter * s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SEGMENT_H__ */
@@ -0,0 +1,103 @@
+/* shiftreg.c - Shift register output expansion bit-banged on the MCR.
+ *
+ * A port's MCR has only two outputs on the connector. With a [SHIFTREG]
+ * section, DTR carries serial data and RTS the shift clock into a chain
+ * of 74HC595 style shift registers, and OUT1 (or a DTR or RTS line on
+ * another port) is the storage register latch, so one port drives up to
+ * 64 outputs. Output lines with line=SR and bit=<n> are set in an image
+ * of the chain like any other output, in the period's flush.
+ *
+ * The chain is only shifted when the image differs from what was last
+ * latched. A refresh shifts every bit, highest first so bit 0 ends up on
+ * the first register's QA, with one outb() setting the data with the
+ * clock low and one raising the clock, then pulses the latch, so the
+ * outputs all change together. That is 2 * bits + 3 outb()s back to
+ * back; on a real UART each takes around a microsecond, which sets the
+ * pace. The monitor report gives the refreshes, their rate and the time
+ * each took.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/io.h>
+
+#include "shiftreg.h"
+
+void sr_init(shift_reg * s, int bits, int mcr, int latch_mcr, unsigned char latch_bit,
+	unsigned char mcr_mask, unsigned char latch_mask)
+{
+	memset(s, 0x00, sizeof(shift_reg));
+	s->bits = bits > SR_MAX_BITS ? SR_MAX_BITS : bits;
+	s->mcr = mcr;
+	s->latch_mcr = latch_mcr;
+	s->latch_bit = latch_bit;
+	s->mcr_mask = mcr_mask;
+	s->latch_mask = latch_mask;
+}
+
+void sr_set(shift_reg * s, int bit, int on)
+{
+	if (on)
+		s->image |= 1ULL << bit;
+	else
+		s->image &= ~(1ULL << bit);
+}
+
+int sr_dirty(const shift_reg * s)
+{
+	return(!s->valid || s->image != s->shifted);
+}
+
+static long long now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return(t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+/* Shift out and latch the whole image. '*mcr' and '*latch' are the
+ * values of the two MCRs, the same byte if the latch is OUT1, and are
+ * left at what was last written. Like any other MCR write, only the bits
+ * in the UART's mask are written. Returns the time it took.
+ */
+long long sr_shift(shift_reg * s, unsigned char * mcr, unsigned char * latch)
+{
+	long long t0 = now_ns();
+	long long t;
+	unsigned char v = *mcr & s->mcr_mask & ~(SR_DATA | SR_CLOCK);
+	int i;
+
+	for (i = s->bits - 1; i >= 0; i--)
+	{
+		if ((s->image >> i) & 1)
+			v |= SR_DATA;
+		else
+			v &= ~SR_DATA;
+		outb(v, s->mcr);
+		outb(v | SR_CLOCK, s->mcr);
+	}
+	outb(v, s->mcr);
+	*mcr = v;
+
+	/* Storage registers take the shifted bits on the rising edge */
+	outb((*latch | s->latch_bit) & s->latch_mask, s->latch_mcr);
+	outb(*latch & ~s->latch_bit & s->latch_mask, s->latch_mcr);
+	*latch &= ~s->latch_bit & s->latch_mask;
+
+	s->shifted = s->image;
+	s->valid = TRUE;
+	t = now_ns() - t0;
+	s->updates++;
+	s->writes += 2 * s->bits + 3;
+	s->time_sum += t;
+	if (t > s->time_max)
+		s->time_max = t;
+	return(t);
+}
@@ -0,0 +1,47 @@
+/* shiftreg.h - Shift register output expansion bit-banged on the MCR.
+
+*/
+
+#ifndef __SHIFTREG_H__
+#define __SHIFTREG_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+#define SR_MAX_BITS			64			// Outputs in one chain
+#define SR_DATA				DTR_MASK	// Serial data
+#define SR_CLOCK			RTS_MASK	// Shift clock, rising edge
+#define SR_OUT1				0x04		// MCR OUT1, the default latch
+
+typedef struct
+{
+	int bits;					// Outputs in the chain
+	int mcr;					// Data and clock MCR IO address
+	int latch_mcr;				// Latch MCR IO address
+	unsigned char latch_bit;	// Latch MCR bit
+	unsigned char mcr_mask;		// MCR bits kept on write, data and clock port
+	unsigned char latch_mask;	// MCR bits kept on write, latch port
+	unsigned long long image;	// Outputs as wanted, bit n is output n
+	unsigned long long shifted;	// Outputs as last latched
+	int valid;					// 'shifted' is what the registers hold
+	unsigned long updates;		// Refreshes
+	unsigned long writes;		// outb()s
+	long long time_max;			// Longest refresh (ns)
+	long long time_sum;
+} shift_reg;
+
+void sr_init(shift_reg * s, int bits, int mcr, int latch_mcr, unsigned char latch_bit,
+	unsigned char mcr_mask, unsigned char latch_mask);
+void sr_set(shift_reg * s, int bit, int on);
+int sr_dirty(const shift_reg * s);
+long long sr_shift(shift_reg * s, unsigned char * mcr, unsigned char * latch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SHIFTREG_H__ */
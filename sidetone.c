@@ -0,0 +1,244 @@
+/* sidetone.c - CW sidetone PCM stream aligned to the key line's edges.
+ *
+ * With Sidetone= in [WINKEY] the monitor writes a sidetone for the CW
+ * key line as raw S16_LE mono PCM to a file, a FIFO or stdout, e.g. for
+ *
+ *   ptt --monitor | aplay -q -t raw -f S16_LE -r 8000
+ *
+ * The stream runs continuously at the sample rate, sample n standing for
+ * the time the stream was opened plus n sample periods. Each edge of the
+ * key line is stamped when its MCR write has been done, and the tone
+ * starts or stops on the sample for that time, so the audio lines up with
+ * what the port did rather than with when the keyer asked for it. The
+ * monitor generates the samples up to the present after every flush, and
+ * wakes at least every SIDETONE_PERIOD_MS to keep the stream going.
+ *
+ * The oscillator is a phase accumulator into a 1024 entry sine table, and
+ * each rise and fall follows a raised cosine table, so a sample costs a
+ * table read and, while ramping, one multiply. A reader that falls behind
+ * loses samples rather than holding up the monitor.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "pcm.h"
+#include "sidetone.h"
+
+static long long mono_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return(t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+/* Index of the sample at 'ns', without overflowing on long runs */
+static long long ns_to_sample(const sidetone * st, long long ns)
+{
+	ns -= st->t0_ns;
+	if (ns < 0)
+		return(0);
+	return((ns / 1000000000LL) * st->rate + (ns % 1000000000LL) * st->rate / 1000000000LL);
+}
+
+/* Open the output, NULL for none, and start the stream at 'now_ns' */
+int sidetone_open(sidetone * st, const char * file, int tone_hz, int rate,
+	int rise_ms, long long now_ns)
+{
+	struct stat sb;
+	int i;
+
+	memset(st, 0x00, sizeof(sidetone));
+	st->rate = rate > 0 ? rate : DEF_AUDIO_RATE;
+	if (tone_hz <= 0)
+		tone_hz = DEF_SIDETONE_HZ;
+	if (rise_ms <= 0)
+		rise_ms = DEF_SIDETONE_RISE;
+	st->step = (unsigned int)((double)tone_hz / st->rate * 4294967296.0);
+	st->t0_ns = now_ns;
+
+	/* Half scale, room for whatever mixes it */
+	for (i = 0; i < (1 << SIDETONE_TABLE_BITS); i++)
+		st->sine[i] = (short)(16383.0 * sin(2.0 * M_PI * i / (1 << SIDETONE_TABLE_BITS)));
+
+	st->ramp_len = rise_ms * st->rate / 1000;
+	if (st->ramp_len < 1)
+		st->ramp_len = 1;
+	if (st->ramp_len > SIDETONE_MAX_RAMP)
+		st->ramp_len = SIDETONE_MAX_RAMP;
+	for (i = 0; i < st->ramp_len; i++)
+		st->ramp[i] = (short)(32767.0 * (1.0 - cos(M_PI * (i + 1) / st->ramp_len)) / 2.0);
+
+	st->fd = -1;
+	if (file == NULL)
+		return(0);
+	if (strcmp(file, "-") == 0)
+	{
+		/* The PCM has stdout to itself, the monitor's text goes to stderr */
+		st->fd = dup(1);
+		if (st->fd < 0 || dup2(2, 1) < 0)
+			return(-1);
+		signal(SIGPIPE, SIG_IGN);
+	}
+	else if (stat(file, &sb) == 0 && S_ISFIFO(sb.st_mode))
+		/* Read-write, so there is no waiting for a reader and no SIGPIPE */
+		st->fd = open(file, O_RDWR);
+	else
+		st->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (st->fd < 0)
+		return(-1);
+	fcntl(st->fd, F_SETFL, fcntl(st->fd, F_GETFL) | O_NONBLOCK);
+	return(0);
+}
+
+/* The key line changed, its MCR write was done at 'edge_ns' */
+void sidetone_edge(sidetone * st, int key, long long edge_ns)
+{
+	tone_edge * e;
+
+	if (key == st->key_set)
+		return;
+	st->key_set = key;
+	if (st->n_edges >= SIDETONE_EDGES)
+		return;
+	e = &st->edges[st->n_edges++];
+	e->index = ns_to_sample(st, edge_ns);
+	e->ns = edge_ns;
+	e->key = key;
+}
+
+/* Generate and write every sample up to 'now_ns' */
+void sidetone_fill(sidetone * st, long long now_ns)
+{
+	short buf[SIDETONE_CHUNK];
+	long long done[SIDETONE_EDGES];
+	long long end = ns_to_sample(st, now_ns);
+	long long t;
+	int n_done;
+	int count;
+	int wrote;
+	int s;
+	int i;
+
+	/* After a stall, skip to a tenth of a second ago rather than
+	 * pour out the backlog
+	 */
+	if (end - st->n > st->rate)
+	{
+		st->n = end - st->rate / 10;
+		st->gaps++;
+	}
+
+	while (st->n < end)
+	{
+		count = end - st->n > SIDETONE_CHUNK ? SIDETONE_CHUNK : end - st->n;
+		n_done = 0;
+		for (i = 0; i < count; i++)
+		{
+			while (st->n_edges > 0 && st->edges[0].index <= st->n + i)
+			{
+				st->key = st->edges[0].key;
+				done[n_done++] = st->edges[0].ns;
+				st->n_edges--;
+				memmove(&st->edges[0], &st->edges[1], st->n_edges * sizeof(tone_edge));
+			}
+
+			if (st->key)
+			{
+				if (st->env < st->ramp_len)
+					st->env++;
+			}
+			else if (st->env > 0)
+				st->env--;
+			if (st->env == 0)
+			{
+				buf[i] = 0;
+				continue;
+			}
+
+			s = st->sine[st->phase >> (32 - SIDETONE_TABLE_BITS)];
+			if (st->env < st->ramp_len)
+				s = s * st->ramp[st->env - 1] >> 15;
+			buf[i] = s;
+			st->phase += st->step;
+		}
+		st->n += count;
+
+		if (st->fd < 0)
+			continue;
+		wrote = write(st->fd, buf, count * sizeof(short));
+		if (wrote < 0)
+			wrote = 0;
+		st->written += wrote / sizeof(short);
+		st->dropped += count - wrote / sizeof(short);
+
+		t = mono_ns();
+		for (i = 0; i < n_done; i++)
+		{
+			st->n_written++;
+			st->lat_sum += t - done[i];
+			if (t - done[i] > st->lat_max)
+				st->lat_max = t - done[i];
+		}
+	}
+}
+
+/* When the stream next needs topping up */
+long long sidetone_next(const sidetone * st)
+{
+	return(st->t0_ns + (st->n / st->rate) * 1000000000LL +
+		(st->n % st->rate) * 1000000000LL / st->rate + SIDETONE_PERIOD_MS * 1000000LL);
+}
+
+void sidetone_close(sidetone * st)
+{
+	if (st->fd >= 0)
+		close(st->fd);
+	st->fd = -1;
+}
+
+/* Generate 'seconds' of 25 wpm dits without writing them, to see how
+ * far ahead of real time the oscillator runs
+ */
+int sidetone_bench(int seconds, int tone_hz, int rate, int rise_ms)
+{
+	static sidetone st;
+	long long dit = 1200000000LL / 25;
+	long long end = seconds * 1000000000LL;
+	long long t0;
+	long long t1;
+	long long t;
+	int key = 0;
+
+	if (seconds <= 0)
+		return(-1);
+	sidetone_open(&st, NULL, tone_hz, rate, rise_ms, 0);
+
+	t0 = mono_ns();
+	for (t = 0; t < end; t += dit)
+	{
+		key = !key;
+		sidetone_edge(&st, key, t);
+		sidetone_fill(&st, t + dit);
+	}
+	t1 = mono_ns();
+
+	printf("Sidetone: %d Hz at %d samples/s, %d sample rise and fall\n",
+		tone_hz > 0 ? tone_hz : DEF_SIDETONE_HZ, st.rate, st.ramp_len);
+	printf("  %lld samples (%d s) in %.3f ms, %.1f ns/sample, %.0fx real time\n",
+		st.n, seconds, (t1 - t0) / 1e6, (double)(t1 - t0) / st.n,
+		seconds * 1e9 / (t1 - t0));
+	return(0);
+}
@@ -0,0 +1,66 @@
+/* sidetone.h - CW sidetone PCM stream aligned to the key line's edges.
+
+*/
+
+#ifndef __SIDETONE_H__
+#define __SIDETONE_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+
+#define SIDETONE_TABLE_BITS	10			// Sine table of 1024 entries
+#define SIDETONE_MAX_RAMP	1024		// Longest rise or fall (samples)
+#define SIDETONE_CHUNK		512			// Samples per write()
+#define SIDETONE_EDGES		16			// Edges waiting to be generated
+#define SIDETONE_PERIOD_MS	10			// Longest time between writes
+#define DEF_SIDETONE_HZ		600
+#define DEF_SIDETONE_RISE	5			// Rise and fall time (ms)
+
+typedef struct
+{
+	long long index;			// Sample the edge falls on
+	long long ns;				// When the MCR was written
+	int key;					// New key level
+} tone_edge;
+
+typedef struct
+{
+	int fd;						// S16_LE mono output, -1 to only count
+	int rate;					// Samples per second
+	long long t0_ns;			// Time of sample 0, CLOCK_MONOTONIC
+	long long n;				// Samples generated
+	unsigned int phase;			// Oscillator phase, a full turn is 2^32
+	unsigned int step;			// Phase step per sample
+	short sine[1 << SIDETONE_TABLE_BITS];
+	short ramp[SIDETONE_MAX_RAMP];	// Raised cosine, up to full scale
+	int ramp_len;
+	int env;					// Place on the ramp, 0 silent, ramp_len full
+	int key;					// Key level being generated
+	int key_set;				// Key level last passed in
+	tone_edge edges[SIDETONE_EDGES];
+	int n_edges;
+	unsigned long n_written;	// Edges whose first sample has been written
+	long long lat_max;			// Worst edge to write() of its sample (ns)
+	long long lat_sum;
+	unsigned long long written;	// Samples written
+	unsigned long long dropped;	// Samples the reader didn't take
+	unsigned long gaps;			// Times the stream skipped ahead
+} sidetone;
+
+int sidetone_open(sidetone * st, const char * file, int tone_hz, int rate,
+	int rise_ms, long long now_ns);
+void sidetone_edge(sidetone * st, int key, long long edge_ns);
+void sidetone_fill(sidetone * st, long long now_ns);
+long long sidetone_next(const sidetone * st);
+void sidetone_close(sidetone * st);
+int sidetone_bench(int seconds, int tone_hz, int rate, int rise_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIDETONE_H__ */
@@ -0,0 +1,281 @@
+/* standby.c - Hot standby: shared line state, lease and takeover.
+ *
+ * A monitor mode ptt with a [STANDBY] section is the primary. It keeps a
+ * small block of POSIX shared memory up to date with the MCR image it
+ * last wrote to every port it drives, and the same image with its PTT and
+ * PULSE outputs released, and renews a lease there every sample period.
+ *
+ * ptt --standby runs the same config as a second process that only
+ * watches the lease. If the lease runs out, or the primary's process is
+ * gone, it takes ownership with a compare and swap and writes every port
+ * from shared memory, either as the primary left it (Failover=ASSERT) or
+ * with the keyed outputs released (Failover=SAFE). It needs nothing from
+ * the hardware to do that, the addresses and the UART masks are in the
+ * shared block too. It then carries on as the primary.
+ *
+ * A primary that was only stalled, not dead, finds the lease taken at its
+ * next renewal and exits without touching the lines again.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ptt.h"
+#include "histlog.h"
+#include "monitor.h"
+#include "standby.h"
+
+static volatile sig_atomic_t waiting;
+static hist_writer hist;
+
+static void on_stop(int sig)
+{
+	(void)sig;
+	waiting = 0;
+}
+
+long long mono_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return(now.tv_sec * 1000000000LL + now.tv_nsec);
+}
+
+/* Map the shared block, creating it if asked to. Primary and standby
+ * can start in either order.
+ */
+standby_shm * standby_attach(const char * name, int create)
+{
+	standby_shm * s;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0600);
+	if (fd < 0)
+		return(NULL);
+
+	if (fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(standby_shm))
+		if (ftruncate(fd, sizeof(standby_shm)) != 0)
+		{
+			close(fd);
+			return(NULL);
+		}
+
+	s = (standby_shm *)mmap(NULL, sizeof(standby_shm), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	return(s == MAP_FAILED ? NULL : s);
+}
+
+/* Is the lease held by a live process other than us */
+static int lease_held(standby_shm * s, pid_t owner, long long now)
+{
+	if (owner == 0 || owner == getpid())
+		return(FALSE);
+	if (kill(owner, 0) != 0 && errno == ESRCH)
+		return(FALSE);
+	return(now <= __atomic_load_n(&s->lease_ns, __ATOMIC_ACQUIRE));
+}
+
+/* Take the lease, unless a live process holds it. Returns 0 on success */
+int standby_claim(standby_shm * s, int lease_ms)
+{
+	pid_t owner = __atomic_load_n(&s->owner, __ATOMIC_ACQUIRE);
+	long long now = mono_now_ns();
+
+	if (lease_held(s, owner, now))
+		return(-1);
+	if (!__atomic_compare_exchange_n(&s->owner, &owner, getpid(), 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return(-1);
+
+	s->renewed_ns = now;
+	__atomic_store_n(&s->lease_ns, now + lease_ms * 1000000LL, __ATOMIC_RELEASE);
+	s->magic = STANDBY_MAGIC;
+	return(0);
+}
+
+/* Extend the lease. Returns -1 if it has been taken from us */
+int standby_renew(standby_shm * s, int lease_ms)
+{
+	long long now = mono_now_ns();
+
+	if (__atomic_load_n(&s->owner, __ATOMIC_ACQUIRE) != getpid())
+		return(-1);
+	s->renewed_ns = now;
+	__atomic_store_n(&s->lease_ns, now + lease_ms * 1000000LL, __ATOMIC_RELEASE);
+	return(0);
+}
+
+/* Stopping on purpose: let the standby in straight away */
+void standby_release(standby_shm * s)
+{
+	if (__atomic_load_n(&s->owner, __ATOMIC_ACQUIRE) == getpid())
+		__atomic_store_n(&s->lease_ns, 0LL, __ATOMIC_RELEASE);
+}
+
+int getFailoverMode(const char * mode)
+{
+	if (strcmp(mode, "SAFE") == 0)
+		return(FAILOVER_SAFE);
+	if (strcmp(mode, "ASSERT") == 0)
+		return(FAILOVER_ASSERT);
+	return(ERROR);
+}
+
+/* Get access to every port the primary drove, before taking the lease, so
+ * that nothing can stop the takeover once it is ours.
+ */
+static int takeover_access(standby_shm * s)
+{
+	int i;
+
+	for (i = 0; i < MAX_PORTS; i++)
+		if (s->ports[i].used && ioperm(s->ports[i].mcr, 1, ON) != 0)
+		{
+			printf("ptt: ioperm(0x%x) failed: %s\n", s->ports[i].mcr, strerror(errno));
+			return(FAIL);
+		}
+	return(PASS);
+}
+
+/* Write every port the primary drove from the shared block */
+static void takeover_write(standby_shm * s, int policy)
+{
+	standby_port * sp;
+	unsigned char old_value;
+	unsigned char new_value;
+	int lock_fd;
+	int i;
+
+	/* The records go out once every port is written */
+	hist.fd = -1;
+	if (strlen(logfile) > 0)
+		hist_open(&hist, logfile);
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		sp = &s->ports[i];
+		if (!sp->used)
+			continue;
+
+		lock_fd = lock_port(sp->mcr);
+		old_value = inb(sp->mcr);
+		new_value = (policy == FAILOVER_ASSERT ? sp->shadow : sp->safe) & sp->mcr_mask;
+		outb(new_value, sp->mcr);
+		if (hist.fd >= 0)
+			hist_add(&hist, HIST_MCR, sp->mcr, 0, old_value, inb(sp->mcr));
+		unlock_port(lock_fd);
+	}
+	hist_close(&hist);
+}
+
+/* Poll every 'period' until the lease on 's' lapses, then take it. '*lease'
+ * gets the lease as it stood and '*seen' the time it was found lapsed.
+ * Returns the pid taken over from, 0 if we were stopped first or -1 if
+ * the ports can't be accessed, in which case the lease is left alone.
+ */
+pid_t standby_wait(standby_shm * s, int lease_ms, struct timespec * period,
+	long long * lease, long long * seen)
+{
+	pid_t owner;
+
+	waiting = 1;
+	while (waiting)
+	{
+		nanosleep(period, NULL);
+
+		/* Nothing to take over until a primary has set up */
+		owner = __atomic_load_n(&s->owner, __ATOMIC_ACQUIRE);
+		if (s->magic != STANDBY_MAGIC || owner == 0)
+			continue;
+
+		*seen = mono_now_ns();
+		if (lease_held(s, owner, *seen))
+			continue;
+
+		if (takeover_access(s) != PASS)
+			return(-1);
+		*lease = __atomic_load_n(&s->lease_ns, __ATOMIC_ACQUIRE);
+		if (!__atomic_compare_exchange_n(&s->owner, &owner, getpid(), 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+		__atomic_store_n(&s->lease_ns, *seen + lease_ms * 1000000LL, __ATOMIC_RELEASE);
+		return(owner);
+	}
+	return(0);
+}
+
+/* Wait for the primary's lease to lapse, take over the lines and run as
+ * the primary from then on.
+ */
+int standby_run(configuration * cfg, int verbose)
+{
+	standby_shm * s;
+	struct timespec period;
+	struct sigaction sa;
+	const char * name;
+	pid_t owner;
+	long long lease;
+	long long seen;
+	long long done;
+	int lease_ms;
+	int policy;
+
+	name = cfg->standby_name;
+	if (name == NULL)
+	{
+		printf("No [STANDBY] Name configured\n");
+		return(FAIL);
+	}
+	lease_ms = cfg->standby_lease > 0 ? cfg->standby_lease : DEF_STANDBY_LEASE;
+	policy = cfg->standby_policy;
+
+	s = standby_attach(name, TRUE);
+	if (s == NULL)
+	{
+		printf("Can't attach standby memory '%s': %s\n", name, strerror(errno));
+		return(FAIL);
+	}
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sa_handler = on_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	period.tv_sec = 0;
+	period.tv_nsec = (cfg->period_us > 0 ? cfg->period_us : DEF_PERIOD_US) * 1000L;
+
+	if (verbose)
+		printf("Standing by on '%s', lease %d ms, failover %s\n", name, lease_ms,
+			policy == FAILOVER_ASSERT ? "ASSERT" : "SAFE");
+
+	owner = standby_wait(s, lease_ms, &period, &lease, &seen);
+	if (owner == 0)
+		return(PASS);
+	if (owner < 0)
+		return(FAIL);
+
+	takeover_write(s, policy);
+	done = mono_now_ns();
+	s->takeovers++;
+
+	printf("Took over from pid %d (%s): lines written %.3f ms after its last renewal\n",
+		(int)owner, lease == 0 ? "released" : seen > lease ? "lease expired" : "process gone",
+		(done - s->renewed_ns) / 1e6);
+	fflush(stdout);
+
+	return(monitor_run(cfg, verbose, policy == FAILOVER_ASSERT ? s->cor : -1));
+}
@@ -0,0 +1,65 @@
+/* standby.h - Hot standby: shared line state, lease and takeover.
+
+*/
+
+#ifndef __STANDBY_H__
+#define __STANDBY_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+#include "ptt.h"
+
+#define STANDBY_MAGIC		0x50545453	// 'PTTS'
+#define DEF_STANDBY_LEASE	20			// Lease time (ms)
+
+/* What the standby does with the lines when it takes over */
+enum {
+	FAILOVER_SAFE,			// PTT and PULSE outputs off, the rest as they were
+	FAILOVER_ASSERT			// Every output as the primary last wrote it
+};
+
+typedef struct
+{
+	int used;					// Primary has lines on this port
+	int mcr;					// MCR IO address
+	unsigned char mcr_mask;		// MCR bits kept on write, from the UART type
+	unsigned char shadow;		// MCR as the primary last wrote it
+	unsigned char safe;			// MCR with the keyed outputs released
+} standby_port;
+
+/* Lives in POSIX shared memory, written by the primary only, except for
+ * 'owner' which the standby takes by compare and swap.
+ */
+typedef struct
+{
+	unsigned int magic;				// STANDBY_MAGIC once set up
+	pid_t owner;					// Process holding the lease
+	long long lease_ns;				// CLOCK_MONOTONIC time the lease runs out
+	long long renewed_ns;			// Last renewal
+	int cor;						// COR as the primary last drove it
+	unsigned long long sr_image;	// [SHIFTREG] chain as last latched
+	int sr_valid;					// 'sr_image' has been latched
+	standby_port ports[MAX_PORTS];
+	unsigned long takeovers;		// Takeovers so far
+} standby_shm;
+
+long long mono_now_ns(void);
+standby_shm * standby_attach(const char * name, int create);
+int standby_claim(standby_shm * s, int lease_ms);
+int standby_renew(standby_shm * s, int lease_ms);
+void standby_release(standby_shm * s);
+int getFailoverMode(const char * mode);
+pid_t standby_wait(standby_shm * s, int lease_ms, struct timespec * period,
+	long long * lease, long long * seen);
+int standby_run(configuration * cfg, int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STANDBY_H__ */
@@ -0,0 +1,238 @@
+/* status.c - Line state published under a seqlock for lock-free readers.
+ *
+ * Status queries and metrics scrapes want the state of every line, but
+ * should neither touch the UARTs nor hold up the monitor loop. Monitor
+ * mode publishes what it already knows each period into a block of POSIX
+ * shared memory: the MCR it last wrote to each port, the last MSR sample,
+ * the level of every line and when each of those last changed.
+ *
+ * The block is guarded by a seqlock. The monitor, the only writer, makes
+ * the sequence odd, updates the block and makes it even again, so it
+ * never waits for anyone. A reader copies the block and keeps the copy if
+ * the sequence was the same even number before and after; otherwise it
+ * was caught mid-update and tries again. Any number of readers can do
+ * this at once in well under a microsecond, and none of them can hold up
+ * the writer.
+ *
+ * ptt --status --fast reads the block. Plain ptt --status reads the MCR
+ * and MSR of each configured port from the hardware instead.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ptt.h"
+#include "uart.h"
+#include "standby.h"
+#include "status.h"
+
+/* Create the block for this monitor, in place of any earlier one */
+status_shm * status_create(const char * name)
+{
+	status_shm * s;
+	int fd;
+
+	/* A fresh object, so a monitor we replaced can't write into ours */
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return(NULL);
+	if (ftruncate(fd, sizeof(status_shm)) != 0)
+	{
+		close(fd);
+		return(NULL);
+	}
+
+	s = (status_shm *)mmap(NULL, sizeof(status_shm), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		return(NULL);
+
+	s->pid = getpid();
+	__atomic_store_n(&s->magic, STATUS_MAGIC, __ATOMIC_RELEASE);
+	return(s);
+}
+
+/* Start an update, readers retry until status_end() */
+void status_begin(status_shm * s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void status_end(status_shm * s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void status_remove(status_shm * s, const char * name)
+{
+	munmap(s, sizeof(status_shm));
+	shm_unlink(name);
+}
+
+/* Copy a consistent view of the block. Returns 0, or -1 if the writer
+ * kept it busy for STATUS_RETRIES tries.
+ */
+int status_read(const status_shm * s, status_shm * copy, int * retries)
+{
+	unsigned int seq;
+	int tries;
+
+	for (tries = 0; tries < STATUS_RETRIES; tries++)
+	{
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+		{
+			/* The writer may be waiting for our CPU to finish */
+			sched_yield();
+			continue;
+		}
+		memcpy(copy, (const void *)s, sizeof(status_shm));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+		{
+			*retries = tries;
+			return(0);
+		}
+	}
+	*retries = tries;
+	return(-1);
+}
+
+static void print_age(long long now, long long then)
+{
+	if (then <= 0)
+		printf("never");
+	else if (now - then < 1000000000LL)
+		printf("%.3f ms ago", (now - then) / 1e6);
+	else
+		printf("%.3f s ago", (now - then) / 1e9);
+}
+
+/* The published view, without going near the hardware */
+static int status_fast(configuration * cfg, int verbose)
+{
+	const char * name = cfg->status_name != NULL ? cfg->status_name : DEF_STATUS_NAME;
+	const status_shm * s;
+	status_shm view;
+	status_port * p;
+	status_line * l;
+	long long t0;
+	long long now;
+	int retries;
+	int fd;
+	int i;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		printf("No monitor status at '%s': %s\n", name, strerror(errno));
+		return(FAIL);
+	}
+	s = (const status_shm *)mmap(NULL, sizeof(status_shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		return(FAIL);
+
+	t0 = mono_now_ns();
+	i = status_read(s, &view, &retries);
+	now = mono_now_ns();
+	munmap((void *)s, sizeof(status_shm));
+	if (i != 0 || view.magic != STATUS_MAGIC)
+	{
+		printf("Monitor status at '%s' is not readable\n", name);
+		return(FAIL);
+	}
+
+	printf("Monitor pid %d%s, updated ", (int)view.pid,
+		kill(view.pid, 0) != 0 && errno == ESRCH ? " (not running)" : "");
+	print_age(now, view.updated_ns);
+	printf(", COR %s%s%s\n", view.cor ? "ON" : "OFF",
+		view.estop ? ", E-stop active" : "", view.panicked ? ", panic holding" : "");
+
+	for (i = 0; i < MAX_PORTS; i++)
+	{
+		p = &view.ports[i];
+		if (!p->used)
+			continue;
+		printf("Port %d (0x%04X): MCR 0x%02X written ", i, p->mcr, p->shadow);
+		print_age(now, p->written_ns);
+		if (p->sampled)
+		{
+			printf(", MSR 0x%02X sampled ", p->msr);
+			print_age(now, p->sampled_ns);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < view.n_lines && i < MAX_LINES; i++)
+	{
+		l = &view.lines[i];
+		printf("%s '%s': ", l->section, l->name);
+		if (l->port >= 0)
+			printf("port %d %s ", l->port, getLineName(l->line));
+		else
+			printf("input device ");
+		printf("%s %s: %s since ", l->output ? "OUT" : "IN", getStateName(l->state),
+			l->level ? "ON" : "OFF");
+		print_age(now, l->changed_ns);
+		printf("\n");
+	}
+
+	if (verbose)
+		printf("Read in %lld ns, %d retries\n", now - t0, retries);
+	return(PASS);
+}
+
+/* Straight from the UARTs of every port the config names */
+static int status_hw(configuration * cfg, int verbose)
+{
+	int seen[MAX_PORTS];
+	line_def * ld;
+	int base;
+	int i;
+
+	memset(seen, 0x00, sizeof(seen));
+	for (i = 0; i < cfg->line_count; i++)
+	{
+		ld = &cfg->lines[i];
+		if (ld->device[0] != '\0' || seen[ld->port])
+			continue;
+		seen[ld->port] = TRUE;
+
+		base = getPortAddress(ld->port);
+		if (ioperm((base + MCR_ADDR_OFFSET) & IO_MASK, 3, ON) != 0)
+		{
+			printf("ptt: ioperm(0x%x) failed: %s\n", base + MCR_ADDR_OFFSET, strerror(errno));
+			return(FAIL);
+		}
+		printf("Port %d (0x%04X): MCR 0x%02X, MSR 0x%02X\n", ld->port,
+			(base + MCR_ADDR_OFFSET) & IO_MASK,
+			inb((base + MCR_ADDR_OFFSET) & IO_MASK), inb(base + UART_MSR));
+	}
+	if (verbose)
+		printf("Use --status --fast for line levels from a running monitor\n");
+	return(PASS);
+}
+
+int status_run(configuration * cfg, int fast, int verbose)
+{
+	if (fast)
+		return(status_fast(cfg, verbose));
+	return(status_hw(cfg, verbose));
+}
@@ -0,0 +1,73 @@
+/* status.h - Line state published under a seqlock for lock-free readers.
+
+*/
+
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+#include "ptt.h"
+
+#define STATUS_MAGIC		0x50545451	// 'PTTQ'
+#define DEF_STATUS_NAME		"/ptt-status"
+#define STATUS_RETRIES		1000		// Reader gives up after this many
+
+typedef struct
+{
+	int used;					// Monitor has lines on this port
+	int mcr;					// MCR IO address
+	unsigned char shadow;		// MCR as last written
+	unsigned char msr;			// Last MSR sample, 0 if not sampled
+	int sampled;				// The MSR is sampled
+	long long written_ns;		// Last MCR write (CLOCK_MONOTONIC)
+	long long sampled_ns;		// Last MSR sample
+} status_port;
+
+typedef struct
+{
+	char section[32];			// [LINEn]
+	char name[64];				// name=
+	int port;					// Port number, -1 for an input device
+	int line;					// LINE_xxx
+	int output;					// An output, else an input
+	int state;					// STATE_xxx
+	int level;					// Input: filtered level, output: as driven
+	long long changed_ns;		// Last change of 'level'
+} status_line;
+
+/* Lives in POSIX shared memory, written by the monitor only. 'seq' is
+ * odd while a write is in progress; a reader copies the block and keeps
+ * the copy only if 'seq' was the same even number before and after.
+ */
+typedef struct
+{
+	unsigned int magic;			// STATUS_MAGIC once set up
+	pid_t pid;					// Monitor publishing it
+	unsigned int seq;			// Seqlock sequence
+	long long updated_ns;		// Last update
+	int cor;					// COR as last driven
+	int estop;					// E-stop active
+	int panicked;				// Signalled panic holding
+	status_port ports[MAX_PORTS];
+	int n_lines;
+	status_line lines[MAX_LINES];
+} status_shm;
+
+status_shm * status_create(const char * name);
+void status_begin(status_shm * s);
+void status_end(status_shm * s);
+void status_remove(status_shm * s, const char * name);
+int status_read(const status_shm * s, status_shm * copy, int * retries);
+int status_run(configuration * cfg, int fast, int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STATUS_H__ */
@@ -0,0 +1,43 @@
+/* test.h - Hardware-free checks of the monitor mode building blocks.
+
+*/
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+extern int checks;				// Checks made so far
+extern int failures;			// Checks that failed
+
+/* Count a check, report it if it fails, carry on either way */
+#define CHECK(cond) \
+	do { \
+		checks++; \
+		if (!(cond)) \
+		{ \
+			failures++; \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while (0)
+
+void test_debounce(void);
+void test_segment(void);
+void test_timer(void);
+void test_evdev(void);
+void test_rules(void);
+void test_band(void);
+void test_histlog(void);
+void test_ctcss(void);
+void test_standby(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TEST_H__ */
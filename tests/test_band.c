@@ -0,0 +1,179 @@
+/* test_band.c - Band decoder against a rigctld that goes away.
+ *
+ * A listening socket on the loopback stands in for rigctld. The decoder
+ * has to ask for the frequency, follow the band it answers with, notice
+ * the rigctld closing the connection without spinning or dying of
+ * SIGPIPE, and reconnect after its backoff when the rigctld is back.
+ * A FIFO source has to keep working, and keep polling quiet rather than
+ * hung up, from one writer to the next.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "ptt.h"
+#include "band.h"
+#include "test.h"
+
+#define MS	1000000LL
+
+/* What the decoder sent, waiting a little for it to arrive */
+static int heard(int fd, const char * what)
+{
+	char buf[64];
+	struct timeval tv = { 1, 0 };
+	int len;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len <= 0)
+		return(0);
+	buf[len] = '\0';
+	return(strcmp(buf, what) == 0);
+}
+
+/* Poll until the answer is in, the loopback is quick but not instant */
+static int poll_for(band_decoder * d, long long now_ns)
+{
+	int changed = 0;
+	int i;
+
+	for (i = 0; i < 100 && !changed; i++)
+	{
+		changed = band_poll(d, now_ns);
+		usleep(1000);
+	}
+	return(changed);
+}
+
+/* One writer after another, as a rig control script restarting would */
+static void test_fifo(const band_def * table)
+{
+	char path[] = "/tmp/ptt-test-XXXXXX";
+	char fifo[64];
+	band_decoder d;
+	struct pollfd pfd;
+	int wfd;
+
+	CHECK(mkdtemp(path) != NULL);
+	snprintf(fifo, sizeof(fifo), "%s/freq", path);
+	CHECK(mkfifo(fifo, 0600) == 0);
+	CHECK(band_open(&d, fifo, 0, table, 2, 0) == 0);
+	CHECK(band_due(&d) == 0);
+
+	wfd = open(fifo, O_WRONLY);
+	CHECK(write(wfd, "14074000\n", 9) == 9);
+	close(wfd);
+	CHECK(band_poll(&d, 0) == 1);
+	CHECK(band_pattern(&d) == 0x5);
+
+	/* The writer has gone, nothing to read and no hang up either */
+	pfd.fd = d.fd;
+	pfd.events = POLLIN;
+	CHECK(poll(&pfd, 1, 0) == 0);
+
+	wfd = open(fifo, O_WRONLY);
+	CHECK(write(wfd, "7074000\n", 8) == 8);
+	CHECK(poll(&pfd, 1, 0) == 1 && pfd.revents == POLLIN);
+	close(wfd);
+	CHECK(band_poll(&d, 0) == 1);
+	CHECK(band_pattern(&d) == 0x3);
+
+	band_close(&d);
+	unlink(fifo);
+	rmdir(path);
+}
+
+static void test_rigctld(const band_def * table)
+{
+	band_decoder d;
+	struct sockaddr_in sa;
+	socklen_t sl = sizeof(sa);
+	char source[64];
+	long long now = 1000 * MS;
+	int lfd;
+	int cfd;
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	CHECK(bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+	CHECK(listen(lfd, 4) == 0);
+	getsockname(lfd, (struct sockaddr *)&sa, &sl);
+	snprintf(source, sizeof(source), "rigctld:127.0.0.1:%d", ntohs(sa.sin_port));
+
+	CHECK(band_open(&d, source, 100, table, 2, 0) == 0);
+	cfd = accept(lfd, NULL, NULL);
+	CHECK(cfd >= 0);
+
+	/* Asked at once, the answer sets the band */
+	CHECK(band_poll(&d, now) == 0);
+	CHECK(heard(cfd, "f\n"));
+	CHECK(write(cfd, "14074000\n", 9) == 9);
+	CHECK(poll_for(&d, now) == 1);
+	CHECK(band_pattern(&d) == 0x5);
+	CHECK(band_due(&d) == now + 100 * MS);
+
+	/* The rigctld goes away: one disconnect, a retry time, the band kept */
+	close(cfd);
+	now += 100 * MS;
+	poll_for(&d, now);
+	CHECK(d.disconnects == 1);
+	CHECK(d.fd < 0);
+	CHECK(band_due(&d) == now + BAND_RETRY_MIN * MS);
+	CHECK(band_pattern(&d) == 0x5);
+
+	/* Nothing happens before the retry time */
+	CHECK(band_poll(&d, now + 1 * MS) == 0);
+	CHECK(d.fd < 0);
+
+	/* Then it reconnects and asks again */
+	now += BAND_RETRY_MIN * MS;
+	band_poll(&d, now);
+	CHECK(d.fd >= 0);
+	cfd = accept(lfd, NULL, NULL);
+	CHECK(cfd >= 0);
+	CHECK(heard(cfd, "f\n"));
+	CHECK(write(cfd, "7074000\n", 8) == 8);
+	CHECK(poll_for(&d, now) == 1);
+	CHECK(band_pattern(&d) == 0x3);
+	CHECK(d.retry_ms == 0);
+
+	/* Nobody listening at all: the backoff doubles */
+	close(cfd);
+	close(lfd);
+	poll_for(&d, now);
+	CHECK(d.disconnects == 2);
+	now += BAND_RETRY_MIN * MS;
+	poll_for(&d, now);
+	poll_for(&d, now);
+	CHECK(d.fd < 0);
+	CHECK(d.retry_ms == 2 * BAND_RETRY_MIN);
+
+	band_close(&d);
+}
+
+void test_band(void)
+{
+	band_def table[2];
+
+	CHECK(band_parse(&table[0], "40m", "7000000-7300000,0x3") == PASS);
+	CHECK(band_parse(&table[1], "20m", "14000000-14350000,0x5") == PASS);
+	CHECK(band_compile(table, 2) == PASS);
+
+	test_rigctld(table);
+	test_fifo(table);
+}
@@ -0,0 +1,153 @@
+/* test_ctcss.c - CTCSS detector against synthetic receiver audio.
+ *
+ * Every EIA tone from 67 to 250.3 Hz is mixed under a voice-band signal
+ * several times its level, plus noise, at the 8 kHz rate a receiver's
+ * audio usually comes in at. The detector for the tone has to find it
+ * within one 150 ms window and hold it; the detectors for the standard
+ * tones either side of it, and voice with no tone at all, must never
+ * see a tone.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "ctcss.h"
+#include "test.h"
+
+#define RATE		8000
+#define CHUNK		80				// 10 ms, as the audio arrives
+#define RUN_MS		1000
+#define TONE_AMP	1000.0			// A fifth of the voice's RMS level
+#define DECIDE_MS	150				// One analysis window
+
+static const double tones[] = {
+	67.0, 69.3, 71.9, 74.4, 77.0, 79.7, 82.5, 85.4, 88.5, 91.5,
+	94.8, 97.4, 100.0, 103.5, 107.2, 110.9, 114.8, 118.8, 123.0, 127.3,
+	131.8, 136.5, 141.3, 146.2, 151.4, 156.7, 159.8, 162.2, 165.5, 167.9,
+	171.3, 173.8, 177.3, 179.9, 183.5, 186.2, 189.9, 192.8, 196.6, 199.5,
+	203.5, 206.5, 210.7, 218.1, 225.7, 229.1, 233.6, 241.8, 250.3
+};
+#define N_TONES		(int)(sizeof(tones) / sizeof(tones[0]))
+
+static unsigned int noise_seed;
+
+/* 'ms' of audio: a tone (none if 0) under voice-like partials whose
+ * levels wander at a syllable rate, and white noise
+ */
+static short * audio(double tone, int ms)
+{
+	static const double voice[] = { 320.0, 510.0, 730.0, 1150.0, 1720.0, 2430.0 };
+	int n = RATE * ms / 1000;
+	short * pcm;
+	double t;
+	double x;
+	int i;
+	int k;
+
+	pcm = (short *)malloc(n * sizeof(short));
+	for (i = 0; i < n; i++)
+	{
+		t = (double)i / RATE;
+		x = tone > 0.0 ? TONE_AMP * sin(2.0 * M_PI * tone * t) : 0.0;
+		for (k = 0; k < 6; k++)
+			x += 1500.0 * (1.0 + sin(2.0 * M_PI * (3.0 + k) * t)) *
+				sin(2.0 * M_PI * voice[k] * t + k);
+		noise_seed = noise_seed * 1103515245 + 12345;
+		x += (double)((noise_seed >> 16) & 0x7FF) - 1024.0;
+		pcm[i] = (short)x;
+	}
+	return(pcm);
+}
+
+/* Feed the audio in chunks, return the ms the tone was first present
+ * at (-1 if never), and the ms it was present for from then on
+ */
+static int run(ctcss * det, const short * pcm, int ms, int * held_ms)
+{
+	int first = -1;
+	int i;
+
+	*held_ms = 0;
+	for (i = 0; i < RATE * ms / 1000; i += CHUNK)
+	{
+		ctcss_feed(det, pcm + i, CHUNK);
+		if (det->present && first < 0)
+			first = (i + CHUNK) * 1000 / RATE;
+		if (det->present)
+			*held_ms += CHUNK * 1000 / RATE;
+	}
+	return(first);
+}
+
+void test_ctcss(void)
+{
+	ctcss det;
+	short * pcm;
+	int missed = 0;
+	int late = 0;
+	int dropped = 0;
+	int false_hits = 0;
+	int first;
+	int held;
+	int i;
+
+	noise_seed = 1;
+	for (i = 0; i < N_TONES; i++)
+	{
+		pcm = audio(tones[i], RUN_MS);
+
+		/* The tone itself: found within one window, then held */
+		ctcss_init(&det, RATE, tones[i], DEF_CTCSS_THRESHOLD, DEF_CTCSS_BLOCK);
+		first = run(&det, pcm, RUN_MS, &held);
+		if (first < 0)
+			missed++;
+		else if (first > DECIDE_MS)
+			late++;
+		else if (held != RUN_MS - first + CHUNK * 1000 / RATE)
+			dropped++;
+		if (first < 0 || first > DECIDE_MS || held != RUN_MS - first + CHUNK * 1000 / RATE)
+			printf("  %.1f Hz: first at %d ms, held %d ms\n", tones[i], first, held);
+
+		/* The standard tones either side of it must not qualify */
+		if (i > 0)
+		{
+			ctcss_init(&det, RATE, tones[i - 1], DEF_CTCSS_THRESHOLD, DEF_CTCSS_BLOCK);
+			if (run(&det, pcm, RUN_MS, &held) >= 0)
+			{
+				false_hits++;
+				printf("  %.1f Hz seen by the %.1f Hz detector\n", tones[i], tones[i - 1]);
+			}
+		}
+		if (i < N_TONES - 1)
+		{
+			ctcss_init(&det, RATE, tones[i + 1], DEF_CTCSS_THRESHOLD, DEF_CTCSS_BLOCK);
+			if (run(&det, pcm, RUN_MS, &held) >= 0)
+			{
+				false_hits++;
+				printf("  %.1f Hz seen by the %.1f Hz detector\n", tones[i], tones[i + 1]);
+			}
+		}
+		free(pcm);
+	}
+	CHECK(missed == 0);
+	CHECK(late == 0);
+	CHECK(dropped == 0);
+	CHECK(false_hits == 0);
+
+	/* Voice alone keys nothing */
+	pcm = audio(0.0, RUN_MS);
+	for (i = 0; i < N_TONES; i++)
+	{
+		ctcss_init(&det, RATE, tones[i], DEF_CTCSS_THRESHOLD, DEF_CTCSS_BLOCK);
+		if (run(&det, pcm, RUN_MS, &held) >= 0)
+			false_hits++;
+	}
+	CHECK(false_hits == 0);
+	free(pcm);
+}
@@ -0,0 +1,99 @@
+/* test_debounce.c - Debounce and glitch filter against synthetic bounce.
+ *
+ * A clean edge with contact bounce on it has to come out as one edge,
+ * the assert/release counts late; a glitch shorter than the counts has
+ * to come out as none. The integrator has to ride out isolated noise
+ * samples the counter would restart on, and a filter seeded with the
+ * line's current level must not report an edge for it.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "debounce.h"
+#include "test.h"
+
+/* Feed a string of '0'/'1' samples, return the sample the output first
+ * changed on, -1 if it never did.
+ */
+static int feed(debounce * db, const char * raw)
+{
+	int before = db->out;
+	int first = -1;
+	int i;
+
+	for (i = 0; raw[i] != '\0'; i++)
+		if (debounce_sample(db, raw[i] - '0') != before && first < 0)
+			first = i;
+	return(first);
+}
+
+static void test_counter(void)
+{
+	debounce db;
+
+	/* Bouncy press, then a bouncy release */
+	debounce_init(&db, FILTER_COUNTER, 3, 4, 0, 0);
+	CHECK(feed(&db, "0101101110111111") == 8);
+	CHECK(db.out == 1);
+	CHECK(db.edges == 1);
+	CHECK(feed(&db, "1010010001000000") == 13);
+	CHECK(db.out == 0);
+	CHECK(db.edges == 2);
+	CHECK(db.raw_edges == 14);
+
+	/* Glitches shorter than the assert count never get through */
+	debounce_init(&db, FILTER_COUNTER, 3, 3, 0, 0);
+	CHECK(feed(&db, "0110011000100110") == -1);
+	CHECK(db.edges == 0);
+
+	/* Minimum pulse: the release is held off until 5 samples after the press */
+	debounce_init(&db, FILTER_COUNTER, 1, 1, 5, 0);
+	CHECK(feed(&db, "1") == 0);
+	CHECK(feed(&db, "000000") == 4);
+	CHECK(db.edges == 2);
+}
+
+static void test_integrator(void)
+{
+	debounce db;
+
+	/* One noise sample in four slows the integrator, doesn't stop it */
+	debounce_init(&db, FILTER_INTEGRATOR, 4, 4, 0, 0);
+	CHECK(feed(&db, "1101111") == 5);
+	CHECK(db.edges == 1);
+
+	/* The counter restarts on the same noise and takes longer */
+	debounce_init(&db, FILTER_COUNTER, 4, 4, 0, 0);
+	CHECK(feed(&db, "1101111") == 6);
+
+	/* Noise that never wins a majority never gets through */
+	debounce_init(&db, FILTER_INTEGRATOR, 3, 3, 0, 0);
+	CHECK(feed(&db, "10101010100100010101") == -1);
+	CHECK(db.edges == 0);
+}
+
+/* A line already active when monitoring starts is no edge */
+static void test_seeded(void)
+{
+	debounce db;
+
+	debounce_init(&db, FILTER_COUNTER, 3, 3, 2, 1);
+	CHECK(feed(&db, "1111111111") == -1);
+	CHECK(db.edges == 0);
+	CHECK(db.raw_edges == 0);
+	CHECK(feed(&db, "000") == 2);
+	CHECK(db.edges == 1);
+}
+
+void test_debounce(void)
+{
+	test_counter();
+	test_integrator();
+	test_seeded();
+}
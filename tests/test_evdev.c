@@ -0,0 +1,262 @@
+/* test_evdev.c - Input device key events, from a pipe and from uinput.
+ *
+ * evdev_read() only needs a non-blocking fd that yields struct
+ * input_event, so a pipe stands in for /dev/input/eventN for the event
+ * handling: presses and releases of the configured key change the
+ * level, with the event's own time stamp; autorepeat, other keys and
+ * other event types don't; key=ANY is active while any key is down; a
+ * press and release read together still show as a press; and a closed
+ * writer reads as the device going away.
+ *
+ * Where /dev/uinput can be opened, the same is done through a real
+ * input device made with it, found by name and grabbed as ptt does, and
+ * a key held before the line is set up has to count as down.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "evdev.h"
+#include "test.h"
+
+#define KEY			KEY_F1
+#define UI_NAME		"ptt test footswitch"
+
+static void put_event(int fd, int type, int code, int value, long sec)
+{
+	struct input_event ev;
+
+	memset(&ev, 0x00, sizeof(ev));
+	ev.input_event_sec = sec;
+	ev.input_event_usec = 500;
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	if (write(fd, &ev, sizeof(ev)) != sizeof(ev))
+		printf("  short write of an event\n");
+}
+
+static void test_pipe(void)
+{
+	evdev_key k;
+	evdev_key any;
+	int p[2];
+	int i;
+
+	CHECK(pipe(p) == 0);
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	evdev_init(&k, p[0], KEY);
+	CHECK(k.level == 0);
+
+	/* Nothing to read is no change */
+	CHECK(evdev_read(&k) == 0);
+
+	/* A press with its autorepeats and the SYN_REPORT after it */
+	put_event(p[1], EV_KEY, KEY, 1, 10);
+	put_event(p[1], EV_KEY, KEY, 2, 11);
+	put_event(p[1], EV_KEY, KEY, 2, 12);
+	put_event(p[1], EV_SYN, SYN_REPORT, 0, 12);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 1);
+	CHECK(k.when_ns == 10 * 1000000000LL + 500000LL);
+	CHECK(evdev_read(&k) == 0);
+
+	/* Other keys and event types leave it alone */
+	put_event(p[1], EV_KEY, KEY_A, 1, 13);
+	put_event(p[1], EV_MSC, MSC_SCAN, 0, 13);
+	put_event(p[1], EV_KEY, KEY_A, 0, 13);
+	CHECK(evdev_read(&k) == 0);
+	CHECK(k.level == 1);
+
+	/* A release and press read together: off for one read, then on */
+	put_event(p[1], EV_KEY, KEY, 0, 14);
+	put_event(p[1], EV_KEY, KEY, 1, 15);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 0);
+	CHECK(k.when_ns == 14 * 1000000000LL + 500000LL);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 1);
+	CHECK(k.when_ns == 15 * 1000000000LL + 500000LL);
+
+	/* A quick tap read in one go is still a press */
+	put_event(p[1], EV_KEY, KEY, 0, 16);
+	CHECK(evdev_read(&k) == 1);
+	put_event(p[1], EV_KEY, KEY, 1, 17);
+	put_event(p[1], EV_KEY, KEY, 0, 17);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 1);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 0);
+	CHECK(evdev_read(&k) == 0);
+
+	/* More taps than the queue holds between two reads: whole taps are
+	 * dropped, the level still ends up right
+	 */
+	for (i = 0; i < EVDEV_QUEUE; i++)
+	{
+		put_event(p[1], EV_KEY, KEY, 1, 18);
+		put_event(p[1], EV_KEY, KEY, 0, 18);
+	}
+	put_event(p[1], EV_KEY, KEY, 1, 19);
+	for (i = 0; evdev_read(&k) == 1; i++)
+		;
+	CHECK(i == EVDEV_QUEUE - 1);
+	CHECK(k.lost == 2 * EVDEV_QUEUE + 1 - i);
+	CHECK(k.level == 1);
+	put_event(p[1], EV_KEY, KEY, 0, 20);
+	CHECK(evdev_read(&k) == 1);
+
+	/* key=ANY is down while any key is, releasing one of two is not up */
+	evdev_init(&any, p[0], EVDEV_ANY_KEY);
+	put_event(p[1], EV_KEY, KEY_A, 1, 21);
+	CHECK(evdev_read(&any) == 1);
+	CHECK(any.level == 1);
+	put_event(p[1], EV_KEY, KEY_B, 1, 22);
+	put_event(p[1], EV_KEY, KEY_A, 0, 23);
+	CHECK(evdev_read(&any) == 0);
+	CHECK(any.level == 1);
+	CHECK(any.n_held == 1);
+	put_event(p[1], EV_KEY, KEY_B, 0, 24);
+	CHECK(evdev_read(&any) == 1);
+	CHECK(any.level == 0);
+	CHECK(any.when_ns == 24 * 1000000000LL + 500000LL);
+
+	/* A release of a key never seen down is not a key going up */
+	put_event(p[1], EV_KEY, KEY_C, 0, 25);
+	CHECK(evdev_read(&any) == 0);
+	CHECK(any.n_held == 0);
+
+	/* The device unplugged */
+	close(p[1]);
+	CHECK(evdev_read(&k) == -1);
+	close(p[0]);
+}
+
+/* Send a key event and its SYN_REPORT through uinput */
+static void ui_key(int ui, int code, int value)
+{
+	put_event(ui, EV_KEY, code, value, 0);
+	put_event(ui, EV_SYN, SYN_REPORT, 0, 0);
+}
+
+/* Wait a little for the event to come through the input core */
+static int ui_read(evdev_key * k)
+{
+	int r = 0;
+	int i;
+
+	for (i = 0; i < 100 && r == 0; i++)
+	{
+		r = evdev_read(k);
+		if (r == 0)
+			usleep(1000);
+	}
+	return(r);
+}
+
+static void test_uinput(void)
+{
+	struct uinput_setup setup;
+	struct timespec ts;
+	evdev_key k;
+	evdev_key any;
+	long long now;
+	int ui;
+	int fd = -1;
+	int i;
+
+	ui = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (ui < 0)
+	{
+		printf("  no /dev/uinput, skipping the input device checks\n");
+		return;
+	}
+
+	memset(&setup, 0x00, sizeof(setup));
+	setup.id.bustype = BUS_USB;
+	setup.id.vendor = 0x1209;
+	setup.id.product = 0x0001;
+	strncpy(setup.name, UI_NAME, sizeof(setup.name) - 1);
+	if (ioctl(ui, UI_SET_EVBIT, EV_KEY) < 0 ||
+		ioctl(ui, UI_SET_KEYBIT, KEY) < 0 ||
+		ioctl(ui, UI_SET_KEYBIT, KEY_A) < 0 ||
+		ioctl(ui, UI_SET_KEYBIT, KEY_B) < 0 ||
+		ioctl(ui, UI_DEV_SETUP, &setup) < 0 ||
+		ioctl(ui, UI_DEV_CREATE) < 0)
+	{
+		printf("  can't make a uinput device, skipping the input device checks\n");
+		close(ui);
+		return;
+	}
+
+	/* Found by name as device=name:... does, once udev has made the node */
+	for (i = 0; i < 200 && fd < 0; i++)
+	{
+		fd = evdev_open("name:" UI_NAME, 1);
+		if (fd < 0)
+			usleep(10000);
+	}
+	CHECK(fd >= 0);
+	if (fd < 0)
+	{
+		ioctl(ui, UI_DEV_DESTROY);
+		close(ui);
+		return;
+	}
+
+	/* KEY_A held before the line is set up counts for key=ANY */
+	ui_key(ui, KEY_A, 1);
+	usleep(20000);
+	evdev_init(&any, fd, EVDEV_ANY_KEY);
+	CHECK(any.level == 1);
+	CHECK(any.n_held == 1);
+	ui_key(ui, KEY_A, 0);
+	CHECK(ui_read(&any) == 1);
+	CHECK(any.level == 0);
+
+	/* The key itself, stamped on CLOCK_MONOTONIC */
+	evdev_init(&k, fd, KEY);
+	CHECK(k.level == 0);
+	ui_key(ui, KEY, 1);
+	CHECK(ui_read(&k) == 1);
+	CHECK(k.level == 1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	CHECK(k.when_ns <= now && k.when_ns > now - 1000000000LL);
+
+	/* A tap sent in one go is still a press, then a release */
+	ui_key(ui, KEY, 0);
+	CHECK(ui_read(&k) == 1);
+	ui_key(ui, KEY, 1);
+	ui_key(ui, KEY, 0);
+	usleep(20000);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 1);
+	CHECK(evdev_read(&k) == 1);
+	CHECK(k.level == 0);
+
+	/* Unplugged */
+	ioctl(ui, UI_DEV_DESTROY);
+	close(ui);
+	for (i = 0; i < 100 && evdev_read(&k) >= 0; i++)
+		usleep(1000);
+	CHECK(evdev_read(&k) == -1);
+	evdev_close(fd);
+}
+
+void test_evdev(void)
+{
+	test_pipe();
+	test_uinput();
+}
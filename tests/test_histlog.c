@@ -0,0 +1,178 @@
+/* test_histlog.c - History queries over files that are out of order.
+ *
+ * History files are written record by record here, in the orders the
+ * monitor's batching and a stepped clock produce, and the ON times
+ * hist_ontime() gives are checked against the ones worked out by hand.
+ * A file of several index blocks checks that the state before a window
+ * comes from the index, also for a block with more MCRs than it keeps,
+ * and that a replaced history file gets a new index.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "histlog.h"
+#include "test.h"
+
+#define T0		1000000000		// Seconds since the epoch the tests start at
+#define LPT		0x378
+#define COM2	0x2F8
+
+static char dir[] = "/tmp/ptt-test-XXXXXX";
+static char file[64];
+static char index_file[64];
+
+/* Start a new history file, and no index */
+static int start(void)
+{
+	unlink(index_file);
+	return(open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+}
+
+static void put(int fd, int address, double t, int old_mcr, int new_mcr)
+{
+	hist_record rec;
+
+	memset(&rec, 0x00, sizeof(rec));
+	rec.sec = T0 + (unsigned int)t;
+	rec.nsec = (unsigned int)((t - (unsigned int)t) * 1e9 + 0.5);
+	rec.address = address;
+	rec.old_mcr = old_mcr;
+	rec.new_mcr = new_mcr;
+	rec.kind = HIST_MCR;
+	if (write(fd, &rec, sizeof(rec)) != sizeof(rec))
+		printf("  short write to %s\n", file);
+}
+
+/* DTR ON time of 'address' between T0 + t1 and T0 + t2 */
+static double dtr(int address, int t1, int t2, int * found)
+{
+	double on[2];
+
+	*found = hist_ontime(file, address, T0 + t1, T0 + t2, 0, on);
+	return(on[0]);
+}
+
+#define NEAR(a, b)	(fabs((a) - (b)) < 1e-6)
+
+/* The monitor stamps a record, a one-shot ptt appends a later one, then
+ * the monitor's batch goes out: DTR on 10-20 and 30-40, written as 10,
+ * 30, 20, 40.
+ */
+static void test_batch(void)
+{
+	int found;
+	int fd;
+
+	fd = start();
+	put(fd, LPT, 10, 0, 1);
+	put(fd, LPT, 30, 0, 1);
+	put(fd, LPT, 20, 1, 0);
+	put(fd, LPT, 40, 1, 0);
+	close(fd);
+
+	CHECK(NEAR(dtr(LPT, 0, 100, &found), 20.0));
+	CHECK(found == 4);
+
+	/* Before 25 the last write, by time, was the one at 20 */
+	CHECK(NEAR(dtr(LPT, 25, 35, &found), 5.0));
+	CHECK(found == 1);
+	CHECK(NEAR(dtr(LPT, 15, 25, &found), 5.0));
+	CHECK(found == 1);
+}
+
+/* The clock is stepped back 100 s after the write at 200 */
+static void test_step(void)
+{
+	int found;
+	int fd;
+
+	fd = start();
+	put(fd, LPT, 150, 0, 1);
+	put(fd, LPT, 200, 1, 0);
+	put(fd, LPT, 110, 0, 1);
+	put(fd, LPT, 120, 1, 0);
+	close(fd);
+
+	CHECK(NEAR(dtr(LPT, 100, 130, &found), 10.0));
+	CHECK(found == 2);
+	CHECK(NEAR(dtr(LPT, 100, 300, &found), 60.0));
+	CHECK(found == 4);
+	CHECK(NEAR(dtr(LPT, 160, 170, &found), 10.0));
+	CHECK(found == 0);
+}
+
+/* LPT keys once at the start and is never written again, COM2 toggles
+ * through three index blocks and a tail, and block 1 also writes nine
+ * other MCRs, more than an index entry keeps.
+ */
+static void test_index(void)
+{
+	struct stat st;
+	int found;
+	int fd;
+	int i;
+
+	fd = start();
+	put(fd, LPT, 1, 0, 1);
+	for (i = 1; i < 3 * HIST_IDX_BLOCK + 100; i++)
+	{
+		if (i >= HIST_IDX_BLOCK && i < HIST_IDX_BLOCK + 9)
+			put(fd, 0x100 + i - HIST_IDX_BLOCK, 1 + i * 0.01, 0, i == HIST_IDX_BLOCK);
+		else
+			put(fd, COM2, 1 + i * 0.01, (i + 1) & 1, i & 1);
+	}
+	close(fd);
+
+	/* Well after the first block: the state comes from its marks */
+	CHECK(NEAR(dtr(LPT, 100, 110, &found), 10.0));
+	CHECK(found == 0);
+	CHECK(stat(index_file, &st) == 0 && st.st_size == 3 * (off_t)sizeof(hist_index));
+
+	/* 0x100 was set in the full block and not since */
+	CHECK(NEAR(dtr(0x100, 100, 110, &found), 10.0));
+	CHECK(NEAR(dtr(0x101, 100, 110, &found), 0.0));
+
+	/* COM2 is ON every other 10 ms */
+	CHECK(NEAR(dtr(COM2, 100, 110, &found), 5.0));
+	CHECK(found == 1000);
+
+	/* A new file under the same name: LPT now never keyed */
+	fd = start();
+	for (i = 0; i < HIST_IDX_BLOCK + 10; i++)
+		put(fd, COM2, 1 + i * 0.01, (i + 1) & 1, i & 1);
+	close(fd);
+	CHECK(NEAR(dtr(LPT, 100, 110, &found), 0.0));
+
+	/* And again, keeping the old index: LPT keyed again */
+	fd = open(file, O_WRONLY | O_TRUNC);
+	put(fd, LPT, 1, 0, 1);
+	for (i = 1; i < HIST_IDX_BLOCK + 10; i++)
+		put(fd, COM2, 1 + i * 0.01, (i + 1) & 1, i & 1);
+	close(fd);
+	CHECK(NEAR(dtr(LPT, 100, 110, &found), 10.0));
+}
+
+void test_histlog(void)
+{
+	CHECK(mkdtemp(dir) != NULL);
+	snprintf(file, sizeof(file), "%s/history", dir);
+	snprintf(index_file, sizeof(index_file), "%s/history.idx", dir);
+
+	test_batch();
+	test_step();
+	test_index();
+
+	unlink(file);
+	unlink(index_file);
+	CHECK(rmdir(dir) == 0);
+}
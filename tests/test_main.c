@@ -0,0 +1,56 @@
+/* test_main.c - Run the hardware-free checks, 'make test'.
+ *
+ * Each suite drives one building block of monitor mode from synthetic
+ * input: no serial port, audio device or input device is needed, and
+ * nothing needs root. The exit status is the number of failed checks,
+ * capped at 1.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "test.h"
+
+int checks;
+int failures;
+
+typedef struct
+{
+	const char * name;
+	void (*run)(void);
+} test_suite;
+
+static const test_suite suites[] =
+{
+	{ "debounce", test_debounce },
+	{ "segment", test_segment },
+	{ "timer", test_timer },
+	{ "evdev", test_evdev },
+	{ "rules", test_rules },
+	{ "band", test_band },
+	{ "histlog", test_histlog },
+	{ "ctcss", test_ctcss },
+	{ "standby", test_standby },
+	{ NULL, NULL }
+};
+
+int main(int argc, char *argv[])
+{
+	const test_suite * t;
+	int before;
+
+	for (t = suites; t->name != NULL; t++)
+	{
+		before = failures;
+		printf("%s:\n", t->name);
+		t->run();
+		printf("  %s\n", failures == before ? "ok" : "FAILED");
+	}
+
+	printf("%d checks, %d failed\n", checks, failures);
+	return(failures == 0 ? 0 : 1);
+}
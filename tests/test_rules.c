@@ -0,0 +1,116 @@
+/* test_rules.c - Rule parser and lookup table against the same logic in C.
+ *
+ * A handful of [RULES] expressions are compiled and every entry of the
+ * table is compared with the expression written out in C, so operator
+ * precedence, NOT/AND/OR keywords, parentheses and name numbering are
+ * all covered. Malformed expressions have to be refused.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ptt.h"
+#include "rules.h"
+#include "test.h"
+
+/* Names in the order they first appear in the rules below */
+enum { COR1, INHIBIT, FOOTSW, COR2, SPARE_1, KEY_A };
+
+#define BIT(v, n)	(((v) >> (n)) & 1)
+
+static const char * exprs[] =
+{
+	"COR1 & !INHIBIT | FOOTSW",
+	"COR1 & (INHIBIT | FOOTSW)",
+	"not COR2 AND Spare_1",
+	"!!COR1 | COR2 & KEY_A",
+	"( COR2 OR FOOTSW ) and NOT ( INHIBIT )",
+};
+
+/* The rules above, by hand */
+static int expect(int rule, unsigned int v)
+{
+	switch (rule)
+	{
+		case 0:
+			return((BIT(v, COR1) && !BIT(v, INHIBIT)) || BIT(v, FOOTSW));
+		case 1:
+			return(BIT(v, COR1) && (BIT(v, INHIBIT) || BIT(v, FOOTSW)));
+		case 2:
+			return(!BIT(v, COR2) && BIT(v, SPARE_1));
+		case 3:
+			return(BIT(v, COR1) || (BIT(v, COR2) && BIT(v, KEY_A)));
+		default:
+			return((BIT(v, COR2) || BIT(v, FOOTSW)) && !BIT(v, INHIBIT));
+	}
+}
+
+static void test_table(void)
+{
+	rule_def defs[5];
+	rule_table * rt;
+	unsigned int v;
+	int bad = 0;
+	int r;
+
+	rt = (rule_table *)malloc(sizeof(rule_table));
+	for (r = 0; r < 5; r++)
+		CHECK(rule_parse(&defs[r], "OUT", exprs[r]) == PASS);
+	CHECK(rule_compile(rt, defs, 5) == PASS);
+
+	CHECK(rt->n_rules == 5);
+	CHECK(rt->n_names == 6);
+	CHECK(strcmp(rt->names[COR1], "COR1") == 0);
+	CHECK(strcmp(rt->names[KEY_A], "KEY_A") == 0);
+	CHECK(strcmp(rt->names[SPARE_1], "Spare_1") == 0);
+
+	for (v = 0; v < (1U << rt->n_names); v++)
+		for (r = 0; r < 5; r++)
+			if (BIT(rt->table[v], r) != expect(r, v) ||
+				rule_eval(rt, r, v) != expect(r, v))
+				bad++;
+	CHECK(bad == 0);
+	free(rt);
+}
+
+static void test_errors(void)
+{
+	static const char * broken[] =
+	{
+		"",
+		"COR1 &",
+		"(COR1 | COR2",
+		"COR1 COR2",
+		"COR1 ^ COR2",
+		"A|B|C|D|E|F|G|H|I|J|K|L|M",
+	};
+	rule_def def;
+	rule_table * rt;
+	char longname[64];
+	unsigned int i;
+
+	rt = (rule_table *)malloc(sizeof(rule_table));
+	printf("  (the compile errors below are expected)\n");
+	for (i = 0; i < sizeof(broken) / sizeof(broken[0]); i++)
+	{
+		CHECK(rule_parse(&def, "OUT", broken[i]) == PASS);
+		CHECK(rule_compile(rt, &def, 1) == FAIL);
+	}
+
+	/* Too long to store at all */
+	memset(longname, 'X', sizeof(longname) - 1);
+	longname[sizeof(longname) - 1] = '\0';
+	CHECK(rule_parse(&def, longname, "COR1") == FAIL);
+	free(rt);
+}
+
+void test_rules(void)
+{
+	test_table();
+	test_errors();
+}
@@ -0,0 +1,144 @@
+/* test_segment.c - Per-transmission recorder fed synthetic PCM and edges.
+ *
+ * A ramp of samples is fed in blocks, like the audio thread does, with
+ * PTT edges between the blocks. Each transmission has to come out as
+ * one WAV file holding the pre-roll plus everything fed while it was
+ * active, with the header patched to the real length, and the samples
+ * in order with none lost across the write buffer.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "segment.h"
+#include "test.h"
+
+#define RATE		8000
+#define PREROLL_MS	50				// 400 samples
+#define BLOCK		160				// 20 ms
+
+static short next_sample;			// The ramp fed in
+
+static void feed(segmenter * s, int blocks)
+{
+	short pcm[BLOCK];
+	int i;
+
+	while (blocks-- > 0)
+	{
+		for (i = 0; i < BLOCK; i++)
+			pcm[i] = next_sample++;
+		segment_feed(s, pcm, BLOCK);
+	}
+}
+
+static unsigned long le32(const unsigned char * p)
+{
+	return(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24));
+}
+
+/* Check one finished recording: its length, header and that it holds
+ * 'count' consecutive samples of the ramp starting at 'first'.
+ */
+static void check_wav(const char * name, short first, long count)
+{
+	unsigned char h[SEG_WAV_HEADER];
+	unsigned char p[2];
+	struct stat st;
+	long broken = 0;
+	long i;
+	int fd;
+
+	CHECK(stat(name, &st) == 0);
+	CHECK(st.st_size == SEG_WAV_HEADER + count * 2);
+
+	fd = open(name, O_RDONLY);
+	CHECK(fd >= 0);
+	if (fd < 0)
+		return;
+	CHECK(read(fd, h, sizeof(h)) == sizeof(h));
+	CHECK(memcmp(h, "RIFF", 4) == 0 && memcmp(h + 8, "WAVE", 4) == 0);
+	CHECK(le32(h + 4) == (unsigned long)(36 + count * 2));
+	CHECK(le32(h + 24) == RATE);
+	CHECK(le32(h + 40) == (unsigned long)(count * 2));
+
+	for (i = 0; i < count; i++)
+		if (read(fd, p, 2) != 2 || (short)(p[0] | (p[1] << 8)) != (short)(first + i))
+			broken++;
+	CHECK(broken == 0);
+	close(fd);
+}
+
+/* Recordings are named to the millisecond, keep two from sharing one */
+static void next_ms(void)
+{
+	struct timespec ts = { 0, 2000000L };
+
+	nanosleep(&ts, NULL);
+}
+
+void test_segment(void)
+{
+	char dir[] = "/tmp/ptt-test-XXXXXX";
+	char name[3][320];
+	segmenter s;
+	short first;
+	int preroll = RATE * PREROLL_MS / 1000;
+	int i;
+
+	CHECK(mkdtemp(dir) != NULL);
+	CHECK(segment_init(&s, dir, RATE, PREROLL_MS) == 0);
+
+	/* Plenty before the first edge, only the pre-roll of it is kept */
+	feed(&s, 10);
+	first = next_sample - preroll;
+	segment_edge(&s, 1);
+	strcpy(name[0], s.name);
+	CHECK(s.fd >= 0);
+	feed(&s, 25);
+	segment_edge(&s, 0);
+	CHECK(s.files == 1);
+	CHECK(s.fd < 0);
+	check_wav(name[0], first, preroll + 25 * BLOCK);
+
+	/* A repeated edge is no new recording */
+	next_ms();
+	feed(&s, 1);
+	first = next_sample - preroll;
+	segment_edge(&s, 1);
+	strcpy(name[1], s.name);
+	segment_edge(&s, 1);
+	feed(&s, 3);
+	segment_edge(&s, 0);
+	segment_edge(&s, 0);
+	CHECK(s.files == 2);
+	check_wav(name[1], first, preroll + 3 * BLOCK);
+
+	/* Long enough to fill the write buffer several times over */
+	next_ms();
+	first = next_sample - preroll;
+	segment_edge(&s, 1);
+	strcpy(name[2], s.name);
+	feed(&s, 700);
+	segment_close(&s);
+	CHECK(s.files == 3);
+	CHECK(s.writes > 3);
+	check_wav(name[2], first, preroll + 700 * BLOCK);
+
+	CHECK(s.samples_in == (unsigned long)(10 + 25 + 1 + 3 + 700) * BLOCK);
+	CHECK(s.samples_out == (unsigned long)3 * preroll + (25 + 3 + 700) * BLOCK);
+	CHECK(s.dropped == 0);
+
+	for (i = 0; i < 3; i++)
+		unlink(name[i]);
+	CHECK(rmdir(dir) == 0);
+}
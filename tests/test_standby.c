@@ -0,0 +1,127 @@
+/* test_standby.c - Takeover time of a standby against a simulated primary.
+ *
+ * A forked child claims the lease and renews it every period, like a
+ * monitor mode primary, then either dies or stalls. The standby side
+ * runs the real standby_wait() and the time from the last renewal to the
+ * takeover is checked against the bound [STANDBY] promises: a dead
+ * primary is seen at the next poll, a stalled one when its lease lapses.
+ * A standby that can't get at the ports must leave the lease alone.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "ptt.h"
+#include "standby.h"
+#include "test.h"
+
+#define LEASE_MS	100				// Lease the primary holds
+#define PERIOD_MS	2				// Renewal and poll period
+#define RUN_MS		50				// Primary's renewals before it fails
+#define SLACK_MS	40				// Scheduling allowance, below LEASE_MS
+
+/* Renew every period for RUN_MS, then exit or stop renewing */
+static pid_t fake_primary(standby_shm * s, int die)
+{
+	struct timespec period = { 0, PERIOD_MS * 1000000L };
+	long long end;
+	pid_t pid;
+
+	pid = fork();
+	if (pid != 0)
+		return(pid);
+
+	standby_claim(s, LEASE_MS);
+	end = mono_now_ns() + RUN_MS * 1000000LL;
+	while (mono_now_ns() < end)
+	{
+		standby_renew(s, LEASE_MS);
+		nanosleep(&period, NULL);
+	}
+	if (!die)
+		pause();
+	_exit(0);
+}
+
+/* Take over from one primary, return ms from its last renewal */
+static double takeover(standby_shm * s, int die)
+{
+	struct timespec period = { 0, PERIOD_MS * 1000000L };
+	long long lease = 0;
+	long long seen = 0;
+	double ms;
+	pid_t pid;
+	pid_t owner;
+
+	memset(s, 0x00, sizeof(standby_shm));
+	pid = fake_primary(s, die);
+	owner = standby_wait(s, LEASE_MS, &period, &lease, &seen);
+	ms = (mono_now_ns() - s->renewed_ns) / 1e6;
+
+	CHECK(owner == pid);
+	CHECK(s->owner == getpid());
+	if (die)
+		CHECK(ms <= 2 * PERIOD_MS + SLACK_MS);
+	else
+	{
+		CHECK(seen > lease);
+		CHECK(ms >= LEASE_MS && ms <= LEASE_MS + 2 * PERIOD_MS + SLACK_MS);
+		kill(pid, SIGKILL);
+	}
+	return(ms);
+}
+
+/* A port beyond the IO space, so ioperm() always refuses it */
+static void no_access(standby_shm * s)
+{
+	struct timespec period = { 0, PERIOD_MS * 1000000L };
+	long long lease = 0;
+	long long seen = 0;
+	pid_t pid;
+	pid_t owner;
+
+	memset(s, 0x00, sizeof(standby_shm));
+	s->ports[0].used = TRUE;
+	s->ports[0].mcr = 0x10000;
+	pid = fake_primary(s, TRUE);
+	owner = standby_wait(s, LEASE_MS, &period, &lease, &seen);
+
+	CHECK(owner == -1);
+	CHECK(s->owner == pid);
+}
+
+void test_standby(void)
+{
+	char name[64];
+	standby_shm * s;
+	double dead;
+	double stalled;
+
+	/* A dead child must be reaped at once for its pid to be gone */
+	signal(SIGCHLD, SIG_IGN);
+
+	snprintf(name, sizeof(name), "/ptt-test-%d", (int)getpid());
+	s = standby_attach(name, TRUE);
+	CHECK(s != NULL);
+	if (s == NULL)
+		return;
+
+	dead = takeover(s, TRUE);
+	stalled = takeover(s, FALSE);
+	printf("  takeover %.3f ms after the last renewal (primary died), "
+		"%.3f ms (stalled, lease %d ms)\n", dead, stalled, LEASE_MS);
+	no_access(s);
+
+	signal(SIGCHLD, SIG_DFL);
+	munmap(s, sizeof(standby_shm));
+	shm_unlink(name);
+}
@@ -0,0 +1,144 @@
+/* test_timer.c - Timer wheel against a brute force list of expiries.
+ *
+ * Timers are added, cancelled and re-armed from their own callbacks at
+ * random, over delays that reach every level of the wheel, and the wheel
+ * is advanced by random steps. Every timer has to fire exactly on its
+ * tick, only once, and tw_next() has to agree with a plain search of the
+ * timers still pending, however stale its cached answer might be.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timer.h"
+#include "test.h"
+
+#define N_TIMERS	64
+#define N_OPS		100000
+#define PERIOD		37				// Re-arm period of the periodic timers
+
+static timer_wheel wheel;
+static ptt_timer timers[N_TIMERS];
+static unsigned long long due[N_TIMERS];	// Expected expiry, 0 if idle
+static unsigned long fired;
+static int late;						// Fired on the wrong tick
+static int stray;						// Fired when not pending
+
+/* Odd timers re-arm themselves, like an output's 'every=' pulse */
+static void fire(ptt_timer * t)
+{
+	int i = t->arg;
+
+	fired++;
+	if (due[i] == 0)
+		stray++;
+	else if (t->expires != due[i] || wheel.now != due[i])
+		late++;
+	due[i] = 0;
+
+	if (i & 1)
+	{
+		tw_add(&wheel, t, wheel.now + PERIOD);
+		due[i] = wheel.now + PERIOD;
+	}
+}
+
+/* Delays from the next tick to beyond the third level */
+static unsigned long long delay(void)
+{
+	switch (rand() % 4)
+	{
+		case 0:
+			return(rand() % TW_SIZE);
+		case 1:
+			return(rand() % (TW_SIZE * TW_SIZE));
+		case 2:
+			return(rand() % (TW_SIZE * TW_SIZE * TW_SIZE));
+		default:
+			return(rand() % (1 << 22));
+	}
+}
+
+static unsigned long long brute_next(void)
+{
+	unsigned long long next = 0;
+	int i;
+
+	for (i = 0; i < N_TIMERS; i++)
+		if (due[i] != 0 && (next == 0 || due[i] < next))
+			next = due[i];
+	return(next);
+}
+
+void test_timer(void)
+{
+	unsigned long long expires;
+	unsigned long added = 0;
+	int wrong_next = 0;
+	int wrong_active = 0;
+	int op;
+	int i;
+
+	srand(1);
+	tw_init(&wheel, 1000);
+	for (i = 0; i < N_TIMERS; i++)
+		tw_timer_init(&timers[i], fire, NULL, i);
+
+	for (op = 0; op < N_OPS; op++)
+	{
+		i = rand() % N_TIMERS;
+		switch (rand() % 8)
+		{
+			case 0:
+			case 1:
+			case 2:
+				expires = wheel.now + delay();
+				tw_add(&wheel, &timers[i], expires);
+				due[i] = expires > wheel.now ? expires : wheel.now + 1;
+				added++;
+				break;
+			case 3:
+				tw_cancel(&wheel, &timers[i]);
+				due[i] = 0;
+				break;
+			case 4:
+			case 5:
+				tw_advance(&wheel, wheel.now + rand() % 8);
+				break;
+			case 6:
+				tw_advance(&wheel, wheel.now + rand() % (TW_SIZE * TW_SIZE));
+				break;
+			default:
+				/* Run straight to the soonest, as the monitor loop sleeps to it */
+				if (tw_next(&wheel) != 0)
+					tw_advance(&wheel, tw_next(&wheel));
+				break;
+		}
+
+		if (tw_next(&wheel) != brute_next())
+			wrong_next++;
+		for (i = 0; i < N_TIMERS; i++)
+			if (tw_active(&timers[i]) != (due[i] != 0))
+				wrong_active++;
+	}
+
+	CHECK(added > 0);
+	CHECK(fired > N_OPS / 10);
+	CHECK(late == 0);
+	CHECK(stray == 0);
+	CHECK(wrong_next == 0);
+	CHECK(wrong_active == 0);
+	CHECK(wheel.cascaded > 0);
+	CHECK(wheel.fired == fired);
+
+	/* Empty the wheel: nothing pending, nothing next */
+	for (i = 0; i < N_TIMERS; i++)
+		tw_cancel(&wheel, &timers[i]);
+	CHECK(wheel.pending == 0);
+	CHECK(tw_next(&wheel) == 0);
+}
@@ -0,0 +1,294 @@
+/* timer.c - Hierarchical timer wheel for scheduled line events.
+ *
+ * Scheduled pulses, beacons and time-out timers in monitor mode are kept
+ * in a four level timer wheel of 64 slots per level, the classic design
+ * from the Linux kernel. Level 0 holds timers due in the next 64 ticks,
+ * one slot per tick, and each higher level covers 64 times the span of
+ * the one below. Adding or cancelling a timer is a list insert or unlink
+ * whatever the number of pending timers is. When level 0 wraps, the
+ * matching slot of the level above is cascaded down, so every timer is
+ * touched at most once per level before it fires.
+ *
+ * A tick is one monitor sample period. Timers further out than the top
+ * level can reach are parked in its farthest slot and re-filed when it
+ * cascades.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+#include "probes.h"
+
+static void list_init(ptt_timer * head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static void list_add(ptt_timer * head, ptt_timer * t)
+{
+	t->next = head->next;
+	t->prev = head;
+	head->next->prev = t;
+	head->next = t;
+}
+
+static void list_del(ptt_timer * t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+void tw_init(timer_wheel * tw, unsigned long long now)
+{
+	int level;
+	int slot;
+
+	memset(tw, 0x00, sizeof(timer_wheel));
+	tw->now = now;
+	for (level = 0; level < TW_LEVELS; level++)
+		for (slot = 0; slot < TW_SIZE; slot++)
+			list_init(&tw->slots[level][slot]);
+}
+
+void tw_timer_init(ptt_timer * t, void (*fn)(ptt_timer * t), void * data, int arg)
+{
+	memset(t, 0x00, sizeof(ptt_timer));
+	t->fn = fn;
+	t->data = data;
+	t->arg = arg;
+}
+
+int tw_active(const ptt_timer * t)
+{
+	return(t->next != NULL);
+}
+
+/* File a timer in the slot its expiry falls in, relative to tw->now */
+static void tw_file(timer_wheel * tw, ptt_timer * t)
+{
+	unsigned long long expires = t->expires;
+	unsigned long long delta;
+	int level;
+
+	delta = expires - tw->now;
+	for (level = 0; level < TW_LEVELS - 1; level++)
+		if (delta < (1ULL << (TW_BITS * (level + 1))))
+			break;
+
+	/* Too far out even for the top level, park it in the last slot */
+	if (delta >= (1ULL << (TW_BITS * TW_LEVELS)))
+		expires = tw->now + (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+
+	list_add(&tw->slots[level][(expires >> (TW_BITS * level)) & TW_MASK], t);
+}
+
+/* Arm (or re-arm) a timer to fire on tick 'expires' */
+void tw_add(timer_wheel * tw, ptt_timer * t, unsigned long long expires)
+{
+	if (tw_active(t))
+		tw_cancel(tw, t);
+
+	/* The current tick has already been run, the soonest is the next */
+	if (expires <= tw->now)
+		expires = tw->now + 1;
+
+	t->expires = expires;
+	tw_file(tw, t);
+
+	/* Keep the soonest expiry, unless it is already to be searched for */
+	if (tw->pending == 0 || (tw->next_ok && expires < tw->next))
+	{
+		tw->next = expires;
+		tw->next_ok = 1;
+	}
+	tw->pending++;
+}
+
+void tw_cancel(timer_wheel * tw, ptt_timer * t)
+{
+	if (!tw_active(t))
+		return;
+	list_del(t);
+	tw->pending--;
+
+	/* There may be others on the same tick, the next tw_next() will see */
+	if (t->expires == tw->next)
+		tw->next_ok = 0;
+}
+
+/* The tick the soonest pending timer fires on, 0 if none is pending.
+ * tw_add() keeps it as timers are armed, so this is a field read. Only
+ * once the soonest timer has fired or been cancelled does it walk every
+ * slot to find the next one.
+ */
+unsigned long long tw_next(timer_wheel * tw)
+{
+	const ptt_timer * head;
+	const ptt_timer * t;
+	unsigned long long next = 0;
+	int level;
+	int slot;
+
+	if (tw->pending == 0)
+		return(0);
+	if (tw->next_ok)
+		return(tw->next);
+
+	for (level = 0; level < TW_LEVELS; level++)
+		for (slot = 0; slot < TW_SIZE; slot++)
+		{
+			head = &tw->slots[level][slot];
+			for (t = head->next; t != head; t = t->next)
+				if (next == 0 || t->expires < next)
+					next = t->expires;
+		}
+	tw->next = next;
+	tw->next_ok = 1;
+	tw->rescans++;
+	return(next);
+}
+
+/* Move every timer in one slot of 'level' down to the levels below.
+ * Returns the slot index, zero means the level above is due too.
+ */
+static int tw_cascade(timer_wheel * tw, int level)
+{
+	ptt_timer * head;
+	ptt_timer * t;
+	int index;
+
+	index = (tw->now >> (TW_BITS * level)) & TW_MASK;
+	head = &tw->slots[level][index];
+
+	while (head->next != head)
+	{
+		t = head->next;
+		list_del(t);
+		tw_file(tw, t);
+		tw->cascaded++;
+	}
+	return(index);
+}
+
+/* Run the wheel forward to tick 'now', firing every timer due on the
+ * way in expiry order. A timer's function may re-arm it.
+ */
+void tw_advance(timer_wheel * tw, unsigned long long now)
+{
+	ptt_timer * head;
+	ptt_timer * t;
+	int level;
+
+	while (tw->now < now)
+	{
+		tw->now++;
+
+		if ((tw->now & TW_MASK) == 0)
+			for (level = 1; level < TW_LEVELS; level++)
+				if (tw_cascade(tw, level) != 0)
+					break;
+
+		head = &tw->slots[0][tw->now & TW_MASK];
+		while (head->next != head)
+		{
+			t = head->next;
+			list_del(t);
+			tw->pending--;
+			tw->fired++;
+			PTT_PROBE3(timer_fire, t->arg, t->expires, tw->now);
+			t->fn(t);
+		}
+	}
+
+	/* The soonest has fired, look for the next one when asked */
+	if (tw->next <= tw->now)
+		tw->next_ok = 0;
+}
+
+static unsigned long bench_late;
+
+static void bench_fire(ptt_timer * t)
+{
+	timer_wheel * tw = (timer_wheel *)t->data;
+
+	if (t->expires != tw->now)
+		bench_late++;
+}
+
+static double bench_ns(struct timespec * t0, struct timespec * t1)
+{
+	return((t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec));
+}
+
+/* Time adding, cancelling and firing 'count' timers spread over a
+ * minute of 1 ms ticks, and check that each one fires on its tick.
+ */
+int tw_bench(int count)
+{
+	timer_wheel * tw;
+	ptt_timer * timers;
+	struct timespec t0;
+	struct timespec t1;
+	unsigned int seed = 1;
+	unsigned long long ticks = 60000;
+	double add_ns;
+	double cancel_ns;
+	double run_ns;
+	int cancelled = 0;
+	int i;
+
+	tw = (timer_wheel *)malloc(sizeof(timer_wheel));
+	timers = (ptt_timer *)calloc(count, sizeof(ptt_timer));
+	if (tw == NULL || timers == NULL)
+	{
+		free(tw);
+		free(timers);
+		return(-1);
+	}
+
+	tw_init(tw, 0);
+	for (i = 0; i < count; i++)
+		tw_timer_init(&timers[i], bench_fire, tw, i);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < count; i++)
+		tw_add(tw, &timers[i], 1 + rand_r(&seed) % ticks);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	add_ns = bench_ns(&t0, &t1);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < count; i += 10, cancelled++)
+		tw_cancel(tw, &timers[i]);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	cancel_ns = bench_ns(&t0, &t1);
+
+	bench_late = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	tw_advance(tw, ticks);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	run_ns = bench_ns(&t0, &t1);
+
+	printf("Timer wheel: %d timers over %llu ticks\n", count, ticks);
+	printf("  add:     %.1f ns/timer\n", add_ns / count);
+	printf("  cancel:  %.1f ns/timer\n", cancelled ? cancel_ns / cancelled : 0.0);
+	printf("  advance: %.1f ns/tick, %.1f ns/fire incl. ticks\n",
+		run_ns / ticks, tw->fired ? run_ns / tw->fired : 0.0);
+	printf("  fired %lu, cascaded %lu, off tick %lu, left %lu\n",
+		tw->fired, tw->cascaded, bench_late, tw->pending);
+
+	i = (bench_late == 0 && tw->pending == 0 &&
+		tw->fired == (unsigned long)(count - cancelled)) ? 0 : -1;
+	free(timers);
+	free(tw);
+	return(i);
+}
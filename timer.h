@@ -0,0 +1,56 @@
+/* timer.h - Hierarchical timer wheel for scheduled line events.
+
+*/
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TW_BITS		6					// Slots per level, as a power of 2
+#define TW_SIZE		(1 << TW_BITS)
+#define TW_MASK		(TW_SIZE - 1)
+#define TW_LEVELS	4					// 2^24 ticks, 4.6 hours at 1 ms
+
+/* A timer is embedded in whatever it belongs to, the wheel only links
+ * it into a slot list, so adding and cancelling never allocate.
+ */
+typedef struct ptt_timer
+{
+	struct ptt_timer * next;			// Slot list links, NULL when idle
+	struct ptt_timer * prev;
+	unsigned long long expires;			// Tick the timer fires on
+	void (*fn)(struct ptt_timer * t);	// Called when the timer fires
+	void * data;						// Owner of the timer
+	int arg;							// Owner defined
+} ptt_timer;
+
+typedef struct
+{
+	unsigned long long now;					// Last tick processed
+	ptt_timer slots[TW_LEVELS][TW_SIZE];	// Slot list heads
+	unsigned long pending;					// Timers in the wheel
+	unsigned long long next;				// Soonest expiry, if 'next_ok'
+	int next_ok;							// 'next' is up to date
+	unsigned long rescans;					// Times 'next' had to be searched for
+	unsigned long fired;					// Timers fired so far
+	unsigned long cascaded;					// Timers moved down a level
+} timer_wheel;
+
+void tw_init(timer_wheel * tw, unsigned long long now);
+void tw_timer_init(ptt_timer * t, void (*fn)(ptt_timer * t), void * data, int arg);
+void tw_add(timer_wheel * tw, ptt_timer * t, unsigned long long expires);
+void tw_cancel(timer_wheel * tw, ptt_timer * t);
+int tw_active(const ptt_timer * t);
+void tw_advance(timer_wheel * tw, unsigned long long now);
+unsigned long long tw_next(timer_wheel * tw);
+int tw_bench(int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TIMER_H__ */
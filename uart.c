@@ -0,0 +1,274 @@
+/* uart.c - 8250 family UART type probe and per-port type cache.
+ *
+ * ptt was written for the classic legacy 8250, but most ports today are
+ * 16550A or better, and some have extra MCR bits (16750 and 16C950 auto
+ * flow control). uart_probe() identifies the part with the same tests
+ * the Linux 8250 driver uses at boot: IER read/write, scratch register,
+ * FIFO bits in IIR, the 16750 64 byte FIFO enable, the EFR, the Exar
+ * divisor latch ID and the 16C950 ID registers.
+ *
+ * Every register the probe writes is put back the way it was found,
+ * except two that can't be read back: FCR, whose FIFO enable is restored
+ * from IIR with the driver's default trigger level, and the 16C950 ACR,
+ * which is left at zero as the driver leaves it. The probe must be run
+ * with the port idle, it briefly disturbs the FIFOs and interrupts.
+ *
+ * The result is cached in a small file per port so later invocations
+ * can pick the MCR mask for the part without probing again.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/io.h>
+
+#include "uart.h"
+
+static const char * uart_names[] = {
+	"UNKNOWN", "NONE", "8250", "16450", "16550", "16550A",
+	"16750", "16650", "XR16C850", "16C950"
+};
+
+const char * uart_type_name(int type)
+{
+	if (type < UART_UNKNOWN || type > UART_16C950)
+		return("ERROR");
+	return(uart_names[type]);
+}
+
+int uart_type_from_name(const char * name)
+{
+	int type;
+
+	for (type = UART_UNKNOWN; type <= UART_16C950; type++)
+		if (strcmp(name, uart_names[type]) == 0)
+			return(type);
+	return(UART_UNKNOWN);
+}
+
+/* Return the MCR bits ptt should keep when it writes the MCR of this
+ * part. For an unprobed port we keep the historical behaviour of only
+ * keeping DTR and RTS. Once the part is known, OUT1, OUT2 (the interrupt
+ * gate used by the kernel driver) and LOOP are preserved, plus the auto
+ * flow control bit on parts that have one.
+ */
+unsigned char uart_mcr_mask(int type)
+{
+	switch (type)
+	{
+		case UART_NONE:
+			return(0x00);
+		case UART_8250:
+		case UART_16450:
+		case UART_16550:
+		case UART_16550A:
+			return(0x1F);
+		case UART_16750:
+		case UART_16650:
+		case UART_XR16C850:
+		case UART_16C950:
+			return(0x3F);
+		case UART_UNKNOWN:
+		default:
+			return(0x03);
+	}
+}
+
+/* Read one of the 16C950 indexed control registers. */
+static unsigned char icr_read(int base, unsigned char index)
+{
+	unsigned char value;
+
+	outb(0x00, base + UART_SCR);		// ACR
+	outb(0x40, base + UART_ICR);		// ACR: ICR read enable
+	outb(index, base + UART_SCR);
+	value = inb(base + UART_ICR);
+	outb(0x00, base + UART_SCR);		// ACR
+	outb(0x00, base + UART_ICR);		// ACR: back to zero
+	return(value);
+}
+
+/* Probe for the parts that have an EFR. Entered and left with LCR=0xBF. */
+static int probe_efr(int base)
+{
+	unsigned char efr;
+	unsigned char dll;
+	unsigned char dlm;
+	unsigned char id1;
+	unsigned char id2;
+	unsigned char id3;
+	unsigned char scr;
+	int type = UART_16650;
+
+	efr = inb(base + UART_EFR);
+
+	/* 16C950: enable enhanced mode so the ICR ID registers answer */
+	outb(efr | 0x10, base + UART_EFR);
+	outb(0x00, base + UART_LCR);
+
+	/* The ICR index goes through SCR, keep whatever the owner left there */
+	scr = inb(base + UART_SCR);
+	id1 = icr_read(base, 0x08);
+	id2 = icr_read(base, 0x09);
+	id3 = icr_read(base, 0x0A);
+	outb(scr, base + UART_SCR);
+	if (id1 == 0x16 && id2 == 0xC9 && (id3 == 0x50 || id3 == 0x52 || id3 == 0x54))
+		type = UART_16C950;
+
+	/* Exar: with DLAB set and the divisor zeroed, DLM reads the device ID */
+	if (type == UART_16650)
+	{
+		outb(0x80, base + UART_LCR);
+		dll = inb(base + UART_DLL);
+		dlm = inb(base + UART_DLM);
+		outb(0x00, base + UART_DLL);
+		outb(0x00, base + UART_DLM);
+		id1 = inb(base + UART_DLM);
+		outb(dll, base + UART_DLL);
+		outb(dlm, base + UART_DLM);
+		if (id1 == 0x10 || id1 == 0x12 || id1 == 0x14)
+			type = UART_XR16C850;
+	}
+
+	outb(0xBF, base + UART_LCR);
+	outb(efr, base + UART_EFR);
+	return(type);
+}
+
+/* Identify the UART at 'base'. The caller must have ioperm()'ed all
+ * WHOLE_UART registers from base.
+ */
+int uart_probe(int base)
+{
+	unsigned char lcr;
+	unsigned char ier;
+	unsigned char scr;
+	unsigned char iir;
+	unsigned char r1;
+	unsigned char r2;
+	int type;
+
+	lcr = inb(base + UART_LCR);
+	outb(lcr & 0x7F, base + UART_LCR);
+
+	/* Something must be there: IER's low nibble reads back what we write */
+	ier = inb(base + UART_IER);
+	outb(0x00, base + UART_IER);
+	r1 = inb(base + UART_IER) & 0x0F;
+	outb(0x0F, base + UART_IER);
+	r2 = inb(base + UART_IER) & 0x0F;
+	outb(ier, base + UART_IER);
+	if (r1 != 0x00 || r2 != 0x0F)
+	{
+		outb(lcr, base + UART_LCR);
+		return(UART_NONE);
+	}
+
+	/* The original 8250 has no scratch register */
+	scr = inb(base + UART_SCR);
+	outb(0x55, base + UART_SCR);
+	r1 = inb(base + UART_SCR);
+	outb(0xAA, base + UART_SCR);
+	r2 = inb(base + UART_SCR);
+	outb(scr, base + UART_SCR);
+	if (r1 != 0x55 || r2 != 0xAA)
+	{
+		outb(lcr, base + UART_LCR);
+		return(UART_8250);
+	}
+
+	/* Turn the FIFO on and see what IIR says about it */
+	iir = inb(base + UART_IIR);
+	outb(0x01, base + UART_FCR);
+	switch (inb(base + UART_IIR) >> 6)
+	{
+		case 0: type = UART_16450; break;
+		case 2: type = UART_16550; break;
+		case 3: type = UART_16550A; break;
+		default: type = UART_UNKNOWN; break;
+	}
+
+	if (type == UART_16550A)
+	{
+		/* An EFR reads back what we write to it with LCR=0xBF */
+		outb(0xBF, base + UART_LCR);
+		r1 = inb(base + UART_EFR);
+		outb(r1 ^ 0x10, base + UART_EFR);
+		r2 = inb(base + UART_EFR);
+		outb(r1, base + UART_EFR);
+		if (r2 == (r1 ^ 0x10))
+			type = probe_efr(base);
+		outb(lcr & 0x7F, base + UART_LCR);
+	}
+
+	if (type == UART_16550A)
+	{
+		/* The 16750 only enables its 64 byte FIFO with DLAB set */
+		outb(0x80, base + UART_LCR);
+		outb(0x21, base + UART_FCR);
+		r1 = inb(base + UART_IIR) >> 5;
+		outb(0x01, base + UART_FCR);
+		outb(0x00, base + UART_LCR);
+		r2 = inb(base + UART_IIR) >> 5;
+		if (r1 == 7 && r2 == 6)
+			type = UART_16750;
+	}
+
+	/* FCR can't be read back, put the FIFO enable back the way IIR had it */
+	if ((iir & 0xC0) != 0)
+		outb(0x81, base + UART_FCR);
+	else
+		outb(0x00, base + UART_FCR);
+
+	outb(lcr, base + UART_LCR);
+	return(type);
+}
+
+static void cache_path(char * path, int size, const char * dir, int base)
+{
+	snprintf(path, size, "%s/ptt-0x%04X.uart", dir, base);
+}
+
+/* Return the cached UART type for the port at 'base', or UART_UNKNOWN. */
+int uart_cache_load(const char * dir, int base)
+{
+	char path[256];
+	char name[16];
+	FILE * fp;
+	int type = UART_UNKNOWN;
+
+	if (strlen(dir) == 0)
+		return(UART_UNKNOWN);
+
+	cache_path(path, sizeof(path), dir, base);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return(UART_UNKNOWN);
+
+	if (fscanf(fp, "%15s", name) == 1)
+		type = uart_type_from_name(name);
+	fclose(fp);
+	return(type);
+}
+
+/* Remember the UART type of the port at 'base'. Returns 0 or -1. */
+int uart_cache_save(const char * dir, int base, int type)
+{
+	char path[256];
+	FILE * fp;
+
+	if (strlen(dir) == 0)
+		return(-1);
+
+	cache_path(path, sizeof(path), dir, base);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return(-1);
+
+	fprintf(fp, "%s\n", uart_type_name(type));
+	fclose(fp);
+	return(0);
+}
@@ -0,0 +1,53 @@
+/* uart.h - 8250 family UART type probe and per-port type cache.
+
+*/
+
+#ifndef __UART_H__
+#define __UART_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* UART register offsets from the COM port base address */
+#define UART_RBR	0		// Receive buffer (read, DLAB=0)
+#define UART_DLL	0		// Divisor latch low (DLAB=1)
+#define UART_IER	1		// Interrupt enable (DLAB=0)
+#define UART_DLM	1		// Divisor latch high (DLAB=1)
+#define UART_IIR	2		// Interrupt ident (read)
+#define UART_FCR	2		// FIFO control (write)
+#define UART_EFR	2		// Enhanced features (LCR=0xBF)
+#define UART_LCR	3		// Line control
+#define UART_MCR	4		// Modem control
+#define UART_LSR	5		// Line status
+#define UART_ICR	5		// 16C950 indexed control (write)
+#define UART_MSR	6		// Modem status
+#define UART_SCR	7		// Scratch
+
+/* UART parts that can be told apart by uart_probe() */
+enum {
+	UART_UNKNOWN,		// Not probed, assume legacy 8250 behaviour
+	UART_NONE,			// No UART responds at this address
+	UART_8250,			// No scratch register
+	UART_16450,			// Scratch register, no FIFO
+	UART_16550,			// Broken FIFO
+	UART_16550A,		// Working 16 byte FIFO
+	UART_16750,			// 64 byte FIFO, auto flow control
+	UART_16650,			// Has EFR (16650/16850 class)
+	UART_XR16C850,		// Exar, identified by divisor latch ID
+	UART_16C950			// Oxford, identified by ICR ID registers
+};
+
+int uart_probe(int base);
+const char * uart_type_name(int type);
+int uart_type_from_name(const char * name);
+unsigned char uart_mcr_mask(int type);
+int uart_cache_load(const char * dir, int base);
+int uart_cache_save(const char * dir, int base, int type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UART_H__ */
@@ -0,0 +1,355 @@
+/* winkey.c - WinKeyer host protocol on a pseudo terminal.
+ *
+ * Contest loggers can nearly all drive a K1EL WinKeyer. With a [WINKEY]
+ * section the monitor opens a pseudo terminal, links it at the name the
+ * config gives, and answers the WinKeyer 2 host protocol on it, so the
+ * logger sends its CW through ptt's keyer onto a state=CW line and keys a
+ * state=CWPTT line around it.
+ *
+ * Bytes 0x20 to 0x7F are text for the keyer's buffer. Below that they are
+ * commands: the immediate ones (speed, weighting, PTT lead and tail,
+ * pin configuration, key compensation, dit/dah ratio, pause, backspace,
+ * clear buffer, key immediate, status request and the admin commands a
+ * logger uses to open and probe the keyer) take effect at once, and the
+ * buffered ones (PTT, key, wait, merge, speed change) go into the buffer
+ * and take effect in order with the text. A status byte goes back to the
+ * host whenever it changes, as the WinKeyer sends it, and in echo mode
+ * each character goes back as it starts being sent.
+ *
+ * There is no paddle or speed pot, and the sidetone is ptt's own (see
+ * sidetone.c); their commands are taken and ignored, and reads return
+ * fixed values. The buffer pointer commands are
+ * ignored too.
+ *
+ * (C) KB4OID Labs, a division of Kodetroll Heavy Industries
+ * Author: Kodetroll (Steve McCarter, KB4OID)
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+
+#include "winkey.h"
+
+/* Length of each command, with the command byte */
+static const unsigned char cmd_len[32] = {
+	2, 2, 2, 2, 3, 4, 2, 1, 1, 2, 1, 2, 2, 2, 2, 16,
+	2, 2, 2, 1, 2, 1, 2, 2, 2, 2, 2, 3, 2, 2, 1, 1
+};
+
+/* The slave side, raw, so nothing we send comes straight back to us */
+static int open_slave(winkey * w)
+{
+	struct termios tio;
+	const char * name;
+
+	if (grantpt(w->fd) != 0 || unlockpt(w->fd) != 0 || (name = ptsname(w->fd)) == NULL)
+		return(-1);
+	w->slave = open(name, O_RDWR | O_NOCTTY);
+	if (w->slave < 0)
+		return(-1);
+	if (tcgetattr(w->slave, &tio) != 0)
+		return(-1);
+	cfmakeraw(&tio);
+	if (tcsetattr(w->slave, TCSANOW, &tio) != 0)
+		return(-1);
+
+	unlink(w->link);
+	return(symlink(name, w->link));
+}
+
+int winkey_open(winkey * w, keyer * k, const char * link)
+{
+	memset(w, 0x00, sizeof(winkey));
+	w->k = k;
+	w->status = -1;
+	w->slave = -1;
+	w->pincfg = WK_PTT_ENABLE;
+	strncpy(w->link, link, sizeof(w->link) - 1);
+
+	w->fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (w->fd < 0)
+		return(-1);
+	if (open_slave(w) != 0)
+	{
+		if (w->slave >= 0)
+			close(w->slave);
+		close(w->fd);
+		w->fd = -1;
+		return(-1);
+	}
+	fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) | O_NONBLOCK);
+	return(0);
+}
+
+/* After an upgrade re-exec: carry on with the old binary's pty. The link
+ * still names its slave, so the logger never sees the keyer go away.
+ */
+void winkey_adopt(winkey * w, keyer * k, const winkey * old)
+{
+	*w = *old;
+	w->k = k;
+}
+
+static void reply(winkey * w, const unsigned char * data, int len)
+{
+	if (write(w->fd, data, len) != len && errno != EAGAIN)
+		w->host = FALSE;
+}
+
+static void reply_byte(winkey * w, int b)
+{
+	unsigned char c = b;
+
+	reply(w, &c, 1);
+}
+
+static int status_byte(winkey * w)
+{
+	keyer * k = w->k;
+	int s = WK_STATUS;
+
+	if (k->count > KEYER_BUFSIZE * 2 / 3)
+		s |= WK_XOFF;
+	if (keyer_busy(k))
+		s |= WK_BUSY;
+	if (k->tune)
+		s |= WK_KEYDOWN;
+	return(s);
+}
+
+static void set_pincfg(winkey * w, int pincfg)
+{
+	w->pincfg = pincfg;
+	w->k->ptt_enable = (pincfg & WK_PTT_ENABLE) != 0;
+	w->k->hang = (pincfg >> 4) & 3;
+}
+
+static void admin(winkey * w)
+{
+	keyer * k = w->k;
+	unsigned char values[15];
+	unsigned char eeprom[256];
+
+	switch (w->cmd[1])
+	{
+	case 1:		/* Reset */
+		keyer_clear(k);
+		w->host = FALSE;
+		w->mode = 0;
+		break;
+	case 2:		/* Host open */
+		w->host = TRUE;
+		w->status = status_byte(w);
+		reply_byte(w, WK_VERSION);
+		break;
+	case 3:		/* Host close */
+		keyer_clear(k);
+		w->host = FALSE;
+		break;
+	case 4:		/* Echo test */
+		reply_byte(w, w->cmd[2]);
+		break;
+	case 7:		/* Get values */
+		memset(values, 0x00, sizeof(values));
+		values[0] = w->mode;
+		values[1] = k->wpm;
+		values[3] = k->weight;
+		values[4] = k->lead_ms / 10;
+		values[5] = k->tail_ms / 10;
+		values[9] = k->comp_ms;
+		values[12] = k->ratio;
+		values[13] = w->pincfg;
+		reply(w, values, sizeof(values));
+		break;
+	case 12:	/* Dump EEPROM */
+		memset(eeprom, 0x00, sizeof(eeprom));
+		reply(w, eeprom, sizeof(eeprom));
+		break;
+	case 5:		/* Paddle and speed pot A/D, calibration, Vcc, versions */
+	case 6:
+	case 9:
+	case 21:
+	case 23:
+	case 24:
+		reply_byte(w, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Run a complete command */
+static void command(winkey * w, long long now_ns)
+{
+	keyer * k = w->k;
+	unsigned char * c = w->cmd;
+	int i;
+
+	w->commands++;
+	switch (c[0])
+	{
+	case 0x00:
+		admin(w);
+		break;
+	case 0x02:
+		if (c[1] > 0)
+			k->wpm = c[1];
+		break;
+	case 0x03:
+		if (c[1] >= 10 && c[1] <= 90)
+			k->weight = c[1];
+		break;
+	case 0x04:
+		k->lead_ms = c[1] * 10;
+		k->tail_ms = c[2] * 10;
+		break;
+	case 0x06:
+		k->paused = c[1] != 0;
+		break;
+	case 0x07:
+		reply_byte(w, 0x80);
+		break;
+	case 0x08:
+		keyer_backspace(k);
+		break;
+	case 0x09:
+		set_pincfg(w, c[1]);
+		break;
+	case 0x0A:
+		keyer_clear(k);
+		break;
+	case 0x0B:
+		keyer_tune(k, c[1] != 0, now_ns);
+		break;
+	case 0x0E:
+		w->mode = c[1];
+		break;
+	case 0x0F:
+		/* Mode, speed, sidetone, weight, lead, tail, min wpm, wpm range,
+		 * 1st extension, key comp, farnsworth, paddle setpoint, ratio,
+		 * pin config, pot range
+		 */
+		w->mode = c[1];
+		if (c[2] > 0)
+			k->wpm = c[2];
+		if (c[4] >= 10 && c[4] <= 90)
+			k->weight = c[4];
+		k->lead_ms = c[5] * 10;
+		k->tail_ms = c[6] * 10;
+		k->comp_ms = c[10];
+		if (c[13] >= 33 && c[13] <= 66)
+			k->ratio = c[13];
+		set_pincfg(w, c[14]);
+		break;
+	case 0x11:
+		k->comp_ms = c[1];
+		break;
+	case 0x15:
+		reply_byte(w, status_byte(w));
+		break;
+	case 0x17:
+		if (c[1] >= 33 && c[1] <= 66)
+			k->ratio = c[1];
+		break;
+	case KEYER_PTT:
+	case KEYER_KEY:
+	case KEYER_WAIT:
+	case KEYER_MERGE:
+	case KEYER_SPEED:
+	case KEYER_HSCW:
+	case KEYER_UNSPEED:
+	case KEYER_NOP:
+		/* In order with the text */
+		if (k->count + w->cmd_len <= KEYER_BUFSIZE)
+			for (i = 0; i < w->cmd_len; i++)
+				keyer_put(k, c[i]);
+		break;
+	default:
+		/* Sidetone, speed pot, HSCW, farnsworth, 1st extension, paddle
+		 * switchpoint, software paddle, null, buffer pointers
+		 */
+		break;
+	}
+}
+
+/* Take whatever the host has sent */
+void winkey_poll(winkey * w, long long now_ns)
+{
+	unsigned char data[256];
+	unsigned char b;
+	int n;
+	int i;
+
+	while ((n = read(w->fd, data, sizeof(data))) > 0)
+		for (i = 0; i < n; i++)
+		{
+			b = data[i];
+			w->bytes++;
+			if (w->skip > 0)
+			{
+				w->skip--;
+				continue;
+			}
+
+			if (w->cmd_len == 0)
+			{
+				if (b >= 0x20)
+				{
+					keyer_put(w->k, b);
+					continue;
+				}
+				w->cmd_need = cmd_len[b];
+			}
+			w->cmd[w->cmd_len++] = b;
+
+			/* Commands whose length depends on their first argument */
+			if (w->cmd_len == 2 && w->cmd[0] == 0x00)
+			{
+				if (b == 0 || b == 4 || b == 14 || b == 15 || b == 22 || b == 25)
+					w->cmd_need = 3;
+				else if (b == 13)
+					w->skip = 256;
+			}
+			if (w->cmd_len == 2 && w->cmd[0] == 0x16 && b == 3)
+				w->cmd_need = 3;
+
+			if (w->cmd_len >= w->cmd_need)
+			{
+				command(w, now_ns);
+				w->cmd_len = 0;
+			}
+		}
+}
+
+/* Tell the host what changed since the last keyer_run() */
+void winkey_update(winkey * w)
+{
+	int s;
+
+	if (w->host && (w->mode & WK_ECHO) && w->k->n_sent > 0)
+		reply(w, w->k->sent, w->k->n_sent);
+	w->k->n_sent = 0;
+
+	s = status_byte(w);
+	if (w->host && s != w->status)
+		reply_byte(w, s);
+	w->status = s;
+}
+
+void winkey_close(winkey * w)
+{
+	if (w->fd < 0)
+		return;
+	unlink(w->link);
+	close(w->slave);
+	close(w->fd);
+	w->fd = -1;
+}
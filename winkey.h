@@ -0,0 +1,54 @@
+/* winkey.h - WinKeyer host protocol on a pseudo terminal.
+
+*/
+
+#ifndef __WINKEY_H__
+#define __WINKEY_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ptt.h"
+#include "keyer.h"
+
+#define WK_VERSION			23			// Reported on host open, WK2.3
+#define WK_STATUS			0xC0		// Status byte, with these bits
+#define WK_XOFF				0x01		// Buffer more than 2/3 full
+#define WK_BREAKIN			0x02		// Paddle break-in, never set here
+#define WK_BUSY				0x04		// Sending
+#define WK_KEYDOWN			0x08		// Key immediate down
+#define WK_WAIT				0x10		// Waiting for the buffer to drain
+#define WK_ECHO				0x04		// Mode register: echo sent characters
+#define WK_PTT_ENABLE		0x01		// Pin config: key PTT
+
+typedef struct
+{
+	int fd;						// pty master, non-blocking
+	int slave;					// Held open so the master never reads EIO
+	char link[128];				// Symlink to the slave, for the logger
+	keyer * k;
+	int host;					// Host mode is open
+	int mode;					// WinKeyer mode register
+	int pincfg;					// Pin configuration
+	unsigned char cmd[20];		// Command being collected
+	int cmd_len;
+	int cmd_need;				// Bytes the command takes, with its own
+	int skip;					// Bytes of an ignored command still to come
+	int status;					// Status byte last sent, -1 for none
+	unsigned long bytes;		// Bytes from the host
+	unsigned long commands;		// Commands from the host
+} winkey;
+
+int winkey_open(winkey * w, keyer * k, const char * link);
+void winkey_adopt(winkey * w, keyer * k, const winkey * old);
+void winkey_poll(winkey * w, long long now_ns);
+void winkey_update(winkey * w);
+void winkey_close(winkey * w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WINKEY_H__ */